@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+#include "linenoise.h"
+#include "ir.h"
+#include "jit.h"
+#include "io.h"
+#include "tui.h"
+#include "sym.h"
+#include "pace.h"
+#include "heat.h"
+#include "prof.h"
+#include "latency.h"
+#include "taint.h"
+#include "smp.h"
+#include "outmatch.h"
+#include "native.h"
+
+#define SCRIPT_DEPTH 16 // sourcing deeper than this is probably a file sourcing itself
+#define HOOK_MAX 32
+
+uint8_t breakpoints[MEMORY_MAX];
+int breakpoint_count;
+
+static FILE* scripts[SCRIPT_DEPTH];
+static int nscripts;
+
+static char* hooks[HOOK_MAX];
+static int nhooks;
+static int in_hook;
+
+// what a command wants done once it's finished
+enum {
+	STAY = -1 // read another command
+};
+
+int parse_address(const char* text, uint16_t* out) {
+	// from the address, remove the leading 0x, if any
+	char address[5];
+	address[4] = '\0'; // add null terminator so we can use stdlib stuff without crashing
+	if (strlen(text) == 6) {
+		for (int i = 0; i < 4; i++) {
+			address[i] = text[i+2];
+		}
+	} else if (strlen(text) == 4) {
+		for (int i = 0; i < 4; i++) {
+			address[i] = text[i];
+		}
+	} else {
+		printf("Unrecognized address; use format 0xA2B4 or BE1F\n");
+		return 0;
+	}
+
+	// verify that the address is valid hex (https://stackoverflow.com/a/63006498)
+	unsigned hex_count = strspn(address, "0123456789ABCDEF");
+	if (address[hex_count]) {
+		printf("Address does not appear to be valid hex; use uppercase letters\n");
+		return 0;
+	}
+
+	// use sscanf to read into a uint16_t
+	unsigned address_u;
+	sscanf(address, "%04X", &address_u);
+	*out = address_u;
+	return 1;
+}
+
+// an address, or the name of a symbol
+static int parse_location(const char* text, uint16_t* out) {
+	if (sym_find(text, out)) return 1;
+	return parse_address(text, out);
+}
+
+int commands_source(const char* path) {
+	if (nscripts == SCRIPT_DEPTH) {
+		printf("Scripts are nested too deeply; not sourcing %s\n", path);
+		return 0;
+	}
+	FILE* file = fopen(path, "r");
+	if (!file) return 0;
+	scripts[nscripts++] = file;
+	return 1;
+}
+
+// the next command from a script, or from the keyboard once they've run out; NULL
+//	at the end of input (^C or ^D at the prompt)
+static char* next_command(int* from_keyboard) {
+	while (nscripts) {
+		char* line = NULL;
+		size_t cap = 0;
+		ssize_t n = getline(&line, &cap, scripts[nscripts - 1]);
+		if (n < 0) {
+			free(line);
+			fclose(scripts[--nscripts]);
+			continue;
+		}
+		while (n && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+
+		// blank lines and comments
+		const char* text = line + strspn(line, " \t");
+		if (!*text || *text == '#') {
+			free(line);
+			continue;
+		}
+		printf("(lc3vm) %s\n", line);
+		*from_keyboard = 0;
+		return line;
+	}
+
+	fflush(stdout); // someone's going to read it now
+	char* line = linenoise("(lc3vm) ");
+	if (line) linenoiseHistoryAdd(line);
+	*from_keyboard = 1;
+	return line;
+}
+
+static void print_help(void) {
+	printf("lc3vm commands:\n");
+	printf("help\t\t\t-- Print this help page.\n");
+	printf("continue\t\t-- Continue execution. Get back here with ^C.\n");
+	printf("step\t\t\t-- Step forward one instruction.\n");
+	printf("memory [addr] [n]\t-- Display n words of memory starting from addr.\n");
+	printf("reg\t\t\t-- Display the contents of the registers.\n");
+	printf("ir [addr]\t\t-- Show the IR for the block at addr (or the PC) before and after optimization.\n");
+	printf("metrics\t\t\t-- Display JIT, clock pacing, trap latency, core and native routine statistics.\n");
+	printf("tui\t\t\t-- Switch to the full-screen debugger.\n");
+	printf("heatmap\t\t\t-- Show the memory access heatmap so far (with --heatmap).\n");
+	printf("profile\t\t\t-- Show the hottest blocks and loops so far (with --profile).\n");
+	printf("taint\t\t\t-- Show which branches and output depended on input so far (with --taint).\n");
+	printf("break [addr|symbol]\t-- Stop before the instruction there runs in turbo mode; list them without one.\n");
+	printf("delete [addr|symbol]\t-- Remove that breakpoint, or all of them.\n");
+	printf("break-output [text...]\t-- Stop when the guest prints any of these (\\s is a space); list them without any.\n");
+	printf("break-output clear\t-- Remove all the output breakpoints.\n");
+	printf("hook [command]\t\t-- Run a command every time the VM stops here; list them without one.\n");
+	printf("hook clear\t\t-- Remove all the hooks.\n");
+	printf("source file\t\t-- Run the commands in a file, one per line (# starts a comment).\n");
+	printf("quit\t\t\t-- Exit.\n");
+
+	printf("\nPress ^C or ^D to exit. You can abbreviate commands with their first letters.\n");
+}
+
+static void print_registers(void) {
+	printf("R0:\t 0x%04hX\n", reg[R_R0]);
+	printf("R1:\t 0x%04hX\n", reg[R_R1]);
+	printf("R2:\t 0x%04hX\n", reg[R_R2]);
+	printf("R3:\t 0x%04hX\n", reg[R_R3]);
+	printf("R4:\t 0x%04hX\n", reg[R_R4]);
+	printf("R5:\t 0x%04hX\n", reg[R_R5]);
+	printf("R6:\t 0x%04hX\n", reg[R_R6]);
+	printf("R7:\t 0x%04hX\n", reg[R_R7]);
+	printf("PC:\t 0x%04hX\n", reg[R_PC]);
+	printf("COND:\t 0x%04hX\n", reg[R_COND]);
+}
+
+static void print_memory(const char* line) {
+	// verify that we have three chunks
+	int spaces = 0;
+	char last = 'a';
+	int consecutive = 0;
+	for (int i = 0; (unsigned) i < strlen(line); i++) {
+		if (line[i] == ' ') {
+			spaces++;
+			if (last == ' ') {
+				consecutive = 1;
+				break; // this condition is an error already
+			}
+		}
+		last = line[i];
+	}
+
+	// must have exactly two spaces, they can't be consecutive,
+	//	and the last character can't be a space
+	if (spaces != 2 || consecutive || line[strlen(line)-1] == ' ') {
+		printf("Invalid format for memory command; type 'help' for help\n");
+		return;
+	}
+
+	// split the input into three chunks
+	char* line_buffer = strdup(line); // avoid clobbering the actual line in case we want to use it
+	char* chunks[3];
+
+	chunks[0] = strtok(line_buffer, " ");
+	chunks[1] = strtok(NULL, " ");
+	chunks[2] = strtok(NULL, " ");
+
+	uint16_t address16;
+	if (!parse_address(chunks[1], &address16)) {
+		free(line_buffer);
+		return;
+	}
+
+	// determine what n is after verifying that it's valid decimal
+	unsigned dec_count = strspn(chunks[2], "0123456789");
+	if (chunks[2][dec_count]) {
+		printf("Number of words does not appear to be valid decimal\n");
+		free(line_buffer);
+		return;
+	}
+
+	int n;
+	sscanf(chunks[2], "%d", &n);
+
+	// straight from memory: looking at KBSR mustn't take the guest's key or count as a poll
+	for (int i = 0; i < n; i++) {
+		printf("Address 0x%04hX: 0x%04hX\n", address16 + i, memory[(uint16_t) (address16 + i)]);
+	}
+
+	free(line_buffer); // avoid memory leak
+}
+
+static void print_ir(const char* line, uint16_t instr_address) {
+	uint16_t address16 = instr_address;
+	const char* argument = strchr(line, ' ');
+	if (argument && !parse_address(argument + 1, &address16)) return;
+
+	static struct ir_block block;
+	if (!ir_build(&block, memory + address16, address16)) {
+		printf("Nothing to translate at 0x%04hX (traps and illegal opcodes stay in the interpreter)\n", address16);
+		return;
+	}
+	printf("Before optimization:\n");
+	ir_dump(&block, stdout);
+	ir_optimize(&block);
+	printf("\nAfter optimization:\n");
+	ir_dump(&block, stdout);
+}
+
+static void print_breakpoint(uint16_t address) {
+	char name[80];
+	sym_format(address, name, sizeof(name));
+	printf("Breakpoint at 0x%04hX%s%s%s\n", address, *name ? " (" : "", name, *name ? ")" : "");
+}
+
+static void set_breakpoint(const char* argument) {
+	if (!argument) {
+		if (!breakpoint_count) printf("No breakpoints.\n");
+		for (int i = 0; i < MEMORY_MAX; i++) {
+			if (breakpoints[i]) print_breakpoint(i);
+		}
+		return;
+	}
+	uint16_t address;
+	if (!parse_location(argument, &address)) return;
+	if (!breakpoints[address]) breakpoint_count++;
+	breakpoints[address] = 1;
+	print_breakpoint(address);
+}
+
+static void delete_breakpoint(const char* argument) {
+	if (!argument) {
+		memset(breakpoints, 0, sizeof(breakpoints));
+		breakpoint_count = 0;
+		printf("Deleted all breakpoints.\n");
+		return;
+	}
+	uint16_t address;
+	if (!parse_location(argument, &address)) return;
+	if (!breakpoints[address]) {
+		printf("No breakpoint at 0x%04hX\n", address);
+		return;
+	}
+	breakpoints[address] = 0;
+	breakpoint_count--;
+}
+
+// patterns are separated by spaces; use \s for a space inside one
+static void break_output(const char* argument) {
+	if (!argument) {
+		outmatch_list();
+		return;
+	}
+	if (!strcmp(argument, "clear")) {
+		outmatch_clear();
+		return;
+	}
+	char* patterns = strdup(argument);
+	for (char* pattern = strtok(patterns, " "); pattern; pattern = strtok(NULL, " ")) outmatch_add(pattern);
+	free(patterns);
+}
+
+static void add_hook(const char* argument) {
+	if (!argument) {
+		if (!nhooks) printf("No hooks.\n");
+		for (int i = 0; i < nhooks; i++) printf("%d: %s\n", i + 1, hooks[i]);
+	} else if (!strcmp(argument, "clear")) {
+		for (int i = 0; i < nhooks; i++) free(hooks[i]);
+		nhooks = 0;
+	} else if (nhooks == HOOK_MAX) {
+		printf("Too many hooks (at most %d)\n", HOOK_MAX);
+	} else {
+		hooks[nhooks++] = strdup(argument);
+	}
+}
+
+// run one command; returns STAY, or what to do with the fetched instruction
+static int dispatch(const char* line, uint16_t instr) {
+	const char* argument = strchr(line, ' ');
+	if (argument) {
+		argument += strspn(argument, " ");
+		if (!*argument) argument = NULL;
+	}
+
+	if (!strncmp(line, "heatmap", 7)) {
+		if (heat_enabled) heat_report(stdout);
+		else printf("Start lc3vm with --heatmap to count memory accesses.\n");
+	} else if (!strncmp(line, "hook", 4)) {
+		add_hook(argument);
+	} else if (!strncmp(line, "h", 1)) {
+		print_help();
+	} else if (!strncmp(line, "c", 1)) {
+		return CMD_CONTINUE;
+	} else if (!strncmp(line, "source", 6)) {
+		if (!argument) printf("Usage: source FILE\n");
+		else if (!commands_source(argument)) printf("Couldn't read commands from %s\n", argument);
+	} else if (!strncmp(line, "s", 1)) {
+		return CMD_STEP;
+	} else if (!strncmp(line, "r", 1)) {
+		print_registers();
+	} else if (!strncmp(line, "metrics", 7)) {
+		jit_print_stats(stdout);
+		pace_print_stats(stdout);
+		latency_print_stats(stdout);
+		smp_print_stats(stdout);
+		native_print_stats(stdout);
+	} else if (!strncmp(line, "p", 1)) {
+		if (prof_enabled) prof_report(stdout);
+		else printf("Start lc3vm with --profile to profile blocks and loops.\n");
+	} else if (!strncmp(line, "m", 1)) {
+		print_memory(line);
+	} else if (!strncmp(line, "break-output", 12)) {
+		break_output(argument);
+	} else if (!strncmp(line, "b", 1)) {
+		set_breakpoint(argument);
+	} else if (!strncmp(line, "d", 1)) {
+		delete_breakpoint(argument);
+	} else if (!strncmp(line, "q", 1)) {
+		return CMD_QUIT;
+	} else if (!strncmp(line, "taint", 5)) {
+		if (taint_enabled) taint_report(stdout);
+		else printf("Start lc3vm with --taint to track input through the program.\n");
+	} else if (!strncmp(line, "t", 1)) {
+		if (in_hook) {
+			printf("Hooks can't switch to the full-screen debugger\n");
+			return STAY;
+		}
+		fflush(stdout); // the TUI writes to the terminal directly
+		disable_input_buffering();
+		tui_enter();
+		if (tui_step() == TUI_RUN) return CMD_STEP;
+		restore_input_buffering();
+		printf("\nFetched instruction from 0x%04hX, containing 0x%04hX.\n", reg[R_PC]-1, instr);
+	} else if (!strncmp(line, "i", 1)) {
+		print_ir(line, reg[R_PC] - 1); // the instruction we just fetched
+	} else {
+		printf("Unrecognized command: %s (type 'help' for help)\n", line);
+	}
+	return STAY;
+}
+
+int command_prompt(uint16_t instr) {
+	restore_input_buffering();
+	printf("\nFetched instruction from 0x%04hX, containing 0x%04hX.\n", reg[R_PC]-1, instr);
+
+	in_hook = 1;
+	for (int i = 0; i < nhooks; i++) {
+		if (dispatch(hooks[i], instr) != STAY) printf("Hooks can't step, continue or quit: %s\n", hooks[i]);
+	}
+	in_hook = 0;
+
+	while (1) {
+		// get user command
+		int from_keyboard;
+		char* line = next_command(&from_keyboard);
+
+		// linenoise intercepts ^C, so if it receives that, we need to restore and exit
+		if (line == NULL) return CMD_QUIT;
+
+		int action = dispatch(line, instr);
+
+		// don't leak the line buffer
+		if (from_keyboard) linenoiseFree(line);
+		else free(line);
+		if (action != STAY) return action;
+		disable_input_buffering();
+	}
+}
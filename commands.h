@@ -0,0 +1,37 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stdint.h>
+
+#include "lc3.h"
+
+// The (lc3vm) prompt. Commands come from the keyboard through linenoise, or from
+//	script files (--commands, or `source` at the prompt), which are read first and
+//	echoed as if they'd been typed. While a script is running, stdout is fully
+//	buffered and only flushed when we're about to wait for someone. Hooks are
+//	commands that run every time the VM stops at the prompt.
+
+// what to do with the instruction that was just fetched
+enum {
+	CMD_STEP = 0,	// execute it and stop again
+	CMD_CONTINUE,	// execute it and carry on in turbo mode
+	CMD_QUIT	// exit the VM
+};
+
+extern uint8_t breakpoints[MEMORY_MAX];
+extern int breakpoint_count;
+
+static inline int at_breakpoint(uint16_t pc) {
+	return breakpoint_count && breakpoints[pc];
+}
+
+// read an address in the format 0xA2B4 or BE1F, complaining and returning 0 if it's malformed
+int parse_address(const char* text, uint16_t* out);
+
+// queue up the commands in a file; 0 if it can't be read
+int commands_source(const char* path);
+
+// stop at the prompt with `instr` fetched but not yet executed
+int command_prompt(uint16_t instr);
+
+#endif
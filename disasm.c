@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lc3.h"
+#include "disasm.h"
+
+static const char* trap_names[] = { "GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT" };
+
+void disassemble(uint16_t address, uint16_t instr, char* out, size_t size) {
+	uint16_t next = address + 1;
+	uint16_t r9 = (instr >> 9) & 0x7;
+	uint16_t r6 = (instr >> 6) & 0x7;
+	uint16_t target9 = next + sign_extend(instr & 0x1FF, 9);
+	int16_t offset6 = (int16_t) sign_extend(instr & 0x3F, 6);
+
+	switch (instr >> 12) {
+	case OP_ADD:
+	case OP_AND:
+		if ((instr >> 5) & 0x1) {
+			snprintf(out, size, "%s R%d, R%d, #%d", (instr >> 12) == OP_ADD ? "ADD" : "AND",
+				r9, r6, (int16_t) sign_extend(instr & 0x1F, 5));
+		} else {
+			snprintf(out, size, "%s R%d, R%d, R%d", (instr >> 12) == OP_ADD ? "ADD" : "AND", r9, r6, instr & 0x7);
+		}
+		break;
+	case OP_NOT:
+		snprintf(out, size, "NOT R%d, R%d", r9, r6);
+		break;
+	case OP_BR:
+		if (r9 == 0) {
+			snprintf(out, size, "NOP");
+		} else {
+			snprintf(out, size, "BR%s%s%s x%04X", r9 & FL_NEG ? "n" : "", r9 & FL_ZRO ? "z" : "",
+				r9 & FL_POS ? "p" : "", target9);
+		}
+		break;
+	case OP_JMP:
+		if (r6 == R_R7) {
+			snprintf(out, size, "RET");
+		} else {
+			snprintf(out, size, "JMP R%d", r6);
+		}
+		break;
+	case OP_JSR:
+		if ((instr >> 11) & 1) {
+			snprintf(out, size, "JSR x%04X", (uint16_t) (next + sign_extend(instr & 0x7FF, 11)));
+		} else {
+			snprintf(out, size, "JSRR R%d", r6);
+		}
+		break;
+	case OP_LD:	snprintf(out, size, "LD R%d, x%04X", r9, target9); break;
+	case OP_LDI:	snprintf(out, size, "LDI R%d, x%04X", r9, target9); break;
+	case OP_LEA:	snprintf(out, size, "LEA R%d, x%04X", r9, target9); break;
+	case OP_ST:	snprintf(out, size, "ST R%d, x%04X", r9, target9); break;
+	case OP_STI:	snprintf(out, size, "STI R%d, x%04X", r9, target9); break;
+	case OP_LDR:	snprintf(out, size, "LDR R%d, R%d, #%d", r9, r6, offset6); break;
+	case OP_STR:	snprintf(out, size, "STR R%d, R%d, #%d", r9, r6, offset6); break;
+	case OP_TRAP:
+		if ((instr & 0xFF) >= TRAP_GETC && (instr & 0xFF) <= TRAP_HALT) {
+			snprintf(out, size, "%s", trap_names[(instr & 0xFF) - TRAP_GETC]);
+		} else {
+			snprintf(out, size, "TRAP x%02X", instr & 0xFF);
+		}
+		break;
+	case OP_RTI:
+		snprintf(out, size, "RTI");
+		break;
+	default:
+		snprintf(out, size, ".FILL x%04X", instr);
+		break;
+	}
+}
@@ -0,0 +1,11 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// write the assembly for `instr`, fetched from `address`, into `out`
+//	(e.g. "ADD R1, R1, #-1" or "BRnp x3004"); branch targets are absolute
+void disassemble(uint16_t address, uint16_t instr, char* out, size_t size);
+
+#endif
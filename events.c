@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3.h"
+#include "events.h"
+
+static FILE* stream;
+static int stream_format;
+static uint64_t next_seq;
+
+static int sets_flags(uint16_t instr) {
+	switch (instr >> 12) {
+	case OP_ADD:
+	case OP_AND:
+	case OP_NOT:
+	case OP_LD:
+	case OP_LDI:
+	case OP_LDR:
+	case OP_LEA:
+		return 1;
+	case OP_TRAP:
+		return (instr & 0xFF) == TRAP_GETC || (instr & 0xFF) == TRAP_IN;
+	default:
+		return 0;
+	}
+}
+
+// zero everything but the buffer for memory changes
+static void clear(struct step_event* ev) {
+	struct event_mem* mem = ev->mem;
+	uint32_t capacity = ev->mem_capacity;
+	memset(ev, 0, sizeof(*ev));
+	ev->mem = mem;
+	ev->mem_capacity = capacity;
+}
+
+static void reserve(struct step_event* ev, uint32_t n) {
+	if (n <= ev->mem_capacity) return;
+	uint32_t capacity = ev->mem_capacity ? ev->mem_capacity : 8;
+	while (capacity < n) capacity *= 2;
+	ev->mem = realloc(ev->mem, capacity * sizeof(*ev->mem));
+	ev->mem_capacity = capacity;
+}
+
+void event_add_mem(struct step_event* ev, uint16_t address, uint16_t from, uint16_t to) {
+	reserve(ev, ev->nmem + 1);
+	ev->mem[ev->nmem].address = address;
+	ev->mem[ev->nmem].from = from;
+	ev->mem[ev->nmem].to = to;
+	ev->nmem++;
+}
+
+void event_copy(struct step_event* to, const struct step_event* from) {
+	struct event_mem* mem = to->mem;
+	uint32_t capacity = to->mem_capacity;
+	*to = *from;
+	to->mem = mem;
+	to->mem_capacity = capacity;
+	reserve(to, from->nmem);
+	if (from->nmem) memcpy(to->mem, from->mem, from->nmem * sizeof(*from->mem));
+}
+
+void event_decode_fields(struct step_event* ev, uint16_t pc, uint16_t instr,
+	const uint16_t* previous_memory, const uint16_t* previous_reg) {
+	clear(ev);
+	ev->pc = pc;
+	ev->instr = instr;
+	ev->op = instr >> 12;
+	ev->cond = reg[R_COND];
+
+	uint16_t next = pc + 1; // what the PC reads as while the instruction runs
+	uint16_t r9 = (instr >> 9) & 0x7;
+	uint16_t r6 = (instr >> 6) & 0x7;
+	uint16_t offset9 = sign_extend(instr & 0x1FF, 9);
+	uint16_t offset6 = sign_extend(instr & 0x3F, 6);
+
+	switch (ev->op) {
+	case OP_ADD:
+	case OP_AND:
+		ev->dr = r9;
+		ev->sr = r6;
+		ev->fields = EV_DR | EV_SR;
+		if ((instr >> 5) & 0x1) {
+			ev->imm = sign_extend(instr & 0x1F, 5);
+			ev->fields |= EV_IMM;
+		} else {
+			ev->sr2 = instr & 0x7;
+			ev->fields |= EV_SR2;
+		}
+		break;
+	case OP_NOT:
+		ev->dr = r9;
+		ev->sr = r6;
+		ev->fields = EV_DR | EV_SR;
+		break;
+	case OP_BR:
+		ev->nzp = r9;
+		ev->imm = offset9;
+		ev->fields = EV_NZP | EV_IMM;
+		if (r9 & previous_reg[R_COND]) ev->fields |= EV_TAKEN;
+		break;
+	case OP_JMP:
+		ev->base = r6;
+		ev->fields = EV_BASE;
+		break;
+	case OP_JSR:
+		if ((instr >> 11) & 1) {
+			ev->imm = sign_extend(instr & 0x7FF, 11);
+			ev->fields = EV_IMM;
+		} else {
+			ev->base = r6;
+			ev->fields = EV_BASE;
+		}
+		break;
+	case OP_LD:
+	case OP_LEA:
+		ev->dr = r9;
+		ev->imm = offset9;
+		ev->address = next + offset9;
+		ev->fields = EV_DR | EV_IMM | EV_ADDRESS;
+		break;
+	case OP_LDI:
+		ev->dr = r9;
+		ev->imm = offset9;
+		ev->pointer = next + offset9;
+		ev->address = previous_memory[ev->pointer];
+		ev->fields = EV_DR | EV_IMM | EV_POINTER | EV_ADDRESS;
+		break;
+	case OP_LDR:
+		ev->dr = r9;
+		ev->base = r6;
+		ev->imm = offset6;
+		ev->address = previous_reg[r6] + offset6;
+		ev->fields = EV_DR | EV_BASE | EV_IMM | EV_ADDRESS;
+		break;
+	case OP_ST:
+		ev->sr = r9;
+		ev->imm = offset9;
+		ev->address = next + offset9;
+		ev->fields = EV_SR | EV_IMM | EV_ADDRESS;
+		break;
+	case OP_STI:
+		ev->sr = r9;
+		ev->imm = offset9;
+		ev->pointer = next + offset9;
+		ev->address = previous_memory[ev->pointer];
+		ev->fields = EV_SR | EV_IMM | EV_POINTER | EV_ADDRESS;
+		break;
+	case OP_STR:
+		ev->sr = r9;
+		ev->base = r6;
+		ev->imm = offset6;
+		ev->address = previous_reg[r6] + offset6;
+		ev->fields = EV_SR | EV_BASE | EV_IMM | EV_ADDRESS;
+		break;
+	case OP_TRAP:
+		ev->trap = instr & 0xFF;
+		ev->fields = EV_TRAP;
+		break;
+	}
+	if (ev->fields & EV_DR) ev->result = reg[ev->dr];
+	if (sets_flags(instr)) ev->fields |= EV_COND;
+}
+
+void event_add_regs(struct step_event* ev, const uint16_t* previous_reg) {
+	for (int i = 0; i < R_COUNT; i++) {
+		if (reg[i] != previous_reg[i]) {
+			ev->regs[ev->nreg].reg = i;
+			ev->regs[ev->nreg].from = previous_reg[i];
+			ev->regs[ev->nreg].to = reg[i];
+			ev->nreg++;
+		}
+	}
+}
+
+void event_decode(struct step_event* ev, uint16_t pc, uint16_t instr,
+	const uint16_t* previous_memory, const uint16_t* previous_reg) {
+	event_decode_fields(ev, pc, instr, previous_memory, previous_reg);
+	ev->seq = next_seq++;
+
+	// memcmp a page at a time and only look closer at the ones that changed
+	for (int page = 0; page < MEMORY_MAX; page += 256) {
+		if (!memcmp(memory + page, previous_memory + page, 256 * sizeof(uint16_t))) continue;
+		for (int i = page; i < page + 256; i++) {
+			if (memory[i] != previous_memory[i]) event_add_mem(ev, i, previous_memory[i], memory[i]);
+		}
+	}
+	event_add_regs(ev, previous_reg);
+}
+
+const char* event_mnemonic(uint16_t instr) {
+	static const char* names[16] = {
+		"BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+		"RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+	};
+	uint16_t op = instr >> 12;
+	if (op == OP_JSR && !((instr >> 11) & 1)) return "JSRR";
+	if (op == OP_JMP && ((instr >> 6) & 0x7) == R_R7) return "RET";
+	return names[op];
+}
+
+static const char* trap_name(uint16_t vector) {
+	switch (vector) {
+	case TRAP_GETC: return "GETC";
+	case TRAP_OUT: return "OUT";
+	case TRAP_PUTS: return "PUTS";
+	case TRAP_IN: return "IN";
+	case TRAP_PUTSP: return "PUTSP";
+	case TRAP_HALT: return "HALT";
+	default: return "?";
+	}
+}
+
+static const char* reg_name(uint8_t r) {
+	static const char* names[R_COUNT] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND" };
+	return names[r];
+}
+
+void event_render_text(const struct step_event* ev, FILE* out) {
+	switch (ev->op) {
+	case OP_ADD:
+		if (ev->fields & EV_IMM) {
+			fprintf(out, "ADDed 0x%04hX (SR1) to 0x%04hX (SEXT(imm5)) and stored 0x%04hX (result) in 0x%04hX (DR).\n", ev->sr, ev->imm, ev->result, ev->dr);
+		} else {
+			fprintf(out, "ADDed 0x%04hX (SR1) to 0x%04hX (SR2) and stored 0x%04hX (result) in 0x%04hX (DR).\n", ev->sr, ev->sr2, ev->result, ev->dr);
+		}
+		break;
+	case OP_AND:
+		if (ev->fields & EV_IMM) {
+			fprintf(out, "ANDed 0x%04hX (SR1) with 0x%04hX (SEXT(imm5)) and stored 0x%04hX (result) in 0x%04hX (DR).\n", ev->sr, ev->imm, ev->result, ev->dr);
+		} else {
+			fprintf(out, "ANDed 0x%04hX (SR1) with 0x%04hX (SR2) and stored 0x%04hX (result) in 0x%04hX (DR).\n", ev->sr, ev->sr2, ev->result, ev->dr);
+		}
+		break;
+	case OP_NOT:
+		fprintf(out, "NOTed 0x%04hX (SR) and stored 0x%04hX (result) in 0x%04hX (DR).\n", ev->sr, ev->result, ev->dr);
+		break;
+	case OP_BR:
+		if (ev->fields & EV_TAKEN) {
+			fprintf(out, "Took BRanch with flag 0x%04hX (n/z/p cond flag) and added 0x%04hX (SEXT(PCoffset9)) to PC.\n", ev->nzp, ev->imm);
+		} else {
+			fprintf(out, "Did not take BRanch with flag 0x%04hX (n/z/p cond flag) and offset 0x%04hX (SEXT(PCoffset9)).\n", ev->nzp, ev->imm);
+		}
+		break;
+	case OP_JMP:
+		fprintf(out, "JMPed (or maybe RETed) to address at contents of 0x%04hX (BaseR).\n", ev->base);
+		break;
+	case OP_JSR:
+		if (ev->fields & EV_IMM) {
+			fprintf(out, "JSRed to PC + 0x%04hX (SEXT(PCoffset11)) and stored incremented PC in R7.\n", ev->imm);
+		} else {
+			fprintf(out, "JSRRed to address at contents of 0x%04hX (BaseR) and stored incremented PC in R7.\n", ev->base);
+		}
+		break;
+	case OP_LD:
+		fprintf(out, "LDed contents of address PC + 0x%04hX (SEXT(PCoffset9)) into 0x%04hX (DR).\n", ev->imm, ev->dr);
+		break;
+	case OP_LDI:
+		fprintf(out, "LDIed contents of address at contents of address PC + 0x%04hX (SEXT(PCoffset9)) into 0x%04hX (DR).\n", ev->imm, ev->dr);
+		break;
+	case OP_LDR:
+		fprintf(out, "LDRed contents of address at register 0x%04hX (BaseR) + 0x%04hX (SEXT(offset6)) into 0x%04hX (DR).\n", ev->base, ev->imm, ev->dr);
+		break;
+	case OP_LEA:
+		fprintf(out, "LEAed address (not contents of addr.) PC + 0x%04hX (SEXT(PCoffset9)) into 0x%04hX (DR).\n", ev->imm, ev->dr);
+		break;
+	case OP_ST:
+		fprintf(out, "STed contents of register 0x%04hX (SR) into address PC + 0x%04hX (SEXT(PCoffset9)) = 0x%04hX.\n", ev->sr, ev->imm, ev->address);
+		break;
+	case OP_STI:
+		fprintf(out, "STIed contents of register 0x%04hX (SR) into address at contents of address PC + 0x%04hX (SEXT(PCoffset9)).\n", ev->sr, ev->imm);
+		break;
+	case OP_STR:
+		fprintf(out, "STRed contents of register 0x%04hX (SR) into address 0x%04hX (SEXT(offset6)) + 0x%04hX (BaseR).\n", ev->sr, ev->imm, ev->base);
+		break;
+	}
+	if (ev->fields & EV_COND) fprintf(out, "Set R_COND to 0x%04hX.\n", ev->cond);
+	if (ev->op == OP_TRAP) fprintf(out, "TRAPed with vector 0x%04hX.\n", ev->trap);
+
+	// show changes to memory and registers caused by the instruction
+	for (uint32_t i = 0; i < ev->nmem; i++) {
+		fprintf(out, "Changed memory at address 0x%04hX from 0x%04hX to 0x%04hX.\n", ev->mem[i].address, ev->mem[i].from, ev->mem[i].to);
+	}
+
+	for (int i = 0; i < ev->nreg; i++) {
+		if (ev->regs[i].reg == R_PC) {
+			fprintf(out, "Changed PC from 0x%04hX to 0x%04hX.\n", ev->regs[i].from, ev->regs[i].to);
+		} else if (ev->regs[i].reg == R_COND) {
+			fprintf(out, "Changed COND from 0x%04hX to 0x%04hX.\n", ev->regs[i].from, ev->regs[i].to);
+		} else {
+			fprintf(out, "Changed register 0x%04hX from 0x%04hX to 0x%04hX.\n", ev->regs[i].reg, ev->regs[i].from, ev->regs[i].to);
+		}
+	}
+}
+
+void event_write_json(const struct step_event* ev, FILE* out) {
+	fprintf(out, "{\"seq\":%llu,\"pc\":%u,\"instr\":%u,\"op\":\"%s\"",
+		(unsigned long long) ev->seq, ev->pc, ev->instr, event_mnemonic(ev->instr));
+	if (ev->fields & EV_DR) fprintf(out, ",\"dr\":%u,\"result\":%u", ev->dr, ev->result);
+	if (ev->fields & EV_SR) fprintf(out, ",\"sr\":%u", ev->sr);
+	if (ev->fields & EV_SR2) fprintf(out, ",\"sr2\":%u", ev->sr2);
+	if (ev->fields & EV_BASE) fprintf(out, ",\"base\":%u", ev->base);
+	if (ev->fields & EV_IMM) fprintf(out, ",\"imm\":%d", (int16_t) ev->imm);
+	if (ev->fields & EV_ADDRESS) fprintf(out, ",\"address\":%u", ev->address);
+	if (ev->fields & EV_POINTER) fprintf(out, ",\"pointer\":%u", ev->pointer);
+	if (ev->fields & EV_NZP) {
+		fprintf(out, ",\"nzp\":\"%s%s%s\",\"taken\":%s", ev->nzp & FL_NEG ? "n" : "", ev->nzp & FL_ZRO ? "z" : "",
+			ev->nzp & FL_POS ? "p" : "", ev->fields & EV_TAKEN ? "true" : "false");
+	}
+	if (ev->fields & EV_TRAP) fprintf(out, ",\"trap\":%u,\"trap_name\":\"%s\"", ev->trap, trap_name(ev->trap));
+	if (ev->fields & EV_COND) fprintf(out, ",\"cond\":%u", ev->cond);
+
+	fprintf(out, ",\"regs\":[");
+	for (int i = 0; i < ev->nreg; i++) {
+		fprintf(out, "%s{\"reg\":\"%s\",\"from\":%u,\"to\":%u}", i ? "," : "",
+			reg_name(ev->regs[i].reg), ev->regs[i].from, ev->regs[i].to);
+	}
+	fprintf(out, "],\"mem\":[");
+	for (uint32_t i = 0; i < ev->nmem; i++) {
+		fprintf(out, "%s{\"address\":%u,\"from\":%u,\"to\":%u}", i ? "," : "",
+			ev->mem[i].address, ev->mem[i].from, ev->mem[i].to);
+	}
+	fprintf(out, "]}\n");
+}
+
+// Binary framing, all little-endian. The stream starts with "LC3E" and a u16
+//	version, then each event is a u16 length (of the rest of the record) and:
+//	  u64 seq, u16 pc, u16 instr, u16 fields, u16 cond
+//	  a u16 for each field bit that's set, in bit order (dr, sr, sr2, base, imm,
+//	    address, pointer, nzp, trap; taken and cond carry no payload), except
+//	    that dr is followed by a second u16 with the value written to it
+//	  u8 nreg, then nreg * (u8 reg, u16 from, u16 to)
+//	  u8 nmem, then nmem * (u16 address, u16 from, u16 to)
+//	Records too long for the u16 (bulk traps) have 0xFFFF there and a u32 length
+//	after it, and 255 or more memory changes are a 255 nmem and a u32 count.
+//	Version 1 streams are the same, but never needed either.
+#define EVENTS_VERSION 2
+#define LONG16 0xFFFF
+#define LONG8 0xFF
+
+static size_t put16(uint8_t* p, uint16_t v) {
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+	return 2;
+}
+
+static size_t put32(uint8_t* p, uint32_t v) {
+	for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+	return 4;
+}
+
+// big enough for any record, grown for the ones with lots of memory changes
+static uint8_t* record_buffer(size_t size) {
+	static uint8_t* buffer;
+	static size_t capacity;
+	if (size > capacity) {
+		capacity = size;
+		buffer = realloc(buffer, capacity);
+	}
+	return buffer;
+}
+
+void event_write_binary(const struct step_event* ev, FILE* out) {
+	uint8_t* buffer = record_buffer(6 + 16 + 10 * 2 + 1 + R_COUNT * 5 + 5 + (size_t) ev->nmem * 6);
+	size_t n = 6; // room for the long form of the length; the short form moves up
+	for (int i = 0; i < 8; i++) buffer[n++] = (ev->seq >> (8 * i)) & 0xFF;
+	n += put16(buffer + n, ev->pc);
+	n += put16(buffer + n, ev->instr);
+	n += put16(buffer + n, ev->fields);
+	n += put16(buffer + n, ev->cond);
+
+	const uint16_t values[] = { ev->dr, ev->sr, ev->sr2, ev->base, ev->imm, ev->address, ev->pointer, ev->nzp };
+	for (int i = 0; i < 8; i++) {
+		if (ev->fields & (1 << i)) n += put16(buffer + n, values[i]);
+		if (i == 0 && (ev->fields & EV_DR)) n += put16(buffer + n, ev->result);
+	}
+	if (ev->fields & EV_TRAP) n += put16(buffer + n, ev->trap);
+
+	buffer[n++] = ev->nreg;
+	for (int i = 0; i < ev->nreg; i++) {
+		buffer[n++] = ev->regs[i].reg;
+		n += put16(buffer + n, ev->regs[i].from);
+		n += put16(buffer + n, ev->regs[i].to);
+	}
+	if (ev->nmem < LONG8) {
+		buffer[n++] = ev->nmem;
+	} else {
+		buffer[n++] = LONG8;
+		n += put32(buffer + n, ev->nmem);
+	}
+	for (uint32_t i = 0; i < ev->nmem; i++) {
+		n += put16(buffer + n, ev->mem[i].address);
+		n += put16(buffer + n, ev->mem[i].from);
+		n += put16(buffer + n, ev->mem[i].to);
+	}
+
+	size_t length = n - 6;
+	if (length < LONG16) {
+		put16(buffer + 4, length);
+		fwrite(buffer + 4, 1, length + 2, out);
+	} else {
+		put16(buffer, LONG16);
+		put32(buffer + 2, length);
+		fwrite(buffer, 1, n, out);
+	}
+}
+
+static uint16_t get16(const uint8_t* p) {
+	return p[0] | p[1] << 8;
+}
+
+int event_read_header(FILE* in) {
+	uint8_t header[6];
+	if (fread(header, 1, sizeof(header), in) != sizeof(header)) return 0;
+	return !memcmp(header, "LC3E", 4) && get16(header + 4) >= 1 && get16(header + 4) <= EVENTS_VERSION;
+}
+
+static uint32_t get32(const uint8_t* p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+int event_read_binary(struct step_event* ev, FILE* in) {
+	uint8_t prefix[4];
+	size_t got = fread(prefix, 1, 2, in);
+	if (got == 0) return 0;
+	if (got != 2) return -1;
+	size_t length = get16(prefix);
+	if (length == LONG16) {
+		if (fread(prefix, 1, 4, in) != 4) return -1;
+		length = get32(prefix);
+	}
+	// no record is longer than every word of memory changing
+	if (length < 16 + 2 || length > 64 + (size_t) MEMORY_MAX * 6) return -1;
+	uint8_t* buffer = record_buffer(length);
+	if (fread(buffer, 1, length, in) != length) return -1;
+
+	clear(ev);
+	const uint8_t* p = buffer;
+	const uint8_t* end = p + length;
+	for (int i = 0; i < 8; i++) ev->seq |= (uint64_t) p[i] << (8 * i);
+	p += 8;
+	ev->pc = get16(p);
+	ev->instr = get16(p + 2);
+	ev->op = ev->instr >> 12;
+	ev->fields = get16(p + 4);
+	ev->cond = get16(p + 6);
+	p += 8;
+
+	uint16_t* values[] = { &ev->dr, &ev->sr, &ev->sr2, &ev->base, &ev->imm, &ev->address, &ev->pointer, &ev->nzp };
+	for (int i = 0; i < 8; i++) {
+		if (ev->fields & (1 << i)) {
+			if (p + 2 > end) return -1;
+			*values[i] = get16(p);
+			p += 2;
+		}
+		if (i == 0 && (ev->fields & EV_DR)) {
+			if (p + 2 > end) return -1;
+			ev->result = get16(p);
+			p += 2;
+		}
+	}
+	if (ev->fields & EV_TRAP) {
+		if (p + 2 > end) return -1;
+		ev->trap = get16(p);
+		p += 2;
+	}
+
+	if (p + 1 > end) return -1;
+	ev->nreg = *p++;
+	if (ev->nreg > R_COUNT || p + ev->nreg * 5 + 1 > end) return -1;
+	for (int i = 0; i < ev->nreg; i++, p += 5) {
+		ev->regs[i].reg = p[0];
+		ev->regs[i].from = get16(p + 1);
+		ev->regs[i].to = get16(p + 3);
+		if (ev->regs[i].reg >= R_COUNT) return -1;
+	}
+	uint32_t nmem = *p++;
+	if (nmem == LONG8) {
+		if (p + 4 > end) return -1;
+		nmem = get32(p);
+		p += 4;
+	}
+	if (nmem > (size_t) (end - p) / 6) return -1;
+	reserve(ev, nmem);
+	for (uint32_t i = 0; i < nmem; i++, p += 6) event_add_mem(ev, get16(p), get16(p + 2), get16(p + 4));
+	return 1;
+}
+
+int events_open(const char* target, int format) {
+	char* end;
+	long fd = strtol(target, &end, 10);
+	if (*target && !*end) {
+		stream = fdopen(fd, format == EVENTS_BINARY ? "wb" : "w");
+	} else {
+		stream = fopen(target, format == EVENTS_BINARY ? "wb" : "w");
+	}
+	if (!stream) return 0;
+
+	stream_format = format;
+	if (format == EVENTS_BINARY) event_write_header(stream);
+	return 1;
+}
+
+void event_write_header(FILE* out) {
+	uint8_t header[6] = { 'L', 'C', '3', 'E' };
+	put16(header + 4, EVENTS_VERSION);
+	fwrite(header, 1, sizeof(header), out);
+}
+
+void events_emit(const struct step_event* ev) {
+	if (!stream) return;
+	if (stream_format == EVENTS_BINARY) {
+		event_write_binary(ev, stream);
+	} else {
+		event_write_json(ev, stream);
+	}
+	// front-ends are waiting on this to update their views
+	fflush(stream);
+}
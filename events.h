@@ -0,0 +1,93 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lc3.h"
+
+// A step event describes one executed instruction: where it was, how it decodes
+//	and what it changed. Single-step mode builds one per instruction and hands it
+//	to the renderers: the human-readable narration on stdout, plus optionally a
+//	JSON Lines or binary stream on a file descriptor for front-ends.
+
+// which decoded fields are meaningful for this instruction
+enum {
+	EV_DR = 1 << 0,		// destination register
+	EV_SR = 1 << 1,		// first source register (the stored register for ST/STI/STR)
+	EV_SR2 = 1 << 2,	// second source register
+	EV_BASE = 1 << 3,	// base register for LDR/STR/JMP/JSRR
+	EV_IMM = 1 << 4,	// sign-extended immediate or offset
+	EV_ADDRESS = 1 << 5,	// effective address of a load, store or LEA
+	EV_POINTER = 1 << 6,	// address the LDI/STI pointer was read from
+	EV_NZP = 1 << 7,	// branch condition mask
+	EV_TAKEN = 1 << 8,	// the branch was taken
+	EV_TRAP = 1 << 9,	// trap vector
+	EV_COND = 1 << 10	// the instruction set the condition codes
+};
+
+struct step_event {
+	uint64_t seq;
+	uint16_t pc;	// address the instruction was fetched from
+	uint16_t instr;
+	uint16_t op;
+	uint16_t fields;
+	uint16_t dr, sr, sr2, base, imm, address, pointer, nzp, trap;
+	uint16_t result;	// value written to dr
+	uint16_t cond;	// COND after the instruction
+	uint8_t nreg;
+	struct {
+		uint8_t reg;
+		uint16_t from, to;
+	} regs[R_COUNT];
+	// most instructions change a word or none, but a bulk READ can change
+	//	thousands, so the changes go in a buffer the event owns and grows. Start
+	//	events zeroed, and copy them with event_copy().
+	uint32_t nmem, mem_capacity;
+	struct event_mem {
+		uint16_t address, from, to;
+	}* mem;
+};
+
+enum {
+	EVENTS_JSON = 0,
+	EVENTS_BINARY
+};
+
+// fill in an event for the instruction at `pc` from the machine state before it
+//	ran (the snapshots) and after it ran (memory and reg)
+void event_decode(struct step_event* ev, uint16_t pc, uint16_t instr,
+	const uint16_t* previous_memory, const uint16_t* previous_reg);
+
+// the parts of event_decode() that don't need a memory snapshot: the decoded
+//	fields, without seq or any deltas (previous_memory is only used for the
+//	LDI/STI pointer)
+void event_decode_fields(struct step_event* ev, uint16_t pc, uint16_t instr,
+	const uint16_t* previous_memory, const uint16_t* previous_reg);
+void event_add_regs(struct step_event* ev, const uint16_t* previous_reg);
+void event_add_mem(struct step_event* ev, uint16_t address, uint16_t from, uint16_t to);
+
+// *to = *from, with its own copy of the memory changes
+void event_copy(struct step_event* to, const struct step_event* from);
+
+const char* event_mnemonic(uint16_t instr);
+
+// the classic single-step narration
+void event_render_text(const struct step_event* ev, FILE* out);
+
+void event_write_json(const struct step_event* ev, FILE* out);
+void event_write_binary(const struct step_event* ev, FILE* out);
+void event_write_header(FILE* out); // what a binary stream starts with
+
+// reading binary streams back: the header (1 if it's one we understand), then
+//	one event at a time (1, or 0 at the end, or -1 if it's malformed)
+int event_read_header(FILE* in);
+int event_read_binary(struct step_event* ev, FILE* in);
+
+// send events to `target`, a file descriptor number or a path; returns 0 on failure
+int events_open(const char* target, int format);
+
+// write an event to the stream opened with events_open(), if any
+void events_emit(const struct step_event* ev);
+
+#endif
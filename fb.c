@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+// unix only
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "lc3.h"
+#include "fb.h"
+#include "io.h"
+#include "tui.h"
+
+#define FB_FPS 30
+#define FB_ROWS (FB_HEIGHT / 2) // terminal rows, two pixels high each
+
+int fb_enabled;
+atomic_uchar fb_dirty[FB_HEIGHT];
+
+static pthread_t thread;
+static atomic_int running;
+static int out_fd = -1; // a terminal of our own, or -1 to share stderr's
+static int rows, cols; // how much of the picture fits
+static uint16_t shown[FB_HEIGHT][FB_WIDTH]; // what's on the terminal now
+
+// a whole frame, so it goes out in one write
+static char frame[FB_ROWS * FB_WIDTH * 48 + 64];
+static int frame_length;
+
+static void emit(const char* text, int length) {
+	if (out_fd < 0) {
+		term_write(text, length);
+	} else {
+		while (length > 0) {
+			ssize_t written = write(out_fd, text, length);
+			if (written <= 0) return;
+			text += written;
+			length -= written;
+		}
+	}
+}
+
+static void append(const char* text) {
+	int length = strlen(text);
+	memcpy(frame + frame_length, text, length);
+	frame_length += length;
+}
+
+static void color(char* out, int size, int layer, uint16_t pixel) {
+	// 5 bits per channel, stretched to 8
+	int r = (pixel >> 10) & 0x1F, g = (pixel >> 5) & 0x1F, b = pixel & 0x1F;
+	snprintf(out, size, "\033[%d;2;%d;%d;%dm", layer, (r << 3) | (r >> 2), (g << 3) | (g >> 2), (b << 3) | (b >> 2));
+}
+
+// redraw the changed part of one terminal row
+static void draw_row(int row) {
+	const uint16_t* top = memory + FB_BASE + row * 2 * FB_WIDTH;
+	const uint16_t* bottom = top + FB_WIDTH;
+
+	// only send the span that actually changed
+	int first = cols, last = -1;
+	for (int x = 0; x < cols; x++) {
+		if ((top[x] & 0x7FFF) != shown[row * 2][x] || (bottom[x] & 0x7FFF) != shown[row * 2 + 1][x]) {
+			if (first == cols) first = x;
+			last = x;
+		}
+	}
+	if (last < 0) return;
+
+	char text[64];
+	snprintf(text, sizeof(text), "\033[%d;%dH", row + 1, first + 1);
+	append(text);
+	uint16_t fg = 0xFFFF, bg = 0xFFFF;
+	for (int x = first; x <= last; x++) {
+		uint16_t upper = top[x] & 0x7FFF, lower = bottom[x] & 0x7FFF;
+		if (upper != fg) {
+			color(text, sizeof(text), 38, upper);
+			append(text);
+			fg = upper;
+		}
+		if (lower != bg) {
+			color(text, sizeof(text), 48, lower);
+			append(text);
+			bg = lower;
+		}
+		append("▀"); // upper half block
+		shown[row * 2][x] = upper;
+		shown[row * 2 + 1][x] = lower;
+	}
+}
+
+static void render(void) {
+	frame_length = 0;
+	if (out_fd < 0) append("\0337");
+	int empty = frame_length;
+	for (int row = 0; row < rows; row++) {
+		// take the dirty bits before reading the pixels, so a store that lands
+		//	while we draw leaves the row dirty for next time
+		int dirty = atomic_exchange_explicit(&fb_dirty[row * 2], 0, memory_order_acquire);
+		dirty |= atomic_exchange_explicit(&fb_dirty[row * 2 + 1], 0, memory_order_acquire);
+		if (dirty) draw_row(row);
+	}
+	if (frame_length == empty) return; // nothing changed
+
+	append("\033[0m");
+	if (out_fd < 0) append("\0338");
+	emit(frame, frame_length);
+}
+
+static void* fb_thread(void* unused) {
+	(void) unused;
+	while (atomic_load(&running)) {
+		struct timespec period = { 0, 1000000000 / FB_FPS };
+		nanosleep(&period, NULL);
+		// the full-screen debugger owns the terminal; the rows stay dirty until it's gone
+		if (out_fd < 0 && tui_active) continue;
+		render();
+	}
+	render();
+	return NULL;
+}
+
+int fb_start(const char* path) {
+	rows = FB_ROWS;
+	cols = FB_WIDTH;
+	if (path) {
+		out_fd = open(path, O_WRONLY | O_NOCTTY | O_CREAT | O_TRUNC, 0644);
+		if (out_fd < 0) return 0;
+		emit("\033[2J\033[?25l", 10); // clear it and hide the cursor
+	} else {
+		// leave at least a few rows below the picture for everything else
+		int height = term_rows();
+		if (height < 8) return 0;
+		if (rows > height - 6) rows = height - 6;
+		if (cols > term_cols()) cols = term_cols();
+
+		// clear the screen and start everything else below the picture
+		char text[32];
+		int length = snprintf(text, sizeof(text), "\033[2J\033[%d;1H", rows + 1);
+		term_write(text, length);
+		term_reserve(rows, -1);
+	}
+
+	memset(shown, 0xFF, sizeof(shown));
+	for (int i = 0; i < FB_HEIGHT; i++) atomic_store(&fb_dirty[i], 1);
+	fb_enabled = 1;
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, fb_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		return 0;
+	}
+	return 1;
+}
+
+void fb_stop(void) {
+	if (!atomic_load(&running)) return;
+	atomic_store(&running, 0);
+	pthread_join(thread, NULL); // it draws one last frame on the way out
+	if (out_fd < 0) {
+		term_reserve(0, -1);
+	} else {
+		emit("\033[?25h", 6);
+		close(out_fd);
+	}
+}
@@ -0,0 +1,31 @@
+#ifndef FB_H
+#define FB_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Framebuffer device: 128x124 words of ordinary memory at 0xC000, one pixel per
+//	word in xRRRRRGGGGGBBBBB. Stores into it only mark the row dirty; a render
+//	thread picks up dirty rows at a capped frame rate and draws them with
+//	half-block characters, two pixel rows per terminal row, so the guest never
+//	pays for drawing.
+
+#define FB_BASE 0xC000
+#define FB_WIDTH 128
+#define FB_HEIGHT 124
+#define FB_END (FB_BASE + FB_WIDTH * FB_HEIGHT) // = MMIO_BASE
+
+extern int fb_enabled;
+extern atomic_uchar fb_dirty[FB_HEIGHT];
+
+// called by mem_write for every store into the framebuffer
+static inline void fb_touch(uint16_t address) {
+	atomic_store_explicit(&fb_dirty[(address - FB_BASE) / FB_WIDTH], 1, memory_order_relaxed);
+}
+
+// draw on `path` (a terminal device, e.g. another window's `tty`), or on the top
+//	of this terminal if it's NULL; returns 0 on failure
+int fb_start(const char* path);
+void fb_stop(void);
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "heat.h"
+#include "sym.h"
+#include "disasm.h"
+
+#define HEAT_STACK 256
+#define HEAT_TOP 10
+
+int heat_enabled;
+
+uint64_t heat_reads[MEMORY_MAX], heat_writes[MEMORY_MAX], heat_fetches[MEMORY_MAX];
+uint16_t heat_pc;
+uint16_t heat_sub;
+
+uint64_t heat_pc_reads[MEMORY_MAX], heat_pc_writes[MEMORY_MAX];
+uint64_t heat_sub_reads[MEMORY_MAX], heat_sub_writes[MEMORY_MAX], heat_sub_fetches[MEMORY_MAX];
+
+// return addresses don't matter here, just whose subroutine we go back to
+static uint16_t stack[HEAT_STACK];
+static int depth;
+
+void heat_start(uint16_t entry) {
+	heat_enabled = 1;
+	heat_sub = entry;
+	depth = 0;
+}
+
+void heat_call(uint16_t target) {
+	// past the end we only keep count, so deep recursion comes back out in step
+	if (depth < HEAT_STACK) stack[depth] = heat_sub;
+	depth++;
+	heat_sub = target;
+}
+
+void heat_return(void) {
+	if (depth == 0) return; // returning from something we didn't see called
+	depth--;
+	if (depth < HEAT_STACK) heat_sub = stack[depth];
+}
+
+// bit length, so counts shade on a log scale
+static int magnitude(uint64_t x) {
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static uint64_t line_total(int line) {
+	uint64_t total = 0;
+	for (int i = line * HEAT_LINE; i < (line + 1) * HEAT_LINE; i++) {
+		total += heat_reads[i] + heat_writes[i] + heat_fetches[i];
+	}
+	return total;
+}
+
+// indexes of the `k` largest nonzero entries of `a`, biggest first; returns how many
+static int top(const uint64_t* a, int n, int* out, int k) {
+	int found = 0;
+	for (int i = 0; i < n; i++) {
+		int j;
+		if (!a[i]) continue;
+		if (found < k) j = found++;
+		else if (a[i] > a[out[k - 1]]) j = k - 1; // bumps the smallest one
+		else continue;
+		while (j > 0 && a[out[j - 1]] < a[i]) {
+			out[j] = out[j - 1];
+			j--;
+		}
+		out[j] = i;
+	}
+	return found;
+}
+
+static void print_symbol(FILE* out, uint16_t address) {
+	char name[80];
+	sym_format(address, name, sizeof(name));
+	fprintf(out, "%-16s", name);
+}
+
+void heat_report(FILE* out) {
+	uint64_t reads = 0, writes = 0, fetches = 0;
+	for (int i = 0; i < MEMORY_MAX; i++) {
+		reads += heat_reads[i];
+		writes += heat_writes[i];
+		fetches += heat_fetches[i];
+	}
+	fprintf(out, "heatmap: %llu fetches, %llu reads, %llu writes\n",
+		(unsigned long long) fetches, (unsigned long long) reads, (unsigned long long) writes);
+
+	// one character per line, one row per 4K words
+	static const char shades[] = " .:-=+*#%@";
+	static uint64_t lines[MEMORY_MAX / HEAT_LINE];
+	int hottest = 0;
+	for (int line = 0; line < MEMORY_MAX / HEAT_LINE; line++) {
+		lines[line] = line_total(line);
+		if (magnitude(lines[line]) > hottest) hottest = magnitude(lines[line]);
+	}
+	fprintf(out, "\n  accesses per %d-word line (log scale, '%c' is hottest)\n", HEAT_LINE, shades[9]);
+	for (int row = 0; row < MEMORY_MAX / HEAT_LINE / 64; row++) {
+		fprintf(out, "  x%04X |", row * 64 * HEAT_LINE);
+		for (int col = 0; col < 64; col++) {
+			uint64_t total = lines[row * 64 + col];
+			int shade = total ? 1 + (magnitude(total) - 1) * 8 / (hottest > 1 ? hottest - 1 : 1) : 0;
+			fputc(shades[shade], out);
+		}
+		fprintf(out, "|\n");
+	}
+
+	int best[HEAT_TOP];
+	static uint64_t pages[MEMORY_MAX / HEAT_PAGE];
+	for (int page = 0; page < MEMORY_MAX / HEAT_PAGE; page++) {
+		pages[page] = 0;
+		for (int line = page * HEAT_PAGE / HEAT_LINE; line < (page + 1) * HEAT_PAGE / HEAT_LINE; line++) {
+			pages[page] += lines[line];
+		}
+	}
+	int n = top(pages, MEMORY_MAX / HEAT_PAGE, best, HEAT_TOP);
+	fprintf(out, "\n  %-11s %12s %12s %12s\n", "pages", "fetches", "reads", "writes");
+	for (int i = 0; i < n; i++) {
+		uint64_t r = 0, w = 0, f = 0;
+		for (int a = best[i] * HEAT_PAGE; a < (best[i] + 1) * HEAT_PAGE; a++) {
+			r += heat_reads[a];
+			w += heat_writes[a];
+			f += heat_fetches[a];
+		}
+		fprintf(out, "  x%04X-x%04X %12llu %12llu %12llu\n", best[i] * HEAT_PAGE, (best[i] + 1) * HEAT_PAGE - 1,
+			(unsigned long long) f, (unsigned long long) r, (unsigned long long) w);
+	}
+
+	// instructions by how much data they touch
+	static uint64_t accesses[MEMORY_MAX];
+	for (int i = 0; i < MEMORY_MAX; i++) accesses[i] = heat_pc_reads[i] + heat_pc_writes[i];
+	n = top(accesses, MEMORY_MAX, best, HEAT_TOP);
+	fprintf(out, "\n  %-43s %12s %12s\n", "instructions", "reads", "writes");
+	for (int i = 0; i < n; i++) {
+		char text[32];
+		disassemble(best[i], memory[best[i]], text, sizeof(text));
+		fprintf(out, "  x%04X ", best[i]);
+		print_symbol(out, best[i]);
+		fprintf(out, " %-20s %12llu %12llu\n", text,
+			(unsigned long long) heat_pc_reads[best[i]], (unsigned long long) heat_pc_writes[best[i]]);
+	}
+
+	n = top(heat_sub_fetches, MEMORY_MAX, best, HEAT_TOP);
+	fprintf(out, "\n  %-22s %16s %12s %12s\n", "subroutines", "instructions", "reads", "writes");
+	for (int i = 0; i < n; i++) {
+		fprintf(out, "  x%04X ", best[i]);
+		print_symbol(out, best[i]);
+		fprintf(out, " %16llu %12llu %12llu\n", (unsigned long long) heat_sub_fetches[best[i]],
+			(unsigned long long) heat_sub_reads[best[i]], (unsigned long long) heat_sub_writes[best[i]]);
+	}
+}
+
+static FILE* open_export(const char* prefix, const char* suffix, const char* mode) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s%s", prefix, suffix);
+	return fopen(path, mode);
+}
+
+static void write_csv_row(FILE* out, const char* level, uint16_t address, int size) {
+	uint64_t r = 0, w = 0, f = 0;
+	for (int a = address; a < address + size; a++) {
+		r += heat_reads[a];
+		w += heat_writes[a];
+		f += heat_fetches[a];
+	}
+	if (!(r | w | f)) return;
+	char name[80];
+	sym_format(address, name, sizeof(name));
+	fprintf(out, "%s,x%04X,%llu,%llu,%llu,%s\n", level, address,
+		(unsigned long long) r, (unsigned long long) w, (unsigned long long) f, name);
+}
+
+int heat_export(const char* prefix) {
+	FILE* out = open_export(prefix, ".txt", "w");
+	if (!out) return 0;
+	heat_report(out);
+	fclose(out);
+
+	out = open_export(prefix, ".csv", "w");
+	if (!out) return 0;
+	fprintf(out, "level,address,reads,writes,fetches,symbol\n");
+	for (int page = 0; page < MEMORY_MAX; page += HEAT_PAGE) write_csv_row(out, "page", page, HEAT_PAGE);
+	for (int line = 0; line < MEMORY_MAX; line += HEAT_LINE) write_csv_row(out, "line", line, HEAT_LINE);
+	for (int a = 0; a < MEMORY_MAX; a++) write_csv_row(out, "word", a, 1);
+	fclose(out);
+
+	out = open_export(prefix, "-pc.csv", "w");
+	if (!out) return 0;
+	fprintf(out, "pc,symbol,subroutine,instructions,reads,writes\n");
+	for (int a = 0; a < MEMORY_MAX; a++) {
+		char name[80];
+		sym_format(a, name, sizeof(name));
+		if (heat_fetches[a] || heat_pc_reads[a] || heat_pc_writes[a]) {
+			fprintf(out, "x%04X,%s,no,%llu,%llu,%llu\n", a, name, (unsigned long long) heat_fetches[a],
+				(unsigned long long) heat_pc_reads[a], (unsigned long long) heat_pc_writes[a]);
+		}
+		if (heat_sub_fetches[a]) {
+			fprintf(out, "x%04X,%s,yes,%llu,%llu,%llu\n", a, name, (unsigned long long) heat_sub_fetches[a],
+				(unsigned long long) heat_sub_reads[a], (unsigned long long) heat_sub_writes[a]);
+		}
+	}
+	fclose(out);
+
+	// binary PPM; any image viewer or converter takes it
+	out = open_export(prefix, ".ppm", "wb");
+	if (!out) return 0;
+	int hottest[3] = { 1, 1, 1 };
+	const uint64_t* channels[3] = { heat_writes, heat_reads, heat_fetches };
+	for (int c = 0; c < 3; c++) {
+		for (int a = 0; a < MEMORY_MAX; a++) {
+			if (magnitude(channels[c][a]) > hottest[c]) hottest[c] = magnitude(channels[c][a]);
+		}
+	}
+	fprintf(out, "P6\n256 256\n255\n");
+	for (int a = 0; a < MEMORY_MAX; a++) {
+		for (int c = 0; c < 3; c++) {
+			int m = magnitude(channels[c][a]);
+			fputc(m ? 64 + (m - 1) * 191 / (hottest[c] > 1 ? hottest[c] - 1 : 1) : 0, out);
+		}
+	}
+	fclose(out);
+	return 1;
+}
@@ -0,0 +1,59 @@
+#ifndef HEAT_H
+#define HEAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Memory access heatmap. Every data read, data write and instruction fetch bumps
+//	a counter in a flat array indexed by address, and data accesses are also
+//	charged to the instruction that made them and to the subroutine it's in
+//	(tracked with a shadow call stack fed by JSR/JSRR and RET). Lines (64
+//	words) and pages (256 words) are summed up at report time.
+
+#define HEAT_LINE 64
+#define HEAT_PAGE 256
+
+extern int heat_enabled;
+
+extern uint64_t heat_reads[MEMORY_MAX], heat_writes[MEMORY_MAX], heat_fetches[MEMORY_MAX];
+extern uint16_t heat_pc; // instruction being executed
+extern uint16_t heat_sub; // entry point of the subroutine it's in
+
+// by issuing instruction, and by subroutine entry point
+extern uint64_t heat_pc_reads[MEMORY_MAX], heat_pc_writes[MEMORY_MAX];
+extern uint64_t heat_sub_reads[MEMORY_MAX], heat_sub_writes[MEMORY_MAX], heat_sub_fetches[MEMORY_MAX];
+
+static inline void heat_fetch(uint16_t address) {
+	heat_fetches[address]++;
+	heat_sub_fetches[heat_sub]++;
+	heat_pc = address;
+}
+
+static inline void heat_read(uint16_t address) {
+	heat_reads[address]++;
+	heat_pc_reads[heat_pc]++;
+	heat_sub_reads[heat_sub]++;
+}
+
+static inline void heat_write(uint16_t address) {
+	heat_writes[address]++;
+	heat_pc_writes[heat_pc]++;
+	heat_sub_writes[heat_sub]++;
+}
+
+void heat_start(uint16_t entry);
+void heat_call(uint16_t target);
+void heat_return(void);
+
+// the summary: a map of the address space by line, then the hottest pages,
+//	instructions and subroutines
+void heat_report(FILE* out);
+
+// write PREFIX.txt (the summary), PREFIX.csv (per word, line and page),
+//	PREFIX-pc.csv (per instruction and subroutine) and PREFIX.ppm (a 256x256
+//	picture of memory, one pixel per word: red writes, green reads, blue fetches)
+int heat_export(const char* prefix);
+
+#endif
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdint.h>
+// unix only
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/termios.h>
+
+#include "io.h"
+#include "lc3.h"
+#include "tui.h"
+#include "stop.h"
+#include "status.h"
+#include "pace.h"
+#include "record.h"
+#include "sweep.h"
+#include "latency.h"
+#include "outmatch.h"
+#include "taint.h"
+#include "native.h"
+#include "smp.h"
+
+struct termios original_tio;
+
+void disable_input_buffering(void) {
+	tcgetattr(STDIN_FILENO, &original_tio);
+	struct termios new_tio = original_tio;
+	new_tio.c_lflag &= ~ICANON & ~ECHO;
+	tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
+}
+
+void restore_input_buffering(void) {
+	tcsetattr(STDIN_FILENO, TCSANOW, &original_tio);
+}
+
+uint16_t check_key(void) {
+	fd_set readfds;
+	FD_ZERO(&readfds);
+	FD_SET(STDIN_FILENO, &readfds);
+
+	struct timeval timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+	return select(1, &readfds, NULL, NULL, &timeout) != 0;
+}
+
+uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int wait_for_key(void) {
+	struct pollfd fds[2] = {
+		{ STDIN_FILENO, POLLIN, 0 },
+		{ stop_fd(), POLLIN, 0 }
+	};
+	while (!stop_requested()) {
+		if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+		if (fds[0].revents) return getchar();
+	}
+	return stop_requested() ? GUEST_STOPPED : getchar();
+}
+
+static int console_getchar(void) {
+	fflush(stdout); // in case it's fully buffered, show what we printed before waiting
+	uint64_t begin = now_ns();
+	int c = wait_for_key();
+	if (recording) record_key(c);
+	uint64_t waited = now_ns() - begin;
+	atomic_fetch_add_explicit(&input_wait_ns, waited, memory_order_relaxed);
+	if (latency_enabled) latency_blocked(waited);
+	pace_rebase(); // the guest was stopped, so it has no time to make up
+	return c;
+}
+
+int guest_getchar(void) {
+	int c = replaying ? replay_key() : sweeping ? sweep_getchar() : console_getchar();
+	if (taint_enabled && c != GUEST_STOPPED) taint_input(c);
+	return c;
+}
+
+int guest_key_ready(void) {
+	// with nobody else to run it may as well block
+	int ready = replaying || sweeping || check_key() || !smp_others_runnable();
+	smp_polled(ready);
+	return ready;
+}
+
+int guest_poll(void) {
+	uint16_t key = 0;
+	int found;
+	if (replaying) {
+		found = replay_poll(&key);
+	} else if (sweeping) {
+		found = sweep_poll(&key);
+	} else {
+		found = check_key();
+		if (found) key = getchar();
+	}
+	if (recording) record_poll(found, key);
+	if (taint_enabled && found) taint_input(key);
+	return found ? key : -1;
+}
+
+// store the i-th character of a buffer
+static void put_char(uint16_t address, int i, uint8_t c, int packed) {
+	uint16_t word = address + (packed ? i / 2 : i);
+	if (!packed) {
+		mem_write(word, c);
+	} else if (i % 2 == 0) {
+		mem_write(word, c); // the high byte stays 0 until the next one arrives
+	} else {
+		mem_write(word, (memory[word] & 0xFF) | c << 8);
+	}
+	if (taint_enabled) taint_mem[word] = (packed && i % 2 ? taint_mem[word] : 0) | taint_last;
+}
+
+int guest_read(uint16_t address, uint16_t n, int flags) {
+	int packed = flags & BULK_PACKED;
+	if (!n) return 0;
+
+	int c;
+	if (flags & BULK_NONBLOCK) {
+		c = guest_poll();
+		if (smp_cores > 1) smp_polled(c >= 0);
+		if (c < 0) return 0; // nothing waiting
+	} else {
+		c = guest_getchar();
+		if (c == GUEST_STOPPED) return GUEST_STOPPED;
+	}
+	if (c == EOF || c == 0xFFFF) return -1;
+
+	int count = 0;
+	put_char(address, count++, c, packed);
+	while (count < n) {
+		c = guest_poll();
+		if (c < 0 || c == 0xFFFF) break; // leave EOF for the next READ to report
+		put_char(address, count++, c, packed);
+	}
+	return count;
+}
+
+int guest_write(uint16_t address, uint16_t n, int flags) {
+	if (flags & BULK_NONBLOCK && !sweeping && !tui_active) {
+		// all or nothing, so the guest can just try again later
+		fflush(stdout);
+		struct pollfd out = { STDOUT_FILENO, POLLOUT, 0 };
+		if (poll(&out, 1, 0) <= 0) return 0;
+	}
+	for (int i = 0; i < n; i++) {
+		uint16_t word = memory[(uint16_t) (address + (flags & BULK_PACKED ? i / 2 : i))];
+		guest_putc(flags & BULK_PACKED && i % 2 ? word >> 8 : word & 0xFF);
+	}
+	guest_flush();
+	return n;
+}
+
+void guest_putc(char c) {
+	atomic_fetch_add_explicit(&output_bytes, 1, memory_order_relaxed);
+	if (outmatch_enabled && !sweeping) outmatch_feed(c);
+	if (native_verifying) native_capture(c);
+	if (sweeping) {
+		sweep_output(c); // reported per case at the end
+	} else if (tui_active) {
+		tui_output(c); // the full-screen debugger shows it in its own pane
+	} else {
+		putc(c, stdout);
+	}
+}
+
+void guest_puts(const char* s) {
+	while (*s) guest_putc(*s++);
+}
+
+void guest_flush(void) {
+	if (tui_active) return;
+	if (!latency_enabled) {
+		fflush(stdout);
+		return;
+	}
+	uint64_t begin = now_ns();
+	fflush(stdout);
+	latency_blocked(now_ns() - begin);
+}
+
+static pthread_mutex_t term_lock = PTHREAD_MUTEX_INITIALIZER;
+static int reserved_top, reserved_bottom;
+
+static int term_size(int* rows, int* cols) {
+	struct winsize size;
+	if (!isatty(STDERR_FILENO) || ioctl(STDERR_FILENO, TIOCGWINSZ, &size) != 0) return 0;
+	*rows = size.ws_row;
+	*cols = size.ws_col;
+	return 1;
+}
+
+int term_rows(void) {
+	int rows, cols;
+	return term_size(&rows, &cols) ? rows : 0;
+}
+
+int term_cols(void) {
+	int rows, cols;
+	return term_size(&rows, &cols) ? cols : 0;
+}
+
+void term_write(const char* text, int length) {
+	while (length > 0) {
+		ssize_t written = write(STDERR_FILENO, text, length);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return;
+		text += written;
+		length -= written;
+	}
+}
+
+void term_reserve(int top, int bottom) {
+	pthread_mutex_lock(&term_lock);
+	if (top >= 0) reserved_top = top;
+	if (bottom >= 0) reserved_bottom = bottom;
+
+	// setting the scroll region homes the cursor, so put it back afterwards
+	char buffer[64];
+	int length;
+	if (!reserved_top && !reserved_bottom) {
+		length = snprintf(buffer, sizeof(buffer), "\0337\033[r\0338");
+	} else {
+		length = snprintf(buffer, sizeof(buffer), "\0337\033[%d;%dr\0338",
+			reserved_top + 1, term_rows() - reserved_bottom);
+	}
+	term_write(buffer, length);
+	pthread_mutex_unlock(&term_lock);
+}
@@ -0,0 +1,48 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+
+// host terminal
+void disable_input_buffering(void);
+void restore_input_buffering(void);
+uint16_t check_key(void);
+
+// monotonic host time in nanoseconds
+uint64_t now_ns(void);
+
+// guest console input: blocks until a key arrives (or EOF), or returns
+//	GUEST_STOPPED if a stop was requested while waiting
+#define GUEST_STOPPED (-2)
+int guest_getchar(void);
+
+// with --cores: whether a blocking read can go ahead, because a key is there or
+//	no other core has anything to do. If not, the core counts as waiting for
+//	input, like after an empty KBSR check, and should run the trap again later
+//	rather than block the others.
+int guest_key_ready(void);
+
+// a key if one's waiting (EOF counts), -1 if not; never blocks
+int guest_poll(void);
+
+// TRAP_READ and TRAP_WRITE: move up to `n` characters between the console and
+//	memory at `address`. A blocking READ waits for the first character, then takes
+//	whatever else is already there, like read(2). Returns the count, or -1 for a
+//	READ at the end of input, or GUEST_STOPPED.
+int guest_read(uint16_t address, uint16_t n, int flags);
+int guest_write(uint16_t address, uint16_t n, int flags);
+
+// guest console output; everything the traps print goes through here
+void guest_putc(char c);
+void guest_puts(const char* s); // unlike puts(), doesn't add a newline
+void guest_flush(void);
+
+// Rows at the top and bottom of the terminal can be set aside for the framebuffer
+//	and the status line, with everything else scrolling in between. Both draw
+//	from their own threads, on stderr, one write() per update.
+int term_rows(void); // 0 if stderr isn't a terminal
+int term_cols(void);
+void term_reserve(int top, int bottom); // -1 leaves that edge as it is
+void term_write(const char* text, int length);
+
+#endif
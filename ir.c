@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lc3.h"
+#include "ir.h"
+#include "plugin.h"
+
+static int16_t emit(struct ir_block* block, uint8_t op, uint8_t r, uint16_t imm, int16_t a, int16_t b, uint16_t pc) {
+	struct ir_op* o = &block->ops[block->n];
+	o->op = op;
+	o->reg = r;
+	o->imm = imm;
+	o->a = a;
+	o->b = b;
+	o->pc = pc;
+	return block->n++;
+}
+
+#define CONST(v) emit(block, IR_CONST, 0, (v), -1, -1, pc)
+#define GETREG(r) emit(block, IR_GETREG, (r), 0, -1, -1, pc)
+#define SETREG(r, v) emit(block, IR_SETREG, (r), 0, (v), -1, pc)
+#define BINOP(o, x, y) emit(block, (o), 0, 0, (x), (y), pc)
+#define UNOP(o, x) emit(block, (o), 0, 0, (x), -1, pc)
+
+// setreg dr, v; setreg COND, flags(v) -- what update_flags() does in the interpreter
+#define SETREG_FLAGS(r, v) do { int16_t val_ = (v); SETREG((r), val_); SETREG(R_COND, UNOP(IR_FLAGS, val_)); } while (0)
+
+int ir_build(struct ir_block* block, const uint16_t* code, uint16_t start) {
+	block->start = start;
+	block->count = 0;
+	block->n = 0;
+
+	uint16_t pc = start;
+	while (1) {
+		// the longest instruction (LDI) needs 8 ops, plus one for the exit
+		if (block->count == IR_MAX_INSTRS || block->n + 9 > IR_MAX_OPS || pc >= MMIO_BASE) {
+			emit(block, IR_EXIT, 0, pc, -1, -1, pc);
+			return 1;
+		}
+
+		uint16_t instr = code[pc - start];
+		uint16_t next = pc + 1;
+		uint16_t r9 = (instr >> 9) & 0x7;
+		uint16_t r6 = (instr >> 6) & 0x7;
+
+		switch (instr >> 12) {
+		case OP_ADD:
+		case OP_AND:
+			{
+				int16_t x = GETREG(r6);
+				int16_t y = (instr >> 5) & 0x1 ? CONST(sign_extend(instr & 0x1F, 5)) : GETREG(instr & 0x7);
+				SETREG_FLAGS(r9, BINOP((instr >> 12) == OP_ADD ? IR_ADD : IR_AND, x, y));
+			}
+
+			break;
+		case OP_NOT:
+			SETREG_FLAGS(r9, UNOP(IR_NOT, GETREG(r6)));
+
+			break;
+		case OP_LEA:
+			SETREG_FLAGS(r9, BINOP(IR_ADD, CONST(next), CONST(sign_extend(instr & 0x1FF, 9))));
+
+			break;
+		case OP_LD:
+			SETREG_FLAGS(r9, UNOP(IR_LOAD, BINOP(IR_ADD, CONST(next), CONST(sign_extend(instr & 0x1FF, 9)))));
+
+			break;
+		case OP_LDI:
+			{
+				int16_t pointer = UNOP(IR_LOAD, BINOP(IR_ADD, CONST(next), CONST(sign_extend(instr & 0x1FF, 9))));
+				SETREG_FLAGS(r9, UNOP(IR_LOAD, pointer));
+			}
+
+			break;
+		case OP_LDR:
+			SETREG_FLAGS(r9, UNOP(IR_LOAD, BINOP(IR_ADD, GETREG(r6), CONST(sign_extend(instr & 0x3F, 6)))));
+
+			break;
+		case OP_ST:
+			{
+				int16_t address = BINOP(IR_ADD, CONST(next), CONST(sign_extend(instr & 0x1FF, 9)));
+				BINOP(IR_STORE, address, GETREG(r9));
+			}
+
+			break;
+		case OP_STI:
+			{
+				int16_t address = UNOP(IR_LOAD, BINOP(IR_ADD, CONST(next), CONST(sign_extend(instr & 0x1FF, 9))));
+				BINOP(IR_STORE, address, GETREG(r9));
+			}
+
+			break;
+		case OP_STR:
+			{
+				int16_t address = BINOP(IR_ADD, GETREG(r6), CONST(sign_extend(instr & 0x3F, 6)));
+				BINOP(IR_STORE, address, GETREG(r9));
+			}
+
+			break;
+		case OP_BR:
+			block->count++;
+			emit(block, IR_BR, r9, next + sign_extend(instr & 0x1FF, 9), GETREG(R_COND), -1, pc);
+			return 1;
+		case OP_JMP:
+			block->count++;
+			UNOP(IR_JUMP, GETREG(r6));
+			return 1;
+		case OP_JSR:
+			// same order as the interpreter: R7 is written before BaseR is read
+			block->count++;
+			SETREG(R_R7, CONST(next));
+			if ((instr >> 11) & 1) {
+				UNOP(IR_JUMP, BINOP(IR_ADD, CONST(next), CONST(sign_extend(instr & 0x7FF, 11))));
+			} else {
+				UNOP(IR_JUMP, GETREG(r6));
+			}
+			return 1;
+		default:
+			// traps and illegal opcodes are left to the interpreter
+			if (block->count == 0) return 0;
+			emit(block, IR_EXIT, 0, pc, -1, -1, pc);
+			return 1;
+		}
+
+		block->count++;
+		pc = next;
+	}
+}
+
+#undef CONST
+#undef GETREG
+#undef SETREG
+#undef BINOP
+#undef UNOP
+#undef SETREG_FLAGS
+
+static uint16_t flags_for(uint16_t value) {
+	if (value == 0) return FL_ZRO;
+	if (value >> 15) return FL_NEG;
+	return FL_POS;
+}
+
+static int is_const(const struct ir_block* block, int16_t v, uint16_t value) {
+	return block->ops[v].op == IR_CONST && block->ops[v].imm == value;
+}
+
+static void make_const(struct ir_op* o, uint16_t value) {
+	o->op = IR_CONST;
+	o->imm = value;
+	o->a = o->b = -1;
+}
+
+static void make_exit(struct ir_op* o, uint16_t target) {
+	o->op = IR_EXIT;
+	o->imm = target;
+	o->a = o->b = -1;
+}
+
+// loads from RAM at a known address can be forwarded; device registers can't
+static int forwardable(const struct ir_block* block, int16_t address) {
+	return block->ops[address].op == IR_CONST && block->ops[address].imm < MMIO_BASE;
+}
+
+// forward pass: register forwarding (which is what puts the block in SSA form),
+//	constant folding and load/store forwarding
+static void propagate(struct ir_block* block) {
+	int16_t repl[IR_MAX_OPS]; // value to use instead of each op
+	int16_t reg_value[R_COUNT]; // latest value written to or read from each guest register
+	int16_t consts[IR_MAX_OPS];
+	int nconsts = 0;
+	struct {
+		uint16_t address;
+		int16_t value;
+	} known[IR_MAX_OPS]; // memory contents we've already loaded or stored
+	int nknown = 0;
+
+	for (int r = 0; r < R_COUNT; r++) reg_value[r] = -1;
+
+	for (int i = 0; i < block->n; i++) {
+		struct ir_op* o = &block->ops[i];
+		repl[i] = i;
+		if (o->a >= 0) o->a = repl[o->a];
+		if (o->b >= 0) o->b = repl[o->b];
+
+		const struct ir_op* a = o->a >= 0 ? &block->ops[o->a] : NULL;
+		const struct ir_op* b = o->b >= 0 ? &block->ops[o->b] : NULL;
+
+		switch (o->op) {
+		case IR_GETREG:
+			if (reg_value[o->reg] >= 0) {
+				repl[i] = reg_value[o->reg];
+				o->op = IR_NOP;
+			} else {
+				reg_value[o->reg] = i;
+			}
+			break;
+		case IR_SETREG:
+			reg_value[o->reg] = o->a;
+			break;
+		case IR_ADD:
+			if (a->op == IR_CONST && b->op == IR_CONST) {
+				make_const(o, a->imm + b->imm);
+			} else if (is_const(block, o->b, 0)) {
+				repl[i] = o->a;
+			} else if (is_const(block, o->a, 0)) {
+				repl[i] = o->b;
+			}
+			break;
+		case IR_AND:
+			if (a->op == IR_CONST && b->op == IR_CONST) {
+				make_const(o, a->imm & b->imm);
+			} else if (is_const(block, o->a, 0) || is_const(block, o->b, 0)) {
+				make_const(o, 0);
+			} else if (is_const(block, o->b, 0xFFFF) || o->a == o->b) {
+				repl[i] = o->a;
+			} else if (is_const(block, o->a, 0xFFFF)) {
+				repl[i] = o->b;
+			}
+			break;
+		case IR_NOT:
+			if (a->op == IR_CONST) {
+				make_const(o, ~a->imm);
+			} else if (a->op == IR_NOT) {
+				repl[i] = a->a;
+			}
+			break;
+		case IR_FLAGS:
+			if (a->op == IR_CONST) make_const(o, flags_for(a->imm));
+			break;
+		case IR_LOAD:
+			if (forwardable(block, o->a)) {
+				int k;
+				for (k = 0; k < nknown && known[k].address != a->imm; k++);
+				if (k < nknown) {
+					repl[i] = known[k].value;
+				} else {
+					known[nknown].address = a->imm;
+					known[nknown++].value = i;
+				}
+			}
+			break;
+		case IR_STORE:
+			if (forwardable(block, o->a)) {
+				int k;
+				for (k = 0; k < nknown && known[k].address != a->imm; k++);
+				known[k].address = a->imm;
+				known[k].value = o->b;
+				if (k == nknown) nknown++;
+			} else if (a->op != IR_CONST) {
+				nknown = 0; // could have hit anything
+			}
+			break;
+		case IR_BR:
+			if (o->reg == 0 || (a->op == IR_CONST && !(a->imm & o->reg))) {
+				make_exit(o, o->pc + 1);
+			} else if (o->reg == (FL_NEG | FL_ZRO | FL_POS) || a->op == IR_CONST) {
+				// COND always has exactly one flag set
+				make_exit(o, o->imm);
+			}
+			break;
+		case IR_JUMP:
+			if (a->op == IR_CONST) make_exit(o, a->imm);
+			break;
+		}
+
+		if (o->op == IR_CONST) {
+			// share one op per distinct constant
+			int k;
+			for (k = 0; k < nconsts && block->ops[consts[k]].imm != o->imm; k++);
+			if (k < nconsts) {
+				repl[i] = consts[k];
+				o->op = IR_NOP;
+			} else {
+				consts[nconsts++] = i;
+			}
+		}
+		if (repl[i] != i) o->op = IR_NOP;
+	}
+}
+
+// backward pass: drop register writes (mostly COND from update_flags) that are
+//	overwritten later in the block. Stores may hit code and bail out of the block
+//	mid-way, so all registers have to be up to date at every store.
+static void eliminate_dead_writes(struct ir_block* block) {
+	int overwritten[R_COUNT] = {0};
+	for (int i = block->n - 1; i >= 0; i--) {
+		struct ir_op* o = &block->ops[i];
+		if (o->op == IR_SETREG) {
+			if (overwritten[o->reg]) {
+				o->op = IR_NOP;
+			} else {
+				overwritten[o->reg] = 1;
+			}
+		} else if (o->op == IR_GETREG) {
+			overwritten[o->reg] = 0;
+		} else if (o->op == IR_STORE) {
+			memset(overwritten, 0, sizeof(overwritten));
+		}
+	}
+}
+
+static int has_side_effects(const struct ir_block* block, const struct ir_op* o) {
+	switch (o->op) {
+	case IR_SETREG:
+	case IR_STORE:
+	case IR_BR:
+	case IR_JUMP:
+	case IR_EXIT:
+		return 1;
+	case IR_LOAD:
+		return !forwardable(block, o->a); // reading the keyboard status polls the keyboard
+	default:
+		return 0;
+	}
+}
+
+// drop unused values and renumber what's left
+static void compact(struct ir_block* block) {
+	uint8_t live[IR_MAX_OPS] = {0};
+	for (int i = block->n - 1; i >= 0; i--) {
+		const struct ir_op* o = &block->ops[i];
+		if (o->op == IR_NOP) continue;
+		if (live[i] || has_side_effects(block, o)) {
+			live[i] = 1;
+			if (o->a >= 0) live[o->a] = 1;
+			if (o->b >= 0) live[o->b] = 1;
+		}
+	}
+
+	int16_t renumber[IR_MAX_OPS];
+	int n = 0;
+	for (int i = 0; i < block->n; i++) {
+		if (!live[i] || block->ops[i].op == IR_NOP) continue;
+		struct ir_op o = block->ops[i];
+		if (o.a >= 0) o.a = renumber[o.a];
+		if (o.b >= 0) o.b = renumber[o.b];
+		renumber[i] = n;
+		block->ops[n++] = o;
+	}
+	block->n = n;
+}
+
+void ir_optimize(struct ir_block* block) {
+	propagate(block);
+	eliminate_dead_writes(block);
+	compact(block);
+}
+
+int ir_run(const struct ir_block* block) {
+	uint16_t v[IR_MAX_OPS];
+	const struct ir_op* o = block->ops;
+	for (int i = 0; ; i++, o++) {
+		switch (o->op) {
+		case IR_CONST:	v[i] = o->imm; break;
+		case IR_GETREG:	v[i] = reg[o->reg]; break;
+		case IR_SETREG:	reg[o->reg] = v[o->a]; break;
+		case IR_ADD:	v[i] = v[o->a] + v[o->b]; break;
+		case IR_AND:	v[i] = v[o->a] & v[o->b]; break;
+		case IR_NOT:	v[i] = ~v[o->a]; break;
+		case IR_FLAGS:	v[i] = flags_for(v[o->a]); break;
+		case IR_LOAD:
+			// plain RAM doesn't need to go through the device checks, unless a plugin's watching it
+			v[i] = v[o->a] >= MMIO_BASE || (plugin_memory_any && plugin_memory[v[o->a]])
+				? mem_read(v[o->a]) : memory[v[o->a]];
+			break;
+		case IR_STORE:
+			mem_write(v[o->a], v[o->b]);
+			// self-modifying code: the rest of this block may be stale. and stop after
+			//	device stores too, so their effects (output breakpoints) land on the
+			//	right instruction
+			if ((uint16_t) (v[o->a] - block->start) < block->count || v[o->a] >= MMIO_BASE) {
+				reg[R_PC] = o->pc + 1;
+				return o->pc - block->start + 1;
+			}
+			break;
+		case IR_BR:
+			reg[R_PC] = (v[o->a] & o->reg) ? o->imm : o->pc + 1;
+			return block->count;
+		case IR_JUMP:
+			reg[R_PC] = v[o->a];
+			return block->count;
+		case IR_EXIT:
+			reg[R_PC] = o->imm;
+			return block->count;
+		}
+	}
+}
+
+static const char* reg_name(uint8_t r) {
+	static const char* names[R_COUNT] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND" };
+	return names[r];
+}
+
+void ir_dump(const struct ir_block* block, FILE* out) {
+	fprintf(out, "block 0x%04hX: %d instructions, %d ops\n", block->start, block->count, block->n);
+	for (int i = 0; i < block->n; i++) {
+		const struct ir_op* o = &block->ops[i];
+		fprintf(out, "  0x%04hX  ", o->pc);
+		switch (o->op) {
+		case IR_CONST:	fprintf(out, "v%-3d = const 0x%04hX\n", i, o->imm); break;
+		case IR_GETREG:	fprintf(out, "v%-3d = getreg %s\n", i, reg_name(o->reg)); break;
+		case IR_SETREG:	fprintf(out, "       setreg %s, v%d\n", reg_name(o->reg), o->a); break;
+		case IR_ADD:	fprintf(out, "v%-3d = add v%d, v%d\n", i, o->a, o->b); break;
+		case IR_AND:	fprintf(out, "v%-3d = and v%d, v%d\n", i, o->a, o->b); break;
+		case IR_NOT:	fprintf(out, "v%-3d = not v%d\n", i, o->a); break;
+		case IR_FLAGS:	fprintf(out, "v%-3d = flags v%d\n", i, o->a); break;
+		case IR_LOAD:	fprintf(out, "v%-3d = load v%d\n", i, o->a); break;
+		case IR_STORE:	fprintf(out, "       store v%d, v%d\n", o->a, o->b); break;
+		case IR_BR:
+			fprintf(out, "       br %s%s%s v%d, 0x%04hX\n", o->reg & FL_NEG ? "n" : "", o->reg & FL_ZRO ? "z" : "",
+				o->reg & FL_POS ? "p" : "", o->a, o->imm);
+			break;
+		case IR_JUMP:	fprintf(out, "       jump v%d\n", o->a); break;
+		case IR_EXIT:	fprintf(out, "       exit 0x%04hX\n", o->imm); break;
+		default:	fprintf(out, "       nop\n"); break;
+		}
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Intermediate representation for straight-line LC-3 regions (basic blocks).
+//	Every op produces at most one value, named by its index in the block, and
+//	operands refer to earlier ops by index, so after ir_optimize() a block is in
+//	SSA form. Guest registers are only touched through getreg/setreg, which makes
+//	redundant COND updates, constant operands and repeated loads easy to spot.
+
+#define IR_MAX_INSTRS 32	// guest instructions per block
+#define IR_MAX_OPS 256		// ops per block
+
+enum {
+	IR_NOP = 0,	// deleted op
+	IR_CONST,	// imm
+	IR_GETREG,	// value of guest register `reg`
+	IR_SETREG,	// guest register `reg` = a
+	IR_ADD,		// a + b
+	IR_AND,		// a & b
+	IR_NOT,		// ~a
+	IR_FLAGS,	// n/z/p condition bits for a
+	IR_LOAD,	// mem_read(a)
+	IR_STORE,	// mem_write(a, b)
+	// terminators (always the last op)
+	IR_BR,		// if (a & reg) goto imm, else fall through to pc + 1
+	IR_JUMP,	// goto a
+	IR_EXIT		// goto imm (the block ended on an instruction we don't translate)
+};
+
+struct ir_op {
+	uint8_t op;
+	uint8_t reg;	// register for getreg/setreg, n/z/p mask for br
+	uint16_t imm;	// constant value or branch target
+	int16_t a, b;	// operands (indices of earlier ops), -1 if unused
+	uint16_t pc;	// address of the guest instruction this op came from
+};
+
+struct ir_block {
+	uint16_t start;	// address of the first guest instruction
+	uint16_t count;	// guest instructions covered, including the terminator
+	uint16_t n;	// number of ops
+	struct ir_op ops[IR_MAX_OPS];
+};
+
+// translate the block starting at `start` literally, one group of ops per instruction.
+//	`code` holds the words from `start` on (it doesn't have to be `memory`, so a copy can be
+//	translated while the guest keeps running). Returns 0 if there's nothing translatable
+//	there, e.g. if it starts with a TRAP.
+int ir_build(struct ir_block* block, const uint16_t* code, uint16_t start);
+
+// run constant propagation, register/load/store forwarding and dead flag elimination
+void ir_optimize(struct ir_block* block);
+
+// execute an optimized block, leaving the PC at the next instruction to run.
+//	Returns the number of guest instructions retired, which is less than block->count
+//	if a store modified the block itself and we had to bail out early.
+int ir_run(const struct ir_block* block);
+
+void ir_dump(const struct ir_block* block, FILE* out);
+
+#endif
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "lc3.h"
+#include "ir.h"
+#include "jit.h"
+#include "stop.h"
+#include "status.h"
+#include "pace.h"
+#include "record.h"
+#include "plugin.h"
+#include "outmatch.h"
+#include "smp.h"
+#include "native.h"
+#include "io.h"
+
+#define JIT_THRESHOLD 50	// block entries before we bother compiling
+#define JIT_QUEUE_MAX 256
+
+// heat values past the threshold
+enum {
+	H_QUEUED = 254,	// waiting for (or being worked on by) a compiler thread
+	H_NEVER = 255	// nothing to translate there
+};
+
+struct jit_block {
+	struct jit_block* next; // in the done/retired lists
+	uint64_t queued_at;
+	uint16_t code[IR_MAX_INSTRS]; // the words we translated, to check they're still current
+	int translated;
+	uint64_t runs; // complete runs not yet added to plugin_counts
+	struct ir_block ir;
+};
+
+int jit_enabled = 1;
+uint8_t jit_code[MEMORY_MAX];
+
+static struct jit_block* table[MEMORY_MAX]; // dispatch table, only touched by the main thread
+static uint8_t heat[MEMORY_MAX];
+static struct jit_block* retired; // invalidated blocks, freed once we're sure they aren't running
+static int dump;
+
+// compile queue and finished blocks, shared with the compiler threads
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static struct {
+	uint16_t start;
+	uint64_t at;
+} queue[JIT_QUEUE_MAX];
+static int queue_head, queue_len;
+static struct jit_block* done;
+static atomic_int done_pending;
+
+static struct {
+	uint64_t queued, compiled, installed, stale, untranslatable, invalidated;
+	int queue_max;
+	uint64_t compile_ns, compile_ns_max; // time spent translating
+	uint64_t latency_ns, latency_ns_max; // from queueing to installing
+	uint64_t blocks_run, instructions;
+} stats;
+
+static void* compiler_thread(void* arg) {
+	(void) arg;
+	while (1) {
+		pthread_mutex_lock(&lock);
+		while (queue_len == 0) pthread_cond_wait(&queue_ready, &lock);
+		uint16_t start = queue[queue_head].start;
+		uint64_t queued_at = queue[queue_head].at;
+		queue_head = (queue_head + 1) % JIT_QUEUE_MAX;
+		queue_len--;
+		pthread_mutex_unlock(&lock);
+
+		uint64_t begin = now_ns();
+		struct jit_block* b = malloc(sizeof(struct jit_block));
+		if (!b) continue; // leaves the address marked as queued, so we just won't compile it
+		b->queued_at = queued_at;
+		b->runs = 0;
+
+		// translate a snapshot, since the guest may be writing to memory as we go
+		size_t words = MEMORY_MAX - start < IR_MAX_INSTRS ? MEMORY_MAX - start : IR_MAX_INSTRS;
+		memcpy(b->code, memory + start, words * sizeof(uint16_t));
+		b->translated = ir_build(&b->ir, b->code, start);
+		if (b->translated) {
+			if (dump) {
+				flockfile(stderr);
+				fprintf(stderr, "\n");
+				ir_dump(&b->ir, stderr);
+			}
+			ir_optimize(&b->ir);
+			if (dump) {
+				fprintf(stderr, "optimized:\n");
+				ir_dump(&b->ir, stderr);
+				funlockfile(stderr);
+			}
+		}
+		uint64_t elapsed = now_ns() - begin;
+
+		pthread_mutex_lock(&lock);
+		stats.compiled++;
+		stats.compile_ns += elapsed;
+		if (elapsed > stats.compile_ns_max) stats.compile_ns_max = elapsed;
+		b->next = done;
+		done = b;
+		atomic_store_explicit(&done_pending, 1, memory_order_release);
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+void jit_start(int threads, int dump_ir) {
+	dump = dump_ir;
+	for (int i = 0; i < threads; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, compiler_thread, NULL) == 0) {
+			pthread_detach(thread);
+		}
+	}
+}
+
+static void enqueue(uint16_t start) {
+	pthread_mutex_lock(&lock);
+	if (queue_len == JIT_QUEUE_MAX) {
+		heat[start] = 0; // try again once the compilers catch up
+	} else {
+		queue[(queue_head + queue_len) % JIT_QUEUE_MAX].start = start;
+		queue[(queue_head + queue_len) % JIT_QUEUE_MAX].at = now_ns();
+		queue_len++;
+		if (queue_len > stats.queue_max) stats.queue_max = queue_len;
+		stats.queued++;
+		heat[start] = H_QUEUED;
+		pthread_cond_signal(&queue_ready);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+static void install(struct jit_block* b) {
+	uint16_t start = b->ir.start;
+	if (!b->translated) {
+		stats.untranslatable++;
+		heat[start] = H_NEVER;
+		free(b);
+		return;
+	}
+
+	// the guest may have overwritten the block while it was being compiled
+	if (memcmp(b->code, memory + start, b->ir.count * sizeof(uint16_t))) {
+		stats.stale++;
+		heat[start] = 0;
+		free(b);
+		return;
+	}
+
+	// plugins watching instructions in it need them interpreted
+	if (plugins_loaded && !plugin_compilable(start, b->ir.count)) {
+		heat[start] = H_NEVER;
+		free(b);
+		return;
+	}
+
+	for (int i = 0; i < b->ir.count; i++) jit_code[(uint16_t) (start + i)]++;
+	table[start] = b;
+	stats.installed++;
+	if (plugins_loaded) plugin_block(start, b->ir.count);
+	uint64_t latency = now_ns() - b->queued_at;
+	stats.latency_ns += latency;
+	if (latency > stats.latency_ns_max) stats.latency_ns_max = latency;
+}
+
+static void install_done(void) {
+	pthread_mutex_lock(&lock);
+	struct jit_block* list = done;
+	done = NULL;
+	atomic_store_explicit(&done_pending, 0, memory_order_relaxed);
+	pthread_mutex_unlock(&lock);
+
+	while (list) {
+		struct jit_block* next = list->next;
+		install(list);
+		list = next;
+	}
+}
+
+static void free_retired(void) {
+	while (retired) {
+		struct jit_block* next = retired->next;
+		free(retired);
+		retired = next;
+	}
+}
+
+static void fold_runs(struct jit_block* b) {
+	for (int i = 0; i < b->ir.count; i++) plugin_counts[(uint16_t) (b->ir.start + i)] += b->runs;
+	b->runs = 0;
+}
+
+void jit_sync_counts(void) {
+	for (int pc = 0; pc < MEMORY_MAX; pc++) {
+		if (table[pc] && table[pc]->runs) fold_runs(table[pc]);
+	}
+}
+
+void jit_invalidate(uint16_t address) {
+	// any block covering the address starts at most IR_MAX_INSTRS - 1 words before it
+	for (int i = 0; i < IR_MAX_INSTRS && i <= address; i++) {
+		uint16_t start = address - i;
+		struct jit_block* b = table[start];
+		if (!b || b->ir.count <= i) continue;
+
+		for (int j = 0; j < b->ir.count; j++) jit_code[(uint16_t) (start + j)]--;
+		if (b->runs) fold_runs(b);
+		table[start] = NULL;
+		heat[start] = 0;
+		stats.invalidated++;
+
+		// it might be the block that's running right now
+		b->next = retired;
+		retired = b;
+	}
+}
+
+void jit_run(int entry) {
+	while (1) {
+		if (atomic_load_explicit(&done_pending, memory_order_acquire)) install_done();
+
+		uint16_t pc = reg[R_PC];
+		struct jit_block* b = table[pc];
+		if (!b) {
+			if (entry && heat[pc] < JIT_THRESHOLD) {
+				heat[pc]++;
+			} else if (entry && heat[pc] == JIT_THRESHOLD) {
+				enqueue(pc);
+			}
+			return;
+		}
+
+		int n = ir_run(&b->ir);
+		// blocks end at a JSR, so the interpreter's check for a native routine goes here
+		if (native_entry[reg[R_PC]] && memory[(uint16_t) (pc + n - 1)] >> 12 == OP_JSR) native_call(reg[R_PC]);
+		if (plugin_counting) {
+			// count whole runs per block, and only spread them over addresses when asked
+			if (n == b->ir.count) b->runs++;
+			else for (int i = 0; i < n; i++) plugin_counts[(uint16_t) (pc + i)]++;
+		}
+		stats.instructions += n;
+		count_retired(n);
+		if (pace_hz) pace_account(n);
+		if (record_enabled) record_account(n);
+		if (smp_cores > 1) smp_account(n); // may swap in another core's registers, which is fine between blocks
+		stats.blocks_run++;
+		free_retired();
+		entry = 1; // compiled blocks always end with a jump, or just before a trap
+
+		// this is the back-edge check: every loop in compiled code goes through here
+		if (stop_requested() || outmatch_hit >= 0) return;
+	}
+}
+
+void jit_print_stats(FILE* out) {
+	pthread_mutex_lock(&lock);
+	fprintf(out, "jit: %s\n", jit_enabled ? "enabled" : "disabled");
+	fprintf(out, "  compile queue: %d now, %d max, %llu queued\n", queue_len, stats.queue_max,
+		(unsigned long long) stats.queued);
+	fprintf(out, "  compiled: %llu (%llu untranslatable, %llu stale by install time)\n",
+		(unsigned long long) stats.compiled, (unsigned long long) stats.untranslatable, (unsigned long long) stats.stale);
+	fprintf(out, "  compile time: %.1f us avg, %.1f us max\n",
+		stats.compiled ? stats.compile_ns / 1000.0 / stats.compiled : 0.0, stats.compile_ns_max / 1000.0);
+	fprintf(out, "  installed: %llu, invalidated: %llu\n",
+		(unsigned long long) stats.installed, (unsigned long long) stats.invalidated);
+	fprintf(out, "  queue-to-install latency: %.1f us avg, %.1f us max\n",
+		stats.installed ? stats.latency_ns / 1000.0 / stats.installed : 0.0, stats.latency_ns_max / 1000.0);
+	fprintf(out, "  compiled code ran %llu blocks, %llu instructions\n",
+		(unsigned long long) stats.blocks_run, (unsigned long long) stats.instructions);
+	pthread_mutex_unlock(&lock);
+}
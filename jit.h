@@ -0,0 +1,35 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Block cache for turbo mode. Block entries are counted as the guest runs, and
+//	once one gets hot it's queued to the compiler threads, which translate it to
+//	optimized IR while the interpreter keeps going. Finished blocks are installed
+//	into the dispatch table by the main thread between blocks, so the guest never
+//	waits on a compile and never sees a half-installed block.
+
+extern int jit_enabled;
+
+// start `threads` compiler threads; with `dump_ir`, each block's IR is printed to
+//	stderr before and after optimization as it's compiled
+void jit_start(int threads, int dump_ir);
+
+// run compiled blocks for as long as the PC lands on one. `entry` says whether the
+//	PC is at the start of a block (i.e. we just took a branch), which is where we
+//	look for hot spots.
+void jit_run(int entry);
+
+// throw away any compiled code covering `address`; called for every store
+void jit_invalidate(uint16_t address);
+
+// number of installed blocks covering each address, so stores can check cheaply
+extern uint8_t jit_code[];
+
+// bring plugin_counts up to date with the runs of compiled blocks
+void jit_sync_counts(void);
+
+void jit_print_stats(FILE* out);
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "latency.h"
+#include "lc3.h"
+
+#define SUB_BITS 3 // 2^SUB_BITS buckets per power of two
+#define SUB (1 << SUB_BITS)
+#define BUCKETS ((64 - SUB_BITS + 1) * SUB)
+
+int latency_enabled;
+uint64_t latency_start, latency_blocked_ns;
+
+struct histogram {
+	uint64_t count, total, max;
+	uint64_t buckets[BUCKETS];
+};
+
+// one row per trap vector we implement, one for KBSR checks, and one for cores
+//	woken by input (which only has the work part)
+enum {
+	ROW_KBSR = TRAP_WRITE - TRAP_GETC + 1,
+	ROW_WAKEUP,
+	ROWS
+};
+
+static const char* row_names[ROWS] = { "GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT", "READ", "WRITE", "KBSR", "WAKEUP" };
+
+static struct {
+	struct histogram work, blocked;
+} rows[ROWS];
+
+static int bucket_of(uint64_t v) {
+	if (v < SUB) return v;
+	int magnitude = 63 - __builtin_clzll(v);
+	return (magnitude - SUB_BITS + 1) * SUB + ((v >> (magnitude - SUB_BITS)) & (SUB - 1));
+}
+
+// the smallest value that lands in bucket i
+static uint64_t bucket_floor(int i) {
+	if (i < SUB) return i;
+	int magnitude = i / SUB + SUB_BITS - 1;
+	return (uint64_t) (SUB + i % SUB) << (magnitude - SUB_BITS);
+}
+
+static void add(struct histogram* h, uint64_t v) {
+	h->count++;
+	h->total += v;
+	if (v > h->max) h->max = v;
+	h->buckets[bucket_of(v)]++;
+}
+
+// the highest value in the bucket holding the p-th percentile
+static uint64_t percentile(const struct histogram* h, double p) {
+	uint64_t rank = (uint64_t) (h->count * p / 100.0 + 0.5);
+	if (rank < 1) rank = 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			uint64_t top = i + 1 < BUCKETS ? bucket_floor(i + 1) - 1 : h->max;
+			return top < h->max ? top : h->max;
+		}
+	}
+	return h->max;
+}
+
+static void end(int row) {
+	uint64_t total = now_ns() - latency_start;
+	uint64_t blocked = latency_blocked_ns < total ? latency_blocked_ns : total;
+	add(&rows[row].work, total - blocked);
+	add(&rows[row].blocked, blocked);
+}
+
+void latency_end_trap(uint16_t vector) {
+	if (vector >= TRAP_GETC && vector <= TRAP_WRITE) end(vector - TRAP_GETC);
+}
+
+void latency_end_kbsr(void) {
+	end(ROW_KBSR);
+}
+
+void latency_wakeup(uint64_t ns) {
+	add(&rows[ROW_WAKEUP].work, ns);
+}
+
+static void print_row(FILE* out, const char* name, const char* part, const struct histogram* h) {
+	fprintf(out, "  %-6s %-8s %10llu %9.2f %9.2f %9.2f %9.2f %11.2f\n", name, part,
+		(unsigned long long) h->count, percentile(h, 50) / 1000.0, percentile(h, 90) / 1000.0,
+		percentile(h, 99) / 1000.0, h->max / 1000.0, h->total / 1000000.0);
+}
+
+void latency_print_stats(FILE* out) {
+	if (!latency_enabled) return;
+	fprintf(out, "trap latency (us):     count       p50       p90       p99       max    total ms\n");
+	for (int i = 0; i < ROWS; i++) {
+		if (!rows[i].work.count) continue;
+		if (i == ROW_WAKEUP) {
+			print_row(out, row_names[i], "to run", &rows[i].work);
+			continue;
+		}
+		print_row(out, row_names[i], "work", &rows[i].work);
+		print_row(out, "", "blocked", &rows[i].blocked);
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "io.h"
+
+// Host time spent in each trap vector and in KBSR checks, split into the VM's
+//	own work and the time it sat blocked on stdin or stdout, so a sluggish
+//	session can be blamed on the guest or on the host. Each of those gets a
+//	log-bucketed histogram (eight buckets per power of two, so any value is off
+//	by at most 12.5%) that's cheap to update and still gives decent percentiles.
+
+extern int latency_enabled;
+
+// the trap (or KBSR check) being timed: where it started, and how long it's been
+//	blocked so far
+extern uint64_t latency_start, latency_blocked_ns;
+
+// bracket a trap or KBSR check; everything io.c blocks on in between is added
+//	with latency_blocked()
+static inline void latency_begin(void) {
+	latency_start = now_ns();
+	latency_blocked_ns = 0;
+}
+
+static inline void latency_blocked(uint64_t ns) {
+	latency_blocked_ns += ns;
+}
+
+void latency_end_trap(uint16_t vector);
+void latency_end_kbsr(void);
+
+// with --cores and the fair scheduler: from a key arriving for a core waiting on
+//	it to that core running again
+void latency_wakeup(uint64_t ns);
+
+void latency_print_stats(FILE* out);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef LC3_H
+#define LC3_H
+
+#include <stdint.h>
+
+// machine state
+enum {
+	S_OFF = 0,
+	S_STEP, // single-step/debugging mode
+	S_TURBO // full speed
+};
+
+extern int state;
+extern int next_state; // what state becomes at the end of the current instruction
+
+// memory
+#define MEMORY_MAX (1 << 16)
+extern uint16_t memory[MEMORY_MAX];
+
+// registers
+enum {
+	R_R0 = 0,
+	R_R1,
+	R_R2,
+	R_R3,
+	R_R4,
+	R_R5,
+	R_R6,
+	R_R7,
+	R_PC,
+	R_COND,
+	R_COUNT
+};
+
+extern uint16_t reg[R_COUNT];
+
+// opcodes
+enum {
+	OP_BR = 0,	// branch
+	OP_ADD,		// add
+	OP_LD,		// load
+	OP_ST,		// store
+	OP_JSR,		// jump register
+	OP_AND,		// bitwise and
+	OP_LDR,		// load register
+	OP_STR,		// store register
+	OP_RTI,		// unused
+	OP_NOT,		// bitwise not
+	OP_LDI,		// load indirect
+	OP_STI,		// store indirect
+	OP_JMP,		// jump
+	OP_RES,		// reserved (unused)
+	OP_LEA,		// load effective address
+	OP_TRAP		// execute trap
+};
+
+// condition flags
+enum {
+	FL_POS = 1 << 0, // P
+	FL_ZRO = 1 << 1, // Z
+	FL_NEG = 1 << 2  // N
+};
+
+// trap codes
+enum {
+	TRAP_GETC = 0x20,	// get character from keyboard, don't echo to terminal
+	TRAP_OUT = 0x21,	// output a character
+	TRAP_PUTS = 0x22,	// output a word string
+	TRAP_IN = 0x23,		// get character from keyboard, do echo to terminal
+	TRAP_PUTSP = 0x24,	// output a byte string
+	TRAP_HALT = 0x25,	// halt the machine
+	// with --bulk-traps: move R1 characters between the console and the buffer at R0.
+	//	R2 bit 0 packs two characters per word (low byte first), bit 1 makes it
+	//	non-blocking. R0 gets the count moved, or -1 for a READ at the end of input.
+	TRAP_READ = 0x26,
+	TRAP_WRITE = 0x27
+};
+
+// R2 flags for TRAP_READ and TRAP_WRITE
+enum {
+	BULK_PACKED = 1 << 0,
+	BULK_NONBLOCK = 1 << 1
+};
+
+// memory-mapped registers
+enum {
+	MR_KBSR = 0xFE00, // keyboard status
+	MR_KBDR = 0xFE02, // keyboard data
+	MR_DSR = 0xFE04,  // display status (always ready)
+	MR_DDR = 0xFE06,  // display data: storing a character prints it
+	MR_CORE = 0xFE08  // number of the core reading it (with --cores)
+};
+
+// everything from here up is device space; reads can have side effects
+#define MMIO_BASE 0xFE00
+
+uint16_t sign_extend(uint16_t x, int bit_count);
+void mem_write(uint16_t address, uint16_t value);
+uint16_t mem_read(uint16_t address);
+
+#endif
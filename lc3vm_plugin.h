@@ -0,0 +1,63 @@
+#ifndef LC3VM_PLUGIN_H
+#define LC3VM_PLUGIN_H
+
+#include <stdint.h>
+
+// Plugins are shared objects loaded with --plugin path.so[:args]. Each one exports
+//	lc3vm_plugin_init(), which gets a struct lc3vm_plugin with the machine and the
+//	host's services filled in, and fills in whichever callbacks it wants. Callbacks
+//	it leaves NULL cost nothing.
+//
+//	Instruction and memory callbacks only fire for the addresses a plugin watches,
+//	and only blocks containing watched instructions lose the JIT (whenever they're
+//	watched); compiled code sends its loads and stores of watched data through
+//	the callbacks like the interpreter does. For plain
+//	execution counts, ask for exec_counts() instead: the engine keeps those itself
+//	(per compiled block, not per instruction) and they don't turn the JIT off.
+//
+//	A minimal plugin:
+//
+//		#include "lc3vm_plugin.h"
+//		static void trap(struct lc3vm_plugin* self, uint16_t vector) { ... }
+//		int lc3vm_plugin_init(struct lc3vm_plugin* self) {
+//			if (self->version != LC3VM_PLUGIN_VERSION) return 0;
+//			self->on_trap = trap;
+//			return 1;
+//		}
+//
+//	Build it with `cc -shared -fPIC -I/path/to/lc3vm -o trap.so trap.c`.
+//	plugins/noop.c is the smallest one there is, for measuring what loading a
+//	plugin costs.
+
+#define LC3VM_PLUGIN_VERSION 1
+
+struct lc3vm_plugin {
+	// filled in by lc3vm
+	int version;
+	const char* args;	// whatever followed the ':' in --plugin, or ""
+	uint16_t* memory;	// all 65536 words; writes here bypass devices and the JIT's invalidation
+	uint16_t* reg;		// R0-R7, PC, COND
+
+	// call on_exec for instructions in from..to (inclusive)
+	void (*watch_exec)(struct lc3vm_plugin* self, uint16_t from, uint16_t to);
+	// call on_read and on_write for accesses to from..to (inclusive)
+	void (*watch_memory)(struct lc3vm_plugin* self, uint16_t from, uint16_t to);
+	// per-address execution counts kept by the engine; asking turns them on, and each
+	//	call brings them up to date
+	const uint64_t* (*exec_counts)(struct lc3vm_plugin* self);
+
+	// filled in by the plugin
+	void* data;
+	void (*on_start)(struct lc3vm_plugin* self);	// about to run the first instruction
+	void (*on_exit)(struct lc3vm_plugin* self);	// the VM is shutting down
+	void (*on_block)(struct lc3vm_plugin* self, uint16_t start, uint16_t count); // the JIT installed a block
+	void (*on_exec)(struct lc3vm_plugin* self, uint16_t pc, uint16_t instr); // before it runs
+	void (*on_read)(struct lc3vm_plugin* self, uint16_t address, uint16_t value);
+	void (*on_write)(struct lc3vm_plugin* self, uint16_t address, uint16_t from, uint16_t to);
+	void (*on_trap)(struct lc3vm_plugin* self, uint16_t vector); // before the trap runs
+};
+
+// exported by every plugin; return 0 to refuse to load
+int lc3vm_plugin_init(struct lc3vm_plugin* self);
+
+#endif
@@ -10,120 +10,65 @@
 #include <sys/types.h>
 #include <sys/termios.h>
 #include <sys/mman.h>
+#include <getopt.h>
 
 #include "linenoise.h"
+#include "lc3.h"
+#include "ir.h"
+#include "jit.h"
+#include "events.h"
+#include "io.h"
+#include "tui.h"
+#include "disasm.h"
+#include "stop.h"
+#include "status.h"
+#include "sym.h"
+#include "pace.h"
+#include "fb.h"
+#include "heat.h"
+#include "prof.h"
+#include "trace.h"
+#include "record.h"
+#include "sweep.h"
+#include "commands.h"
+#include "plugin.h"
+#include "latency.h"
+#include "outmatch.h"
+#include "smp.h"
+#include "taint.h"
+#include "pool.h"
+#include "traptrace.h"
+#include "native.h"
 
-struct termios original_tio;
-
-void disable_input_buffering(void) {
-	tcgetattr(STDIN_FILENO, &original_tio);
-	struct termios new_tio = original_tio;
-	new_tio.c_lflag &= ~ICANON & ~ECHO;
-	tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
-}
-
-void restore_input_buffering(void) {
-	tcsetattr(STDIN_FILENO, TCSANOW, &original_tio);
-}
-
-uint16_t check_key(void) {
-	fd_set readfds;
-	FD_ZERO(&readfds);
-	FD_SET(STDIN_FILENO, &readfds);
+int state = S_STEP;
+int next_state = S_STEP; // prevent mid-loop state changes
 
-	struct timeval timeout;
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 0;
-	return select(1, &readfds, NULL, NULL, &timeout) != 0;
-}
+static int bulk_traps; // whether TRAP_READ and TRAP_WRITE exist
 
-// machine state
-enum {
-	S_OFF = 0,
-	S_STEP, // single-step/debugging mode
-	S_TURBO // full speed
+// the machine as it was before the instruction we're single-stepping
+struct snapshot {
+	uint16_t memory[MEMORY_MAX];
+	uint16_t reg[R_COUNT];
 };
+static struct pool snapshots;
 
-int state = S_STEP;
-int next_state = S_STEP; // prevent mid-loop state changes
-
+// only async-signal-safe calls in here; the main loop does the rest once it notices
 void handle_interrupt(int signal) {
 	(void) signal; // we're intentionally handling all signals the same way
-	next_state--;
-	if (state == 0) {
-		// this code won't run currently because linenoise handles it for us
+	if (stop_requested()) {
+		// nobody picked up the last ^C, so give up on the VM entirely
 		restore_input_buffering();
-		printf("\n");
-		exit(-2);
-	} else {
-		printf("Dropped into single-step mode. Press ^C again to quit.\n");
+		_exit(130);
 	}
+	request_stop();
 }
 
 // memory
-#define MEMORY_MAX (1 << 16)
 uint16_t memory[MEMORY_MAX];
 
 // registers
-enum {
-	R_R0 = 0,
-	R_R1,
-	R_R2,
-	R_R3,
-	R_R4,
-	R_R5,
-	R_R6,
-	R_R7,
-	R_PC,
-	R_COND,
-	R_COUNT
-};
-
 uint16_t reg[R_COUNT];
 
-// opcodes
-enum {
-	OP_BR = 0,	// branch
-	OP_ADD,		// add
-	OP_LD,		// load
-	OP_ST,		// store
-	OP_JSR,		// jump register
-	OP_AND,		// bitwise and
-	OP_LDR,		// load register
-	OP_STR,		// store register
-	OP_RTI,		// unused
-	OP_NOT,		// bitwise not
-	OP_LDI,		// load indirect
-	OP_STI,		// store indirect
-	OP_JMP,		// jump
-	OP_RES,		// reserved (unused)
-	OP_LEA,		// load effective address
-	OP_TRAP		// execute trap
-};
-
-// condition flags
-enum {
-	FL_POS = 1 << 0, // P
-	FL_ZRO = 1 << 1, // Z
-	FL_NEG = 1 << 2  // N
-};
-
-// trap codes
-enum {
-	TRAP_GETC = 0x20,	// get character from keyboard, don't echo to terminal
-	TRAP_OUT = 0x21,	// output a character
-	TRAP_PUTS = 0x22,	// output a word string
-	TRAP_IN = 0x23,		// get character from keyboard, do echo to terminal
-	TRAP_PUTSP = 0x24,	// output a byte string
-	TRAP_HALT = 0x25	// halt the machine
-};
-
-// memory-mapped registers
-enum {
-	MR_KBSR = 0xFE00, // keyboard status
-	MR_KBDR = 0xFE02  // keyboard data
-};
-
 uint16_t sign_extend(uint16_t x, int bit_count) {
 	if ((x >> (bit_count - 1)) & 1) {
 		x |= (0xFFFF << bit_count);
@@ -136,22 +81,69 @@ uint16_t swap16(uint16_t x) {
 }
 
 void mem_write(uint16_t address, uint16_t value) {
+	if (record_enabled) record_store(address);
+	if (sweeping) sweep_store(address);
+	if (trace_enabled) trace_store(address, memory[address], value);
+	if (heat_enabled) heat_write(address);
+	if (smp_tracking) smp_store(address);
+	if (plugin_memory_any && plugin_memory[address]) plugin_write(address, memory[address], value);
 	memory[address] = value;
+	if (address == MR_DDR) {
+		guest_putc((char) value);
+		guest_flush();
+	}
+	if (jit_code[address]) jit_invalidate(address);
+	if (native_code[address]) native_forget(address);
+	if (fb_enabled && address >= FB_BASE && address < FB_END) fb_touch(address);
 }
 
 uint16_t mem_read(uint16_t address) {
+	if (heat_enabled) heat_read(address);
 	// handle memory-mapped registers
 	if (address == MR_KBSR) {
-		if (check_key()) {
-			memory[MR_KBSR] = (1 << 15);
-			memory[MR_KBDR] = getchar();
+		if (latency_enabled) latency_begin();
+		uint16_t status = 0, data = memory[MR_KBDR];
+		if (replaying) {
+			if (replay_poll(&data)) status = 1 << 15;
+		} else if (sweeping) {
+			if (sweep_poll(&data)) status = 1 << 15;
+			sweep_store(MR_KBSR);
 		} else {
-			memory[MR_KBSR] = 0;
+			uint64_t begin = latency_enabled ? now_ns() : 0;
+			if (check_key()) {
+				status = 1 << 15;
+				data = getchar();
+			}
+			if (latency_enabled) latency_blocked(now_ns() - begin);
+		}
+		// a replayed key is as much input as a typed one
+		if (taint_enabled && status) taint_mem[MR_KBDR] = taint_input((int16_t) data);
+		if (recording) record_poll(status != 0, data);
+		if (smp_cores > 1) smp_polled(status != 0);
+		if (record_enabled) record_store(MR_KBSR);
+		if (trace_enabled) {
+			trace_store(MR_KBSR, memory[MR_KBSR], status);
+			trace_store(MR_KBDR, memory[MR_KBDR], data);
 		}
+		memory[MR_KBSR] = status;
+		memory[MR_KBDR] = data;
+		if (latency_enabled) latency_end_kbsr();
+	} else if (address == MR_DSR) {
+		memory[MR_DSR] = 1 << 15;
+	} else if (address == MR_CORE) {
+		memory[MR_CORE] = smp_current;
 	}
+	if (plugin_memory_any && plugin_memory[address]) plugin_read(address, memory[address]);
 	return memory[address];
 }
 
+// like mem_read, but it counts as an instruction fetch rather than a data read
+uint16_t mem_fetch(uint16_t address) {
+	if (heat_enabled) heat_fetch(address);
+	if (address < MMIO_BASE) return memory[address]; // so plugins don't see it as a read
+	return mem_read(address);
+}
+
 void update_flags(uint16_t r) {
 	if (reg[r] == 0) {
 		reg[R_COND] = FL_ZRO;
@@ -160,7 +152,14 @@ void update_flags(uint16_t r) {
 	} else {
 		reg[R_COND] = FL_POS;
 	}
-	if (state == S_STEP) printf("Set R_COND to 0x%04hX.\n", reg[R_COND]);
+}
+
+// GETC, IN and a blocking READ sit waiting for a key
+static int waits_for_key(uint16_t instr) {
+	if (instr >> 12 != OP_TRAP) return 0;
+	uint16_t vector = instr & 0xFF;
+	if (vector == TRAP_READ) return bulk_traps && reg[R_R1] && !(reg[R_R2] & BULK_NONBLOCK);
+	return vector == TRAP_GETC || vector == TRAP_IN;
 }
 
 void read_image_file(FILE* file) {
@@ -191,44 +190,381 @@ int read_image(const char* image_path) {
 	return 1; // success
 }
 
-void print_changes(uint16_t* previous_memory, uint16_t* previous_reg) {
-	for (int i = 0; (unsigned) i < MEMORY_MAX; i++) {
-		if (memory[i] != previous_memory[i]) {
-			printf("Changed memory at address 0x%04hX from 0x%04hX to 0x%04hX.\n", i, previous_memory[i], memory[i]);
-		}
+void print_usage(void) {
+	printf("Usage: lc3vm [options] [image-file1] ...\n");
+	printf("       lc3vm trace-diff [options] TRACE-A TRACE-B\n");
+	printf("       lc3vm slice [options] TRACE REG|ADDR [at N]\n");
+	printf("       lc3vm regen [options] RECORDING TRACE\n");
+	printf("  --no-jit\t\tDon't compile hot blocks in turbo mode.\n");
+	printf("  --jit-threads N\tNumber of background compiler threads (default 1).\n");
+	printf("  --dump-ir\t\tPrint each block's IR to stderr as it's compiled.\n");
+	printf("  --events FD|FILE\tWrite a structured record of each single-stepped instruction.\n");
+	printf("  --events-format F\tFormat of those records: json (JSON Lines, default) or binary.\n");
+	printf("  --status\t\tShow a live status line while running in turbo mode.\n");
+	printf("  --clock HZ\t\tRun turbo mode at HZ instructions per second (k and M suffixes work).\n");
+	printf("  --framebuffer[=TTY]\tShow the 128x124 framebuffer at 0xC000, here or on another terminal.\n");
+	printf("  --heatmap PREFIX\tCount memory accesses and write PREFIX.txt, .csv, -pc.csv and .ppm at exit.\n");
+	printf("\t\t\tTurns off the JIT, since compiled code doesn't count them.\n");
+	printf("  --profile[=FILE]\tProfile basic blocks and loops, and report to FILE (or stderr) at exit.\n");
+	printf("\t\t\tAlso turns off the JIT.\n");
+	printf("  --trace FILE\t\tRecord every instruction executed, for trace-diff and slice. Also turns off the JIT.\n");
+	printf("  --record FILE\t\tRecord checkpoints and input, so regen can rebuild the trace later.\n");
+	printf("  --record-interval N\tInstructions between checkpoints (default 1000000).\n");
+	printf("  --commands FILE\tRun the debugger commands in FILE at the first prompt, before asking.\n");
+	printf("  --plugin SO[:ARGS]\tLoad an instrumentation plugin (see lc3vm_plugin.h). Can be repeated.\n");
+	printf("  --latency\t\tTime each trap vector and KBSR check, split into VM work and time\n");
+	printf("\t\t\tblocked on stdin/stdout; shown by metrics and at exit.\n");
+	printf("  --trace-traps[=LIST]\tLog every trap (or just these, e.g. getc,puts,x25) with its arguments.\n");
+	printf("  --trace-traps-file F\tWrite that log to F instead of stderr.\n");
+	printf("  --trace-traps-format F\ttext (default) or binary; see traptrace.h.\n");
+	printf("  --break-output TEXT\tDrop into single-step mode when the guest prints TEXT. Can be repeated.\n");
+	printf("  --bulk-traps\t\tAdd READ (x26) and WRITE (x27) traps that move whole buffers; see lc3.h.\n");
+	printf("  --cores N\t\tRun N cores on shared memory; each reads its number from 0xFE08.\n");
+	printf("  --quantum N\t\tInstructions a core runs before another gets a turn (default 1000;\n");
+	printf("\t\t\twithout --deterministic, quanta vary randomly around it).\n");
+	printf("  --deterministic\tSchedule the cores round robin in fixed quanta.\n");
+	printf("  --core-threads N\tWith --deterministic, run up to N quanta at once on host threads\n");
+	printf("\t\t\twhere the cores touch different pages; the results are the same.\n");
+	printf("  --core-weights W,...\tShare instructions between the cores in these proportions (default 1 each).\n");
+	printf("  --core-classes C,...\ti (interactive, the default) or b (batch) per core; interactive cores\n");
+	printf("\t\t\tgo first, and a core waiting on a key runs as soon as one arrives.\n");
+	printf("  --schedule-record F\tSave the order and length of every quantum to F.\n");
+	printf("  --schedule-replay F\tRun the cores exactly as recorded in F.\n");
+	printf("  --taint[=FILE]\tTrack which branches and output depend on which input characters, and\n");
+	printf("\t\t\treport to FILE (or stderr) at exit. Also turns off the JIT.\n");
+	printf("  --native[=LIST]\tRun the library routines in native.h natively wherever they turn up.\n");
+	printf("\t\t\tLIST can add symbols (also trust routines found by name) and verify (run\n");
+	printf("\t\t\tthe guest code too and report differences; turns off the JIT).\n");
+	printf("  --sweep CASES\t\tRun once per line of CASES, fed to the program as its input, and\n");
+	printf("\t\t\treport each case's output. Runs that reach the same state are merged.\n");
+	printf("  --sweep-every N\tInstructions between state comparisons (default 10000).\n");
+	printf("  --sweep-limit N\tMost instructions to run for any one case (default 100000000).\n");
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && !strcmp(argv[1], "trace-diff")) return trace_diff_main(argc - 1, argv + 1);
+	if (argc > 1 && !strcmp(argv[1], "slice")) return slice_main(argc - 1, argv + 1);
+	if (argc > 1 && !strcmp(argv[1], "regen")) {
+		return regen_main(argc - 1, argv + 1, access("/proc/self/exe", X_OK) == 0 ? "/proc/self/exe" : argv[0]);
 	}
 
-	for (int i = 0; (unsigned) i < R_COUNT; i++) {
-		if (reg[i] != previous_reg[i]) {
-			if (i == 8) {
-				printf("Changed PC from 0x%04hX to 0x%04hX.\n", previous_reg[i], reg[i]);
-			} else if (i == 9) {
-				printf("Changed COND from 0x%04hX to 0x%04hX.\n", previous_reg[i], reg[i]);
+	stop_init();
+	// no SA_RESTART, so ^C also interrupts whatever we're blocked in
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_interrupt;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	disable_input_buffering();
+
+	// read stdin a byte at a time, so stdio never holds on to input that poll() can't see
+	setvbuf(stdin, NULL, _IONBF, 0);
+
+	static const struct option options[] = {
+		{ "no-jit", no_argument, NULL, 'n' },
+		{ "jit-threads", required_argument, NULL, 'j' },
+		{ "dump-ir", no_argument, NULL, 'd' },
+		{ "events", required_argument, NULL, 'e' },
+		{ "events-format", required_argument, NULL, 'f' },
+		{ "status", no_argument, NULL, 's' },
+		{ "clock", required_argument, NULL, 'c' },
+		{ "framebuffer", optional_argument, NULL, 'F' },
+		{ "heatmap", required_argument, NULL, 'H' },
+		{ "profile", optional_argument, NULL, 'P' },
+		{ "trace", required_argument, NULL, 'T' },
+		{ "record", required_argument, NULL, 'R' },
+		{ "record-interval", required_argument, NULL, 'I' },
+		{ "commands", required_argument, NULL, 'C' },
+		{ "plugin", required_argument, NULL, 'p' },
+		{ "latency", no_argument, NULL, 'l' },
+		{ "trace-traps", optional_argument, NULL, 't' },
+		{ "trace-traps-file", required_argument, NULL, 'Z' },
+		{ "trace-traps-format", required_argument, NULL, 'z' },
+		{ "break-output", required_argument, NULL, 'o' },
+		{ "bulk-traps", no_argument, NULL, 'b' },
+		{ "cores", required_argument, NULL, 'N' },
+		{ "quantum", required_argument, NULL, 'q' },
+		{ "deterministic", no_argument, NULL, 'D' },
+		{ "core-threads", required_argument, NULL, 'G' },
+		{ "core-weights", required_argument, NULL, 'w' },
+		{ "core-classes", required_argument, NULL, 'k' },
+		{ "schedule-record", required_argument, NULL, 'W' },
+		{ "schedule-replay", required_argument, NULL, 'X' },
+		{ "taint", optional_argument, NULL, 'a' },
+		{ "native", optional_argument, NULL, 'u' },
+		{ "sweep", required_argument, NULL, 'S' },
+		{ "sweep-every", required_argument, NULL, 'V' },
+		{ "sweep-limit", required_argument, NULL, 'L' },
+		// regen runs us with these to rerun one stretch of a recording
+		{ "replay", required_argument, NULL, 'y' },
+		{ "segment", required_argument, NULL, 'g' },
+		{ "replay-trace", required_argument, NULL, 'Y' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int jit_threads = 1;
+	int dump_ir = 0;
+	const char* events_target = NULL;
+	int events_format = EVENTS_JSON;
+	int show_status = 0;
+	uint64_t clock_hz = 0;
+	int framebuffer = 0;
+	const char* framebuffer_path = NULL;
+	const char* heatmap_prefix = NULL;
+	int profile = 0;
+	const char* profile_path = NULL;
+	const char* trace_path = NULL;
+	const char* record_path = NULL;
+	uint64_t record_interval = 1000000;
+	int cores = 1;
+	uint64_t quantum = 1000;
+	int deterministic = 0;
+	int core_threads = 1;
+	const char* core_weights = NULL;
+	const char* core_classes = NULL;
+	const char* schedule_record = NULL;
+	const char* schedule_replay = NULL;
+	int trace_traps = 0;
+	const char* trace_traps_filter = NULL;
+	const char* trace_traps_path = NULL;
+	int trace_traps_binary = 0;
+	int taint = 0;
+	const char* taint_path = NULL;
+	int native = 0;
+	const char* native_modes = NULL;
+	const char* sweep_path = NULL;
+	uint64_t sweep_every = 10000;
+	uint64_t sweep_limit = 100000000;
+	const char* replay_path = NULL;
+	const char* replay_segment = NULL;
+	const char* replay_trace = NULL;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			jit_enabled = 0;
+			break;
+		case 'j':
+			jit_threads = atoi(optarg);
+			break;
+		case 'd':
+			dump_ir = 1;
+			break;
+		case 'e':
+			events_target = optarg;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "json")) {
+				events_format = EVENTS_JSON;
+			} else if (!strcmp(optarg, "binary")) {
+				events_format = EVENTS_BINARY;
+			} else {
+				printf("Unknown event format: %s (use json or binary)\n", optarg);
+				restore_input_buffering();
+				exit(2);
+			}
+			break;
+		case 's':
+			show_status = 1;
+			break;
+		case 'H':
+			heatmap_prefix = optarg;
+			jit_enabled = 0;
+			break;
+		case 'P':
+			profile = 1;
+			profile_path = optarg;
+			jit_enabled = 0;
+			break;
+		case 'T':
+			trace_path = optarg;
+			jit_enabled = 0;
+			break;
+		case 'R':
+			record_path = optarg;
+			break;
+		case 'I':
+			record_interval = strtoull(optarg, NULL, 10);
+			if (!record_interval) record_interval = 1;
+			break;
+		case 'C':
+			// scripts can print a lot, so only write it out when someone's about to read it
+			setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+			if (!commands_source(optarg)) {
+				printf("Failed to read commands from %s.\n", optarg);
+				restore_input_buffering();
+				exit(1);
+			}
+			break;
+		case 'p':
+			if (!plugin_load(optarg)) {
+				restore_input_buffering();
+				exit(1);
+			}
+			break;
+		case 'l':
+			latency_enabled = 1;
+			break;
+		case 't':
+			trace_traps = 1;
+			trace_traps_filter = optarg;
+			break;
+		case 'Z':
+			trace_traps_path = optarg;
+			break;
+		case 'z':
+			if (!strcmp(optarg, "text")) {
+				trace_traps_binary = 0;
+			} else if (!strcmp(optarg, "binary")) {
+				trace_traps_binary = 1;
 			} else {
-				printf("Changed register 0x%04hX from 0x%04hX to 0x%04hX.\n", i, previous_reg[i], reg[i]);
+				printf("Unknown trap log format: %s (use text or binary)\n", optarg);
+				restore_input_buffering();
+				exit(2);
+			}
+			break;
+		case 'o':
+			if (!outmatch_add(optarg)) {
+				restore_input_buffering();
+				exit(2);
 			}
+			break;
+		case 'b':
+			bulk_traps = 1;
+			break;
+		case 'N':
+			cores = atoi(optarg);
+			if (cores < 1 || cores > SMP_MAX) {
+				printf("Invalid number of cores: %s (1 to %d)\n", optarg, SMP_MAX);
+				restore_input_buffering();
+				exit(2);
+			}
+			break;
+		case 'q':
+			quantum = strtoull(optarg, NULL, 10);
+			break;
+		case 'D':
+			deterministic = 1;
+			break;
+		case 'G':
+			core_threads = atoi(optarg);
+			break;
+		case 'w':
+			core_weights = optarg;
+			break;
+		case 'k':
+			core_classes = optarg;
+			break;
+		case 'W':
+			schedule_record = optarg;
+			break;
+		case 'X':
+			schedule_replay = optarg;
+			break;
+		case 'a':
+			taint = 1;
+			taint_path = optarg;
+			jit_enabled = 0;
+			break;
+		case 'u':
+			native = 1;
+			native_modes = optarg;
+			break;
+		case 'S':
+			sweep_path = optarg;
+			jit_enabled = 0;
+			break;
+		case 'V':
+			sweep_every = strtoull(optarg, NULL, 10);
+			if (!sweep_every) sweep_every = 1;
+			break;
+		case 'L':
+			sweep_limit = strtoull(optarg, NULL, 10);
+			break;
+		case 'y':
+			replay_path = optarg;
+			break;
+		case 'g':
+			replay_segment = optarg;
+			break;
+		case 'Y':
+			replay_trace = optarg;
+			break;
+		case 'F':
+			framebuffer = 1;
+			framebuffer_path = optarg;
+			break;
+		case 'c':
+			{
+				char* suffix;
+				clock_hz = strtoull(optarg, &suffix, 10);
+				if (*suffix == 'k' || *suffix == 'K') clock_hz *= 1000, suffix++;
+				else if (*suffix == 'M') clock_hz *= 1000000, suffix++;
+				if (*suffix || !clock_hz) {
+					printf("Invalid clock rate: %s\n", optarg);
+					restore_input_buffering();
+					exit(2);
+				}
+			}
+			break;
+		default:
+			print_usage();
+			restore_input_buffering();
+			exit(2);
 		}
 	}
-}
 
-int main(int argc, char** argv) {
-	signal(SIGINT, handle_interrupt);
-	disable_input_buffering();
+	if (replay_path) {
+		// we're one of regen's workers; the recording has everything, images included
+		int segment;
+		unsigned long long from, to;
+		if (!replay_segment || !replay_trace || sscanf(replay_segment, "%d,%llu,%llu", &segment, &from, &to) != 3
+			|| !replay_open(replay_path, segment, from, to, replay_trace)) {
+			fprintf(stderr, "Failed to replay %s.\n", replay_path);
+			exit(1);
+		}
+		jit_enabled = 0;
+		taint_enabled = taint; // to see what a recorded session's input reached
+		state = next_state = S_TURBO;
+		goto run;
+	}
 
-	if (argc < 2) {
-		printf("Usage: lc3vm [image-file1] ...\n");
+	if (optind >= argc) {
+		print_usage();
+		restore_input_buffering();
 		exit(2);
 	}
 
-	for (int i = 1; i < argc; i++) {
-		printf("Loading image file #%d: '%s'...\n", i, argv[i]);
+	if (events_target && !events_open(events_target, events_format)) {
+		printf("Failed to open event stream: %s.\n", events_target);
+		restore_input_buffering();
+		exit(1);
+	}
+
+	for (int i = optind; i < argc; i++) {
+		printf("Loading image file #%d: '%s'...\n", i - optind + 1, argv[i]);
 		if (!read_image(argv[i])) {
 			printf("Failed to load image: %s.\n", argv[i]);
 			exit(1);
 		}
+		sym_load_for_image(argv[i]); // it's fine if there isn't one
+	}
+	if (native) {
+		int verify = native_modes && strstr(native_modes, "verify");
+		if (taint || trace_path || record_path || (verify && cores > 1)) {
+			printf("--native doesn't work with --taint, --trace or --record yet, nor verify with --cores.\n");
+			restore_input_buffering();
+			exit(2);
+		}
+		if (!native_start(native_modes)) {
+			printf("Invalid --native list: %s (symbols and verify are allowed).\n", native_modes);
+			restore_input_buffering();
+			exit(2);
+		}
+		if (verify) jit_enabled = 0; // the guest code's run is checked at the top of every instruction
+		native_scan();
 	}
 
-	printf("You are in single-step mode. Type (h)elp for help.\n");
+	if (!sweep_path) printf("You are in single-step mode. Type (h)elp for help.\n");
 
 	// set the command history available to the user (up arrow to get last command, like the shell)
 	if (!linenoiseHistorySetMaxLen(1024)) {
@@ -243,147 +579,138 @@ int main(int argc, char** argv) {
 	// set the PC to its starting position
 	reg[R_PC] = 0x3000;
 
-	while (state) {
-		uint16_t* previous_memory;
-		uint16_t* previous_reg;
-		if (state == S_STEP) {
-			previous_memory = malloc(sizeof(memory));
-			memcpy(previous_memory, memory, sizeof(memory));
-			previous_reg = malloc(sizeof(reg));
-			memcpy(previous_reg, reg, sizeof(reg));
+	if (taint && (cores > 1 || sweep_path)) {
+		printf("--taint doesn't work with --cores or --sweep yet.\n");
+		restore_input_buffering();
+		exit(2);
+	}
+	taint_enabled = taint;
+	// every case's VM would write into the same file
+	if (sweep_path && (trace_path || record_path)) {
+		printf("--sweep doesn't work with --trace or --record yet.\n");
+		restore_input_buffering();
+		exit(2);
+	}
+	if (cores > 1) {
+		if (record_path || sweep_path) {
+			printf("--cores doesn't work with --record or --sweep yet.\n");
+			restore_input_buffering();
+			exit(2);
 		}
-
-		// fetch
-		uint16_t instr = mem_read(reg[R_PC]++);
-		uint16_t op = instr >> 12; // get first four bits
-
-		// single-step/debugger mode command line
-		if (state == S_STEP) {
+		// compiled blocks make quanta end wherever the compiler happens to be up to
+		if (deterministic || schedule_record || schedule_replay) jit_enabled = 0;
+		if (core_threads != 1 && (!deterministic || core_weights || core_classes || schedule_replay
+			|| !smp_parallel(core_threads))) {
+			printf("--core-threads takes 1 to %d, and only works with --deterministic and without\n"
+				"--core-weights, --core-classes or --schedule-replay.\n", SMP_MAX);
 			restore_input_buffering();
-			printf("\nFetched instruction from 0x%04hX, containing 0x%04hX.\n", reg[R_PC]-1, instr);
-
-			while (1) {
-				// get user command
-				char* line = linenoise("(lc3vm) ");
-
-				// linenoise intercepts ^C, so if it receives that, we need to restore and exit
-				if (line == NULL) {
-					goto end;
-				};
-
-				// add command to history
-				linenoiseHistoryAdd(line);
-
-				if (!strncmp(line, "h", 1)) {
-					printf("lc3vm commands:\n");
-					printf("help\t\t\t-- Print this help page.\n");
-					printf("continue\t\t-- Continue execution. Get back here with ^C.\n");
-					printf("step\t\t\t-- Step forward one instruction.\n");
-					printf("memory [addr] [n]\t-- Display n words of memory starting from addr.\n");
-					printf("reg\t\t\t-- Display the contents of the registers.\n");
-
-					printf("\nPress ^C or ^D to exit. You can abbreviate commands with their first letters.\n");
-				} else if (!strncmp(line, "c", 1)) {
-					next_state++; // move from S_STEP to S_TURBO
-					break;
-				} else if (!strncmp(line, "s", 1)) {
-					break;
-				} else if (!strncmp(line, "r", 1)) {
-					printf("R0:\t 0x%04hX\n", reg[R_R0]);
-					printf("R1:\t 0x%04hX\n", reg[R_R1]);
-					printf("R2:\t 0x%04hX\n", reg[R_R2]);
-					printf("R3:\t 0x%04hX\n", reg[R_R3]);
-					printf("R4:\t 0x%04hX\n", reg[R_R4]);
-					printf("R5:\t 0x%04hX\n", reg[R_R5]);
-					printf("R6:\t 0x%04hX\n", reg[R_R6]);
-					printf("R7:\t 0x%04hX\n", reg[R_R7]);
-					printf("PC:\t 0x%04hX\n", reg[R_PC]);
-					printf("COND:\t 0x%04hX\n", reg[R_COND]);
-				} else if (!strncmp(line, "m", 1)) {
-					// verify that we have three chunks
-					int spaces = 0;
-					char last = 'a';
-					int consecutive = 0;
-					for (int i = 0; (unsigned) i < strlen(line); i++) {
-						if (line[i] == ' ') {
-							spaces++;
-							if (last == ' ') {
-								consecutive = 1;
-								break; // this condition is an error already
-							}
-						}
-						last = line[i];
-					}
-
-					// must have exactly two spaces, they can't be consecutive, 
-					//	and the last character can't be a space
-					if (spaces != 2 || consecutive || line[strlen(line)-1] == ' ') {
-						printf("Invalid format for memory command; type 'help' for help\n");
-						goto end_single_step;
-					}
+			exit(2);
+		}
+		if ((core_weights || core_classes) && !smp_fair(core_weights, core_classes)) {
+			printf("Invalid --core-weights or --core-classes (comma-separated, one per core).\n");
+			restore_input_buffering();
+			exit(2);
+		}
+		if (!smp_start(cores, quantum, deterministic, schedule_record, schedule_replay)) {
+			printf("Failed to set up the schedule.\n");
+			restore_input_buffering();
+			exit(1);
+		}
+	}
+	if (heatmap_prefix) heat_start(reg[R_PC]);
+	if (profile) prof_start(reg[R_PC]);
+	if (trace_path && !trace_open(trace_path)) {
+		printf("Failed to open trace file: %s.\n", trace_path);
+		restore_input_buffering();
+		exit(1);
+	}
+	if (record_path && !record_open(record_path, record_interval)) {
+		printf("Failed to open recording: %s.\n", record_path);
+		restore_input_buffering();
+		exit(1);
+	}
+	if (trace_traps) {
+		if (sweep_path) {
+			printf("--trace-traps doesn't work with --sweep yet.\n");
+			restore_input_buffering();
+			exit(2);
+		}
+		if (!traptrace_start(trace_traps_filter, trace_traps_path, trace_traps_binary)) {
+			printf("Couldn't start the trap log (check the filter and the file).\n");
+			restore_input_buffering();
+			exit(1);
+		}
+	}
+	if (sweep_path) {
+		if (!sweep_start(sweep_path, sweep_every, sweep_limit)) {
+			printf("Failed to read sweep cases from %s.\n", sweep_path);
+			restore_input_buffering();
+			exit(1);
+		}
+		state = next_state = S_TURBO; // nobody's at the prompt
+	}
+run:
+	if (jit_enabled) jit_start(jit_threads, dump_ir);
+	if (show_status) status_start();
+	if (clock_hz) pace_start(clock_hz);
+	if (framebuffer && !fb_start(framebuffer_path)) {
+		printf("Couldn't show the framebuffer on %s.\n", framebuffer_path ? framebuffer_path : "this terminal (is it big enough?)");
+	}
 
-					// split the input into three chunks
-					char* line_buffer = strdup(line); // avoid clobbering the actual line in case we want to use it
-					char* chunks[3];
+	if (plugins_loaded) plugin_start();
 
-					chunks[0] = strtok(line_buffer, " ");
-					chunks[1] = strtok(NULL, " ");
-					chunks[2] = strtok(NULL, " ");
+	pool_init(&snapshots, sizeof(struct snapshot), state == S_STEP); // only one's ever in use
+	int block_entry = 1; // whether the PC is at the start of a basic block
+	while (state) {
+		if (native_verifying) native_check();
+
+		// stop at a breakpoint just as if ^C had been pressed there
+		if (state == S_TURBO && at_breakpoint(reg[R_PC])) {
+			char name[80];
+			sym_format(reg[R_PC], name, sizeof(name));
+			printf("\nBreakpoint at 0x%04hX%s%s%s.\n", reg[R_PC], *name ? " (" : "", name, *name ? ")" : "");
+			state = next_state = S_STEP;
+		}
 
-					// from the address, remove the leading 0x, if any
-					char address[5];
-					address[4] = '\0'; // add null terminator so we can use stdlib stuff without crashing
-					if (strlen(chunks[1]) == 6) {
-						for (int i = 0; i < 4; i++) {
-							address[i] = chunks[1][i+2];
-						}
-					} else if (strlen(chunks[1]) == 4) {
-						for (int i = 0; i < 4; i++) {
-							address[i] = chunks[1][i];
-						}
-					} else {
-						printf("Unrecognized address; use format 0xA2B4 or BE1F\n");
-						goto end_single_step;
-					}
+		// in turbo mode, let compiled code take over whenever it can (it doesn't know about breakpoints)
+		if (state == S_TURBO && jit_enabled && !breakpoint_count) {
+			jit_run(block_entry);
+			if (outmatch_report()) state = next_state = S_STEP; // compiled code stops right after the match
+		}
 
-					// verify that the address is valid hex (https://stackoverflow.com/a/63006498)
-					unsigned hex_count = strspn(address, "0123456789ABCDEF");
-					if (address[hex_count]) {
-						printf("Address does not appear to be valid hex; use uppercase letters\n");
-						goto end_single_step;
-					}
+		// blocking here would hold up every core, so this one goes back to waiting
+		//	without running the trap, and runs it once a key is there
+		if (smp_cores > 1 && waits_for_key(memory[reg[R_PC]]) && !guest_key_ready()) {
+			smp_yield();
+			continue;
+		}
 
-					// use sscanf to read into a uint16_t
-					unsigned address_u;
-					sscanf(address, "%04X", &address_u);
-					uint16_t address16 = address_u;
+		struct snapshot* previous = NULL;
+		if (state == S_STEP) {
+			previous = pool_take(&snapshots);
+			memcpy(previous->memory, memory, sizeof(memory));
+			memcpy(previous->reg, reg, sizeof(reg));
+		}
 
-					// determine what n is after verifying that it's valid decimal
-					unsigned dec_count = strspn(chunks[2], "0123456789");
-					if (chunks[2][dec_count]) {
-						printf("Number of words does not appear to be valid decimal\n");
-						goto end_single_step;
-					}
+		if (prof_enabled) prof_step(reg[R_PC], block_entry);
+		if (trace_enabled) trace_begin();
 
-					int n;
-					sscanf(chunks[2], "%d", &n);
+		// fetch
+		uint16_t instr = mem_fetch(reg[R_PC]++);
+		uint16_t op = instr >> 12; // get first four bits
 
-					for (int i = 0; i < n; i++) {
-						printf("Address 0x%04hX: 0x%04hX\n", address16 + i, mem_read(address16 + i));
-					}
+		if (plugin_stepping) plugin_step(reg[R_PC] - 1, instr);
 
-					free(line_buffer); // avoid memory leak
-				} else {
-					printf("Unrecognized command: %s (type 'help' for help)\n", line);
-					goto end_single_step;
-				}
+		// single-step/debugger mode command line
+		if (state == S_STEP && tui_active && tui_step() == TUI_RUN) {
+			// the full-screen debugger already decided what to do
+		} else if (state == S_STEP) {
+			int command = command_prompt(instr);
+			if (command == CMD_QUIT) goto end;
+			if (command == CMD_CONTINUE) next_state++; // move from S_STEP to S_TURBO
+		}
 
-end_single_step:
-				// don't leak the line buffer
-				linenoiseFree(line);
-				disable_input_buffering();
-			}
-		} 
+		if (taint_enabled) taint_step(instr);
 
 		switch (op) {
 		case OP_ADD:
@@ -398,11 +725,9 @@ end_single_step:
 				if (imm_flag) {
 					uint16_t imm5 = sign_extend(instr & 0x1F, 5);
 					reg[dr] = reg[sr1] + imm5;
-					if (state == S_STEP) printf("ADDed 0x%04hX (SR1) to 0x%04hX (SEXT(imm5)) and stored 0x%04hX (result) in 0x%04hX (DR).\n", sr1, imm5, reg[dr], dr);
 				} else {
 					uint16_t sr2 = instr & 0x7;
 					reg[dr] = reg[sr1] + reg[sr2];
-					if (state == S_STEP) printf("ADDed 0x%04hX (SR1) to 0x%04hX (SR2) and stored 0x%04hX (result) in 0x%04hX (DR).\n", sr1, sr2, reg[dr], dr);
 				}
 				update_flags(dr);
 			}
@@ -417,11 +742,9 @@ end_single_step:
 				if (imm_flag) {
 					uint16_t imm5 = sign_extend(instr & 0x1F, 5);
 					reg[dr] = reg[sr1] & imm5;
-					if (state == S_STEP) printf("ANDed 0x%04hX (SR1) with 0x%04hX (SEXT(imm5)) and stored 0x%04hX (result) in 0x%04hX (DR).\n", sr1, imm5, reg[dr], dr);
 				} else {
 					uint16_t sr2 = instr & 0x7;
 					reg[dr] = reg[sr1] & reg[sr2];
-					if (state == S_STEP) printf("ANDed 0x%04hX (SR1) with 0x%04hX (SR2) and stored 0x%04hX (result) in 0x%04hX (DR).\n", sr1, sr2, reg[dr], dr);
 				}
 				update_flags(dr);
 			}
@@ -433,7 +756,6 @@ end_single_step:
 				uint16_t sr = (instr >> 6) & 0x7;
 
 				reg[dr] = ~reg[sr];
-				if (state == S_STEP) printf("NOTed 0x%04hX (SR) and stored 0x%04hX (result) in 0x%04hX (DR).\n", sr, reg[dr], dr);
 				update_flags(dr);
 			}
 
@@ -444,9 +766,6 @@ end_single_step:
 				uint16_t cond_flag = (instr >> 9) & 0x7;
 				if (cond_flag & reg[R_COND]) {
 					reg[R_PC] += pc_offset;
-					if (state == S_STEP) printf("Took BRanch with flag 0x%04hX (n/z/p cond flag) and added 0x%04hX (SEXT(PCoffset9)) to PC.\n", cond_flag, pc_offset);
-				} else {
-					if (state == S_STEP) printf("Did not take BRanch with flag 0x%04hX (n/z/p cond flag) and offset 0x%04hX (SEXT(PCoffset9)).\n", cond_flag, pc_offset);
 				}
 			}
 
@@ -456,7 +775,7 @@ end_single_step:
 				// also handles the RET "instruction", which is just when the PC is loaded with the contents of R7
 				uint16_t sr = (instr >> 6) & 0x7;
 				reg[R_PC] = reg[sr];
-				if (state == S_STEP) printf("JMPed (or maybe RETed) to address at contents of 0x%04hX (BaseR).\n", sr);
+				if (heat_enabled && sr == R_R7) heat_return();
 			}
 
 			break;
@@ -467,12 +786,12 @@ end_single_step:
 				if (long_flag) {
 					uint16_t long_pc_offset = sign_extend(instr & 0x7FF, 11); // JSR
 					reg[R_PC] += long_pc_offset;
-					if (state == S_STEP) printf("JSRed to PC + 0x%04hX (SEXT(PCoffset11)) and stored incremented PC in R7.\n", long_pc_offset);
 				} else {
 					uint16_t sr = (instr >> 6) & 0x7;
 					reg[R_PC] = reg[sr]; // JSRR
-					if (state == S_STEP) printf("JSRRed to address at contents of 0x%04hX (BaseR) and stored incremented PC in R7.\n", sr);
 				}
+				if (heat_enabled) heat_call(reg[R_PC]);
+				if (native_entry[reg[R_PC]] && !at_breakpoint(reg[R_PC])) native_call(reg[R_PC]);
 			}
 
 			break;
@@ -481,7 +800,6 @@ end_single_step:
 				uint16_t dr = (instr >> 9) & 0x7;
 				uint16_t pc_offset = sign_extend(instr & 0x1FF, 9);
 				reg[dr] = mem_read(reg[R_PC] + pc_offset);
-				if (state == S_STEP) printf("LDed contents of address PC + 0x%04hX (SEXT(PCoffset9)) into 0x%04hX (DR).\n", pc_offset, dr);
 				update_flags(dr);
 			}
 
@@ -493,7 +811,6 @@ end_single_step:
 				// add PC offset to current PC, look at the referenced memory location
 				//	to get the final memory location
 				reg[dr] = mem_read(mem_read(reg[R_PC] + pc_offset));
-				if (state == S_STEP) printf("LDIed contents of address at contents of address PC + 0x%04hX (SEXT(PCoffset9)) into 0x%04hX (DR).\n", pc_offset, dr);
 				update_flags(dr);
 			}
 
@@ -504,7 +821,6 @@ end_single_step:
 				uint16_t sr = (instr >> 6) & 0x7;
 				uint16_t offset = sign_extend(instr & 0x3F, 6);
 				reg[dr] = mem_read(reg[sr] + offset);
-				if (state == S_STEP) printf("LDRed contents of address at register 0x%04hX (BaseR) + 0x%04hX (SEXT(offset6)) into 0x%04hX (DR).\n", sr, offset, dr);
 				update_flags(dr);
 			}
 
@@ -514,7 +830,6 @@ end_single_step:
 				uint16_t dr = (instr >> 9) & 0x7;
 				uint16_t pc_offset = sign_extend(instr & 0x1FF, 9);
 				reg[dr] = reg[R_PC] + pc_offset;
-				if (state == S_STEP) printf("LEAed address (not contents of addr.) PC + 0x%04hX (SEXT(PCoffset9)) into 0x%04hX (DR).\n", pc_offset, dr);
 				update_flags(dr);
 			}
 
@@ -524,7 +839,6 @@ end_single_step:
 				uint16_t sr = (instr >> 9) & 0x7;
 				uint16_t pc_offset = sign_extend(instr & 0x1FF, 9);
 				mem_write(reg[R_PC] + pc_offset, reg[sr]);
-				if (state == S_STEP) printf("STed contents of register 0x%04hX (SR) into address PC + 0x%04hX (SEXT(PCoffset9)) = 0x%04hX.\n", sr, pc_offset, reg[R_PC] + pc_offset);
 			}
 
 			break;
@@ -533,7 +847,6 @@ end_single_step:
 				uint16_t sr = (instr >> 9) & 0x7;
 				uint16_t pc_offset = sign_extend(instr & 0x1FF, 9);
 				mem_write(mem_read(reg[R_PC] + pc_offset), reg[sr]);
-				if (state == S_STEP) printf("STIed contents of register 0x%04hX (SR) into address at contents of address PC + 0x%04hX (SEXT(PCoffset9)).\n", sr, pc_offset);
 			}
 
 			break;
@@ -543,26 +856,36 @@ end_single_step:
 				uint16_t baseR = (instr >> 6) & 0x7;
 				uint16_t offset = sign_extend(instr & 0x3F, 6);
 				mem_write(reg[baseR] + offset, reg[sr]);
-				if (state == S_STEP) printf("STRed contents of register 0x%04hX (SR) into address 0x%04hX (SEXT(offset6)) + 0x%04hX (BaseR).\n", sr, offset, baseR);
 			}
 
 			break;
 		case OP_TRAP:
 			{
+				if (plugin_traps) plugin_trap(instr & 0xFF);
+				if (traptrace_enabled) traptrace_begin(instr & 0xFF);
+				if (latency_enabled) latency_begin();
+				uint16_t r7 = reg[R_R7];
 				reg[R_R7] = reg[R_PC];
 				switch (instr & 0xFF) {
 				case TRAP_GETC:
 					{
 						// read a single ASCII char
-						reg[R_R0] = (uint16_t) getchar();
+						int c = guest_getchar();
+						if (c == GUEST_STOPPED) {
+							// we'll run the trap again when the guest resumes
+							reg[R_R7] = r7;
+							reg[R_PC]--;
+							break;
+						}
+						reg[R_R0] = (uint16_t) c;
 						update_flags(R_R0);
 					}
 
 					break;
 				case TRAP_OUT:
 					{
-						putc((char) reg[R_R0], stdout);
-						fflush(stdout);
+						guest_putc((char) reg[R_R0]);
+						guest_flush();
 					}
 
 					break;
@@ -571,19 +894,26 @@ end_single_step:
 						// one char per word, not one char per byte
 						uint16_t* c = memory + reg[R_R0];
 						while (*c) {
-							putc((char) *c, stdout);
+							guest_putc((char) *c);
 							++c;
 						}
-						fflush(stdout);
+						guest_flush();
 					}
 
 					break;
 				case TRAP_IN:
 					{
-						printf("Enter a character: ");
-						char c = getchar();
-						putc(c, stdout);
-						fflush(stdout);
+						guest_puts("Enter a character: ");
+						guest_flush();
+						int key = guest_getchar();
+						if (key == GUEST_STOPPED) {
+							reg[R_R7] = r7;
+							reg[R_PC]--;
+							break;
+						}
+						char c = key;
+						guest_putc(c);
+						guest_flush();
 						reg[R_R0] = (uint16_t) c;
 						update_flags(R_R0);
 					}
@@ -596,31 +926,54 @@ end_single_step:
 						uint16_t* c = memory + reg[R_R0];
 						while (*c) {
 							char char1 = (*c) & 0xFF;
-							putc(char1, stdout);
+							guest_putc(char1);
 							char char2 = (*c) >> 8;
-							if (char2) putc(char2, stdout);
+							if (char2) guest_putc(char2);
 							++c;
 						}
-						fflush(stdout);
+						guest_flush();
 					}
 
 					break;
 				case TRAP_HALT:
 					{
-						puts("HALT");
-						fflush(stdout);
-						next_state = S_OFF;
+						guest_puts("HALT\n");
+						guest_flush();
+						if (smp_cores == 1 || !smp_halt()) next_state = S_OFF; // other cores keep going
+					}
+
+					break;
+				case TRAP_READ:
+				case TRAP_WRITE:
+					{
+						if (!bulk_traps) {
+							goto invalid_trap; // they're only traps with --bulk-traps
+						}
+						int n = (instr & 0xFF) == TRAP_READ ? guest_read(reg[R_R0], reg[R_R1], reg[R_R2])
+							: guest_write(reg[R_R0], reg[R_R1], reg[R_R2]);
+						if (n == GUEST_STOPPED) {
+							reg[R_R7] = r7;
+							reg[R_PC]--;
+							break;
+						}
+						reg[R_R0] = (uint16_t) n;
+						update_flags(R_R0);
 					}
 
 					break;
 				default:
+				invalid_trap:
 					{
+						// finish timing and logging it, so the trap that stopped us shows up
+						if (latency_enabled) latency_end_trap(instr & 0xFF);
+						if (traptrace_enabled) traptrace_end();
 						printf("invalid trap vector: 0x%04hX\n", instr & 0xFF);
 						goto end;
 					}
 				}
+				if (latency_enabled) latency_end_trap(instr & 0xFF);
+				if (traptrace_enabled) traptrace_end();
 			}
-			if (state == S_STEP) printf("TRAPed with vector 0x%04hX.\n", instr & 0xFF);
 
 			break;
 		case OP_RES:
@@ -631,15 +984,70 @@ end_single_step:
 			goto end;
 			break;
 		}
-		// show changes to memory and registers caused by last instruction
+		// describe what the instruction did, and show changes to memory and registers
 		if (state == S_STEP) {
-			print_changes(previous_memory, previous_reg);
-			free(previous_memory);
-			free(previous_reg);
+			static struct step_event event; // keeps its buffer for memory changes
+			event_decode(&event, previous->reg[R_PC], instr, previous->memory, previous->reg);
+			if (!tui_active) event_render_text(&event, stdout);
+			events_emit(&event);
+			pool_give(&snapshots, previous);
+		}
+		if (trace_enabled) trace_record(instr);
+		if (record_enabled) record_account(1);
+		if (sweeping) sweep_account(1);
+		block_entry = op == OP_BR || op == OP_JMP || op == OP_JSR || op == OP_TRAP;
+		count_retired(1);
+		if (smp_cores > 1) smp_account(1);
+		if (state == S_TURBO && pace_hz) pace_account(1);
+
+		if (outmatch_report() && next_state == S_TURBO) next_state = S_STEP;
+		if (stop_requested()) {
+			clear_stop();
+			if (next_state == S_TURBO) {
+				printf("\nDropped into single-step mode. Press ^C again to quit.\n");
+				next_state = S_STEP;
+			} else if (next_state == S_STEP) {
+				next_state = S_OFF;
+			}
 		}
+		if (state != S_TURBO && next_state == S_TURBO) pace_rebase(); // don't count time spent at the prompt
 		state = next_state;
 	}
 
 end:
+	if (plugins_loaded) plugin_exit();
+	if (sweeping) sweep_finish();
+	fb_stop();
+	status_stop();
+	tui_leave();
 	restore_input_buffering();
+	pace_print_stats(stderr);
+	latency_print_stats(stderr);
+	trace_close();
+	traptrace_stop();
+	record_close();
+	smp_stop();
+	smp_print_stats(stderr);
+	native_print_stats(stderr);
+	if (heatmap_prefix && !heat_export(heatmap_prefix)) {
+		fprintf(stderr, "Failed to write the heatmap to %s.*\n", heatmap_prefix);
+	}
+	if (profile) {
+		FILE* out = profile_path ? fopen(profile_path, "w") : stderr;
+		if (out) {
+			prof_report(out);
+			if (out != stderr) fclose(out);
+		} else {
+			fprintf(stderr, "Failed to write the profile to %s.\n", profile_path);
+		}
+	}
+	if (taint) {
+		FILE* out = taint_path ? fopen(taint_path, "w") : stderr;
+		if (out) {
+			taint_report(out);
+			if (out != stderr) fclose(out);
+		} else {
+			fprintf(stderr, "Failed to write the taint report to %s.\n", taint_path);
+		}
+	}
 }
@@ -0,0 +1,511 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "native.h"
+#include "io.h"
+#include "sym.h"
+
+#define NATIVE_MAX 64 // routines found; native_entry has to fit their numbers
+#define VERIFY_OUTPUT 256 // characters of each side's output kept for comparing
+#define VERIFY_REPORTS 10 // differing calls described in full
+
+int native_enabled;
+int native_verifying;
+uint8_t native_entry[MEMORY_MAX];
+uint8_t native_code[MEMORY_MAX];
+
+// The library. Each routine's save slots (.BLKW 1 apiece) come right after the
+//	words here, which are all that's hashed, since the slots change as it runs.
+
+// R0 = R0 * R1, modulo 2^16; the flags follow R0
+static const uint16_t multiply_code[] = {
+	0x320C, // MULTIPLY  ST R1, MUL_R1
+	0x340C, //           ST R2, MUL_R2
+	0x1420, //           ADD R2, R0, #0
+	0x5020, //           AND R0, R0, #0
+	0x1260, //           ADD R1, R1, #0
+	0x0403, //           BRz MUL_DONE
+	0x1002, // MUL_LOOP  ADD R0, R0, R2
+	0x127F, //           ADD R1, R1, #-1
+	0x0BFD, //           BRnp MUL_LOOP
+	0x2203, // MUL_DONE  LD R1, MUL_R1
+	0x2403, //           LD R2, MUL_R2
+	0x1020, //           ADD R0, R0, #0
+	0xC1C0, //           RET
+	// MUL_R1, MUL_R2
+};
+
+// R0 = R0 / R1 and R1 = R0 % R1 for R0 >= 0 and R1 > 0, otherwise both -1; the
+//	flags follow R0
+static const uint16_t divide_code[] = {
+	0x3416, // DIVIDE    ST R2, DIV_R2
+	0x3616, //           ST R3, DIV_R3
+	0x1260, //           ADD R1, R1, #0
+	0x0C0C, //           BRnz DIV_ERR
+	0x1020, //           ADD R0, R0, #0
+	0x080A, //           BRn DIV_ERR
+	0x967F, //           NOT R3, R1
+	0x16E1, //           ADD R3, R3, #1
+	0x54A0, //           AND R2, R2, #0
+	0x1003, // DIV_LOOP  ADD R0, R0, R3
+	0x0802, //           BRn DIV_END
+	0x14A1, //           ADD R2, R2, #1
+	0x0FFC, //           BR DIV_LOOP
+	0x1201, // DIV_END   ADD R1, R0, R1
+	0x10A0, //           ADD R0, R2, #0
+	0x0E03, //           BR DIV_RET
+	0x5020, // DIV_ERR   AND R0, R0, #0
+	0x103F, //           ADD R0, R0, #-1
+	0x1220, //           ADD R1, R0, #0
+	0x2403, // DIV_RET   LD R2, DIV_R2
+	0x2603, //           LD R3, DIV_R3
+	0x1020, //           ADD R0, R0, #0
+	0xC1C0, //           RET
+	// DIV_R2, DIV_R3
+};
+
+// print R0 as a signed decimal number; the flags end up following R7
+static const uint16_t print_decimal_code[] = {
+	0x3035, // PRINT_DECIMAL ST R0, PD_R0
+	0x3235, //           ST R1, PD_R1
+	0x3435, //           ST R2, PD_R2
+	0x3635, //           ST R3, PD_R3
+	0x3835, //           ST R4, PD_R4
+	0x3A35, //           ST R5, PD_R5
+	0x3E35, //           ST R7, PD_R7
+	0x1220, //           ADD R1, R0, #0
+	0x0604, //           BRzp PD_POS
+	0x2024, //           LD R0, PD_MINUS
+	0xF021, //           OUT
+	0x927F, //           NOT R1, R1
+	0x1261, //           ADD R1, R1, #1
+	0xE422, // PD_POS    LEA R2, PD_TENS
+	0x5B60, //           AND R5, R5, #0
+	0x6680, // PD_DIGIT  LDR R3, R2, #0
+	0x0411, //           BRz PD_DONE
+	0x96FF, //           NOT R3, R3
+	0x16E1, //           ADD R3, R3, #1
+	0x5920, //           AND R4, R4, #0
+	0x1243, // PD_SUB    ADD R1, R1, R3
+	0x0802, //           BRn PD_OVER
+	0x1921, //           ADD R4, R4, #1
+	0x0FFC, //           BR PD_SUB
+	0x96FF, // PD_OVER   NOT R3, R3
+	0x16E1, //           ADD R3, R3, #1
+	0x1243, //           ADD R1, R1, R3
+	0x1B44, //           ADD R5, R5, R4
+	0x0403, //           BRz PD_NEXT
+	0x2011, //           LD R0, PD_ZERO
+	0x1004, //           ADD R0, R0, R4
+	0xF021, //           OUT
+	0x14A1, // PD_NEXT   ADD R2, R2, #1
+	0x0FED, //           BR PD_DIGIT
+	0x1B60, // PD_DONE   ADD R5, R5, #0
+	0x0A02, //           BRnp PD_RET
+	0x200A, //           LD R0, PD_ZERO
+	0xF021, //           OUT
+	0x200F, // PD_RET    LD R0, PD_R0
+	0x220F, //           LD R1, PD_R1
+	0x240F, //           LD R2, PD_R2
+	0x260F, //           LD R3, PD_R3
+	0x280F, //           LD R4, PD_R4
+	0x2A0F, //           LD R5, PD_R5
+	0x2E0F, //           LD R7, PD_R7
+	0xC1C0, //           RET
+	0x002D, // PD_MINUS  .FILL x2D
+	0x0030, // PD_ZERO   .FILL x30
+	0x2710, // PD_TENS   .FILL #10000
+	0x03E8, //           .FILL #1000
+	0x0064, //           .FILL #100
+	0x000A, //           .FILL #10
+	0x0001, //           .FILL #1
+	0x0000, //           .FILL #0
+	// PD_R0 to PD_R5, PD_R7
+};
+
+// copy the zero-terminated string at R1 to R0, the zero included; the flags
+//	end up following R2
+static const uint16_t strcpy_code[] = {
+	0x300C, // STRCPY    ST R0, SC_R0
+	0x320C, //           ST R1, SC_R1
+	0x340C, //           ST R2, SC_R2
+	0x6440, // SC_LOOP   LDR R2, R1, #0
+	0x7400, //           STR R2, R0, #0
+	0x0403, //           BRz SC_DONE
+	0x1021, //           ADD R0, R0, #1
+	0x1261, //           ADD R1, R1, #1
+	0x0FFA, //           BR SC_LOOP
+	0x2003, // SC_DONE   LD R0, SC_R0
+	0x2203, //           LD R1, SC_R1
+	0x2403, //           LD R2, SC_R2
+	0xC1C0, //           RET
+	// SC_R0, SC_R1, SC_R2
+};
+
+// R0 = the difference between the first characters that differ in the strings
+//	at R0 and R1, or 0 if they're the same; the flags follow R0
+static const uint16_t strcmp_code[] = {
+	0x3213, // STRCMP    ST R1, CMP_R1
+	0x3413, //           ST R2, CMP_R2
+	0x3613, //           ST R3, CMP_R3
+	0x6400, // CMP_LOOP  LDR R2, R0, #0
+	0x6640, //           LDR R3, R1, #0
+	0x96FF, //           NOT R3, R3
+	0x16E1, //           ADD R3, R3, #1
+	0x1683, //           ADD R3, R2, R3
+	0x0A05, //           BRnp CMP_DONE
+	0x14A0, //           ADD R2, R2, #0
+	0x0403, //           BRz CMP_DONE
+	0x1021, //           ADD R0, R0, #1
+	0x1261, //           ADD R1, R1, #1
+	0x0FF5, //           BR CMP_LOOP
+	0x10E0, // CMP_DONE  ADD R0, R3, #0
+	0x2204, //           LD R1, CMP_R1
+	0x2404, //           LD R2, CMP_R2
+	0x2604, //           LD R3, CMP_R3
+	0x1020, //           ADD R0, R0, #0
+	0xC1C0, //           RET
+	// CMP_R1, CMP_R2, CMP_R3
+};
+
+static void multiply(uint16_t entry, int exact);
+static void divide(uint16_t entry, int exact);
+static void print_decimal(uint16_t entry, int exact);
+static void string_copy(uint16_t entry, int exact);
+static void string_compare(uint16_t entry, int exact);
+
+#define LENGTH(code) ((int) (sizeof(code) / sizeof(code[0])))
+
+static struct routine {
+	const char* names[4]; // what the symbol table might call it; the first is ours
+	const uint16_t* code;
+	int length;
+	// with `exact`, do everything the code above would; otherwise just what its
+	//	convention promises
+	void (*run)(uint16_t entry, int exact);
+	uint64_t hash;
+} routines[] = {
+	{ { "MULTIPLY", "MULT", "MUL" }, multiply_code, LENGTH(multiply_code), multiply, 0 },
+	{ { "DIVIDE", "DIV" }, divide_code, LENGTH(divide_code), divide, 0 },
+	{ { "PRINT_DECIMAL", "PRINTDEC", "PRINT_NUM" }, print_decimal_code, LENGTH(print_decimal_code), print_decimal, 0 },
+	{ { "STRCPY" }, strcpy_code, LENGTH(strcpy_code), string_copy, 0 },
+	{ { "STRCMP" }, strcmp_code, LENGTH(strcmp_code), string_compare, 0 },
+};
+#define ROUTINES ((int) (sizeof(routines) / sizeof(routines[0])))
+
+// a copy of one in memory
+static struct found {
+	int routine;
+	uint16_t address;
+	int exact; // its code is the library's
+	int dropped; // something stored into it
+	uint64_t calls, verified, mismatches;
+} found[NATIVE_MAX];
+static int found_count;
+
+static int trust_symbols;
+static int verify;
+
+// with verify, the native run happens on the side: straight to memory, and
+//	output is kept rather than printed
+static int aside;
+static struct found* checking;
+static uint16_t before_reg[R_COUNT], native_reg[R_COUNT];
+static uint16_t before_memory[MEMORY_MAX], native_memory[MEMORY_MAX];
+static char native_output[VERIFY_OUTPUT], guest_output[VERIFY_OUTPUT];
+static int native_printed, guest_printed;
+static int reports;
+
+static uint64_t hash_words(const uint16_t* words, int n) {
+	uint64_t hash = 0xCBF29CE484222325ULL; // FNV-1a, a byte at a time
+	for (int i = 0; i < n; i++) {
+		hash = (hash ^ (words[i] & 0xFF)) * 0x100000001B3ULL;
+		hash = (hash ^ (words[i] >> 8)) * 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static uint16_t load(uint16_t address) {
+	return aside ? memory[address] : mem_read(address);
+}
+
+static void store(uint16_t address, uint16_t value) {
+	if (aside) memory[address] = value;
+	else mem_write(address, value);
+}
+
+// what OUT does with R0
+static void put(uint16_t c) {
+	if (aside) {
+		if (native_printed < VERIFY_OUTPUT) native_output[native_printed] = (char) c;
+		native_printed++;
+		return;
+	}
+	guest_putc((char) c);
+	guest_flush();
+}
+
+static void set_flags(uint16_t value) {
+	reg[R_COND] = !value ? FL_ZRO : value >> 15 ? FL_NEG : FL_POS;
+}
+
+static void multiply(uint16_t entry, int exact) {
+	if (exact) {
+		store(entry + 13, reg[R_R1]);
+		store(entry + 14, reg[R_R2]);
+	}
+	reg[R_R0] *= reg[R_R1]; // the loop adds R0 to itself R1 times, unsigned
+	set_flags(reg[R_R0]);
+}
+
+static void divide(uint16_t entry, int exact) {
+	if (exact) {
+		store(entry + 23, reg[R_R2]);
+		store(entry + 24, reg[R_R3]);
+	}
+	uint16_t dividend = reg[R_R0], divisor = reg[R_R1];
+	if ((int16_t) divisor <= 0 || (int16_t) dividend < 0) {
+		reg[R_R0] = reg[R_R1] = 0xFFFF;
+	} else {
+		reg[R_R0] = dividend / divisor;
+		reg[R_R1] = dividend % divisor;
+	}
+	set_flags(reg[R_R0]);
+}
+
+static void print_decimal(uint16_t entry, int exact) {
+	static const uint16_t powers[] = { 10000, 1000, 100, 10, 1 };
+	if (exact) {
+		static const int saved[] = { R_R0, R_R1, R_R2, R_R3, R_R4, R_R5, R_R7 };
+		for (int i = 0; i < 7; i++) store(entry + 54 + i, reg[saved[i]]);
+	}
+	uint16_t left = reg[R_R0];
+	if (left >> 15) {
+		put('-');
+		left = -left; // -32768 stays negative, and still comes out right below
+	}
+	uint16_t digits = 0; // their sum, which is 0 while there are only leading zeros
+	for (int i = 0; i < 5; i++) {
+		uint16_t digit = 0;
+		while (!((uint16_t) (left -= powers[i]) >> 15)) digit++;
+		left += powers[i];
+		digits += digit;
+		if (digits) put('0' + digit);
+	}
+	if (!digits) put('0');
+	set_flags(exact ? reg[R_R7] : reg[R_R0]);
+}
+
+static void string_copy(uint16_t entry, int exact) {
+	if (exact) {
+		store(entry + 13, reg[R_R0]);
+		store(entry + 14, reg[R_R1]);
+		store(entry + 15, reg[R_R2]);
+	}
+	for (uint16_t to = reg[R_R0], from = reg[R_R1]; ; to++, from++) {
+		uint16_t c = load(from);
+		store(to, c);
+		if (!c) break;
+	}
+	set_flags(exact ? reg[R_R2] : reg[R_R0]);
+}
+
+static void string_compare(uint16_t entry, int exact) {
+	if (exact) {
+		store(entry + 20, reg[R_R1]);
+		store(entry + 21, reg[R_R2]);
+		store(entry + 22, reg[R_R3]);
+	}
+	uint16_t difference;
+	for (uint16_t a = reg[R_R0], b = reg[R_R1]; ; a++, b++) {
+		uint16_t c = load(a);
+		difference = c - load(b);
+		if (difference || !c) break;
+	}
+	reg[R_R0] = difference;
+	set_flags(reg[R_R0]);
+}
+
+int native_start(const char* modes) {
+	for (const char* p = modes; p && *p; ) {
+		int n = strcspn(p, ",");
+		if (n == 7 && !strncmp(p, "symbols", n)) trust_symbols = 1;
+		else if (n == 6 && !strncmp(p, "verify", n)) verify = 1;
+		else return 0;
+		p += n;
+		if (*p == ',') p++;
+	}
+	for (int i = 0; i < ROUTINES; i++) routines[i].hash = hash_words(routines[i].code, routines[i].length);
+	return 1;
+}
+
+static int matches(int routine, uint16_t address) {
+	const struct routine* r = &routines[routine];
+	return address + r->length <= MMIO_BASE && memory[address] == r->code[0]
+		&& hash_words(&memory[address], r->length) == r->hash;
+}
+
+static void add(int routine, uint16_t address, int exact) {
+	if (found_count == NATIVE_MAX || native_entry[address]) return;
+	struct found* f = &found[found_count++];
+	f->routine = routine;
+	f->address = address;
+	f->exact = exact;
+	native_entry[address] = found_count;
+	// a trusted routine's length is a guess, so only its entry point is watched
+	for (int i = 0; i < (exact ? routines[routine].length : 1); i++) native_code[address + i] = 1;
+	native_enabled = 1;
+
+	char name[80];
+	sym_format(address, name, sizeof(name));
+	int named = *name && strcmp(name, routines[routine].names[0]); // only worth showing if it's different
+	printf("Running %s at 0x%04X%s%s%s natively%s.\n", routines[routine].names[0], address, named ? " (" : "",
+		named ? name : "", named ? ")" : "", exact ? "" : " (trusting its name)");
+}
+
+static int find_name(int routine, uint16_t* address) {
+	for (int i = 0; i < 4 && routines[routine].names[i]; i++) {
+		char lower[32];
+		const char* name = routines[routine].names[i];
+		int n = 0;
+		while (name[n] && n < 31) lower[n] = tolower(name[n]), n++;
+		lower[n] = '\0';
+		if (sym_find(name, address) || sym_find(lower, address)) return 1;
+	}
+	return 0;
+}
+
+void native_scan(void) {
+	for (int a = 0; a < MMIO_BASE; a++) {
+		for (int i = 0; i < ROUTINES; i++) {
+			if (matches(i, a)) {
+				add(i, a, 1);
+				a += routines[i].length - 1;
+				break;
+			}
+		}
+	}
+	for (int i = 0; i < ROUTINES; i++) {
+		uint16_t address;
+		if (!find_name(i, &address) || native_entry[address]) continue;
+		if (trust_symbols) {
+			add(i, address, 0);
+		} else {
+			printf("%s at 0x%04X isn't the library's code, so it runs as it is (--native=symbols trusts it).\n",
+				routines[i].names[0], address);
+		}
+	}
+}
+
+void native_call(uint16_t entry) {
+	if (native_verifying) return; // called from guest code that's being checked; it runs as it is
+	struct found* f = &found[native_entry[entry] - 1];
+	const struct routine* r = &routines[f->routine];
+	f->calls++;
+	if (!verify) {
+		r->run(entry, f->exact);
+		reg[R_PC] = reg[R_R7];
+		return;
+	}
+
+	memcpy(before_reg, reg, sizeof(reg));
+	memcpy(before_memory, memory, sizeof(memory));
+	aside = 1;
+	native_printed = 0;
+	r->run(entry, f->exact);
+	reg[R_PC] = reg[R_R7];
+	aside = 0;
+	memcpy(native_reg, reg, sizeof(reg));
+	memcpy(native_memory, memory, sizeof(memory));
+	memcpy(reg, before_reg, sizeof(reg));
+	memcpy(memory, before_memory, sizeof(memory));
+
+	// now the guest code gets its turn, from the entry point
+	checking = f;
+	guest_printed = 0;
+	native_verifying = 1;
+}
+
+void native_capture(char c) {
+	if (guest_printed < VERIFY_OUTPUT) guest_output[guest_printed] = c;
+	guest_printed++;
+}
+
+static void print_text(FILE* out, const char* text, int length) {
+	fputc('"', out);
+	for (int i = 0; i < length && i < VERIFY_OUTPUT; i++) {
+		if (text[i] == '\n') fprintf(out, "\\n");
+		else if (text[i] == '"' || text[i] == '\\') fprintf(out, "\\%c", text[i]);
+		else if (isprint((unsigned char) text[i])) fputc(text[i], out);
+		else fprintf(out, "\\x%02X", (uint8_t) text[i]);
+	}
+	fputc('"', out);
+	if (length > VERIFY_OUTPUT) fprintf(out, "...");
+}
+
+void native_check(void) {
+	if (reg[R_PC] != before_reg[R_R7]) return;
+	native_verifying = 0;
+	struct found* f = checking;
+
+	int differs = native_printed != guest_printed
+		|| memcmp(native_output, guest_output, native_printed < VERIFY_OUTPUT ? native_printed : VERIFY_OUTPUT);
+	for (int i = 0; i < R_COUNT; i++) differs |= native_reg[i] != reg[i];
+	differs |= memcmp(native_memory, memory, MMIO_BASE * sizeof(uint16_t)) != 0;
+	f->verified++;
+	if (!differs) return;
+	f->mismatches++;
+	if (reports++ == VERIFY_REPORTS) fprintf(stderr, "(not describing any more calls that differ)\n");
+	if (reports > VERIFY_REPORTS) return;
+
+	char name[80];
+	sym_format(before_reg[R_R7] - 1, name, sizeof(name));
+	fprintf(stderr, "%s at 0x%04X, called from 0x%04X%s%s%s, differs from its guest code:\n", routines[f->routine].names[0],
+		f->address, before_reg[R_R7] - 1, *name ? " (" : "", name, *name ? ")" : "");
+	static const char* names[R_COUNT] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND" };
+	for (int i = 0; i < R_COUNT; i++) {
+		if (native_reg[i] != reg[i]) fprintf(stderr, "  %-4s  native 0x%04X, guest 0x%04X\n", names[i], native_reg[i], reg[i]);
+	}
+	int shown = 0;
+	for (int a = 0; a < MMIO_BASE; a++) {
+		if (native_memory[a] == memory[a]) continue;
+		if (shown++ == 8) {
+			fprintf(stderr, "  (and more memory)\n");
+			break;
+		}
+		fprintf(stderr, "  0x%04X  native 0x%04X, guest 0x%04X\n", a, native_memory[a], memory[a]);
+	}
+	if (native_printed != guest_printed || memcmp(native_output, guest_output, native_printed < VERIFY_OUTPUT ? native_printed : VERIFY_OUTPUT)) {
+		fprintf(stderr, "  output  native ");
+		print_text(stderr, native_output, native_printed);
+		fprintf(stderr, ", guest ");
+		print_text(stderr, guest_output, guest_printed);
+		fputc('\n', stderr);
+	}
+}
+
+void native_forget(uint16_t address) {
+	for (int i = 0; i < found_count; i++) {
+		struct found* f = &found[i];
+		int length = f->exact ? routines[f->routine].length : 1;
+		if (f->dropped || (uint16_t) (address - f->address) >= length) continue;
+		f->dropped = 1;
+		native_entry[f->address] = 0;
+		for (int j = 0; j < length; j++) native_code[f->address + j] = 0;
+	}
+}
+
+void native_print_stats(FILE* out) {
+	if (!native_enabled) return;
+	fprintf(out, "natives:  routine        address  code       calls%s\n", verify ? "   verified  differed" : "");
+	for (int i = 0; i < found_count; i++) {
+		struct found* f = &found[i];
+		fprintf(out, "          %-14s 0x%04X   %-8s %7llu", routines[f->routine].names[0], f->address,
+			f->dropped ? "replaced" : f->exact ? "library" : "trusted", (unsigned long long) f->calls);
+		if (verify) fprintf(out, " %10llu %9llu", (unsigned long long) f->verified, (unsigned long long) f->mismatches);
+		fputc('\n', out);
+	}
+	if (native_verifying) fprintf(out, "  (the last call to %s never returned)\n", routines[checking->routine].names[0]);
+}
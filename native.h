@@ -0,0 +1,59 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Native substitutes for common guest library routines. native.c carries the
+//	LC-3 code of a small library (MULTIPLY, DIVIDE, PRINT_DECIMAL, STRCPY and
+//	STRCMP, with their calling conventions next to them), and once the images
+//	are loaded memory is searched for copies of it by hashing: a routine whose
+//	code hashes the same as the library's is the library's, wherever it was
+//	assembled to, since all its addressing is PC-relative. A JSR or JSRR to one
+//	then runs a C version instead that leaves exactly what the guest code would
+//	have: the same registers and flags, the same words in its save slots, the
+//	same output, and back at R7.
+//
+//	The .sym file points at routines by name as well. One whose code isn't the
+//	library's is left alone unless "symbols" is given, in which case it's
+//	trusted to follow the library's convention: results and saved registers
+//	come out the same, but the flags follow the result and nothing is written
+//	to its save slots. "verify" runs each call both ways, the C version on the
+//	side, and reports anything that differs from what the guest code did.
+//
+//	A store into a routine's code drops its substitute, and a breakpoint on its
+//	entry point keeps calls to it in guest code. In single-step mode the whole
+//	call is one step.
+
+extern int native_enabled; // some routine was found
+extern int native_verifying; // a call's guest code is running, to be compared at the return
+
+// routine number + 1 at the entry point of each one we run natively
+extern uint8_t native_entry[MEMORY_MAX];
+// 1 over the code of each, so stores can check cheaply
+extern uint8_t native_code[MEMORY_MAX];
+
+// `modes` is NULL or a comma-separated list of "symbols" and "verify"; 0 if it doesn't parse
+int native_start(const char* modes);
+
+// look for the library in memory and in the symbol table, once the images are loaded
+void native_scan(void);
+
+// a JSR or JSRR just landed on `entry`: run the routine and return
+void native_call(uint16_t entry);
+
+// with verify: compare against the native run if the guest code has just returned
+void native_check(void);
+
+// with verify: the guest code printed `c`
+void native_capture(char c);
+
+// drop the routine whose code covers `address`; called by stores that hit one
+void native_forget(uint16_t address);
+
+// calls per routine, and what verify found
+void native_print_stats(FILE* out);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "outmatch.h"
+#include "lc3.h"
+#include "sym.h"
+
+#define OUTMATCH_MAX_PATTERNS 64
+#define OUTMATCH_MAX_LENGTH 256
+#define NONE 0xFFFF
+
+int outmatch_enabled;
+int outmatch_state;
+uint16_t (*outmatch_next)[256];
+int16_t* outmatch_found;
+int outmatch_hit = -1;
+
+static struct {
+	char text[OUTMATCH_MAX_LENGTH];
+	int length;
+} patterns[OUTMATCH_MAX_PATTERNS];
+static int npatterns;
+
+static void print_pattern(int p) {
+	for (int i = 0; i < patterns[p].length; i++) {
+		unsigned char c = patterns[p].text[i];
+		if (c == '\n') printf("\\n");
+		else if (c == '\t') printf("\\t");
+		else if (c == '"' || c == '\\') printf("\\%c", c);
+		else if (c < 32 || c >= 127) printf("\\x%02X", c);
+		else putchar(c);
+	}
+}
+
+// the trie of all the patterns, then failure links to fill in the missing
+//	transitions breadth first, so every state has all 256
+static void build(void) {
+	int max_states = 1;
+	for (int p = 0; p < npatterns; p++) max_states += patterns[p].length;
+	free(outmatch_next);
+	free(outmatch_found);
+	outmatch_next = malloc(max_states * sizeof(*outmatch_next));
+	outmatch_found = malloc(max_states * sizeof(*outmatch_found));
+	uint16_t* fail = malloc(max_states * sizeof(uint16_t));
+	uint16_t* queue = malloc(max_states * sizeof(uint16_t));
+
+	int states = 1;
+	memset(outmatch_next[0], 0xFF, sizeof(outmatch_next[0]));
+	outmatch_found[0] = -1;
+	for (int p = 0; p < npatterns; p++) {
+		int s = 0;
+		for (int i = 0; i < patterns[p].length; i++) {
+			uint8_t c = patterns[p].text[i];
+			if (outmatch_next[s][c] == NONE) {
+				memset(outmatch_next[states], 0xFF, sizeof(outmatch_next[states]));
+				outmatch_found[states] = -1;
+				outmatch_next[s][c] = states++;
+			}
+			s = outmatch_next[s][c];
+		}
+		if (outmatch_found[s] < 0) outmatch_found[s] = p;
+	}
+
+	int head = 0, tail = 0;
+	for (int c = 0; c < 256; c++) {
+		uint16_t t = outmatch_next[0][c];
+		if (t == NONE) {
+			outmatch_next[0][c] = 0;
+		} else {
+			fail[t] = 0;
+			queue[tail++] = t;
+		}
+	}
+	while (head < tail) {
+		uint16_t s = queue[head++];
+		// a pattern that's a suffix of this state's text matches here too
+		if (outmatch_found[s] < 0) outmatch_found[s] = outmatch_found[fail[s]];
+		for (int c = 0; c < 256; c++) {
+			uint16_t t = outmatch_next[s][c];
+			if (t == NONE) {
+				outmatch_next[s][c] = outmatch_next[fail[s]][c];
+			} else {
+				fail[t] = outmatch_next[fail[s]][c];
+				queue[tail++] = t;
+			}
+		}
+	}
+	free(fail);
+	free(queue);
+	outmatch_state = 0;
+	outmatch_enabled = npatterns > 0;
+}
+
+int outmatch_add(const char* pattern) {
+	if (npatterns == OUTMATCH_MAX_PATTERNS) {
+		printf("Too many output patterns (at most %d)\n", OUTMATCH_MAX_PATTERNS);
+		return 0;
+	}
+	int length = 0;
+	for (const char* p = pattern; *p && length < OUTMATCH_MAX_LENGTH; p++) {
+		char c = *p;
+		if (c == '\\' && p[1]) {
+			c = *++p;
+			if (c == 'n') c = '\n';
+			else if (c == 't') c = '\t';
+			else if (c == 'r') c = '\r';
+			else if (c == 's') c = ' ';
+			else if (c == 'x' && p[1] && p[2]) {
+				char hex[3] = { p[1], p[2], '\0' };
+				c = strtol(hex, NULL, 16);
+				p += 2;
+			}
+		}
+		patterns[npatterns].text[length++] = c;
+	}
+	if (!length) return 0;
+	patterns[npatterns].length = length;
+	npatterns++;
+	build();
+	return 1;
+}
+
+void outmatch_clear(void) {
+	npatterns = 0;
+	outmatch_enabled = 0;
+	outmatch_hit = -1;
+}
+
+void outmatch_list(void) {
+	if (!npatterns) printf("No output breakpoints.\n");
+	for (int p = 0; p < npatterns; p++) {
+		printf("%d: \"", p + 1);
+		print_pattern(p);
+		printf("\"\n");
+	}
+}
+
+int outmatch_report(void) {
+	if (outmatch_hit < 0) return 0;
+	uint16_t pc = reg[R_PC] - 1;
+	char name[80];
+	sym_format(pc, name, sizeof(name));
+	printf("\nOutput matched \"");
+	print_pattern(outmatch_hit);
+	printf("\" at the instruction at 0x%04hX%s%s%s.\n", pc, *name ? " (" : "", name, *name ? ")" : "");
+	outmatch_hit = -1;
+	return 1;
+}
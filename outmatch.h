@@ -0,0 +1,31 @@
+#ifndef OUTMATCH_H
+#define OUTMATCH_H
+
+#include <stdint.h>
+
+// Output breakpoints: stop when the guest prints one of a set of strings. The
+//	patterns are compiled into an Aho-Corasick automaton with every transition
+//	filled in, so each output byte costs one table lookup however many patterns
+//	there are, and a match is noticed on the byte that completes it.
+
+extern int outmatch_enabled;
+extern int outmatch_state;
+extern uint16_t (*outmatch_next)[256];	// transitions
+extern int16_t* outmatch_found;		// pattern that ends at each state, or -1
+extern int outmatch_hit;		// pattern that matched since we last looked, or -1
+
+static inline void outmatch_feed(char c) {
+	outmatch_state = outmatch_next[outmatch_state][(uint8_t) c];
+	if (outmatch_found[outmatch_state] >= 0) outmatch_hit = outmatch_found[outmatch_state];
+}
+
+// add a pattern (C-style escapes like \n work); 0 if it's empty or there are too many
+int outmatch_add(const char* pattern);
+void outmatch_clear(void);
+void outmatch_list(void);
+
+// if a pattern matched, say so (the instruction that completed it is the one just
+//	before the PC), forget it, and return 1
+int outmatch_report(void);
+
+#endif
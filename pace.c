@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "pace.h"
+#include "io.h"
+
+#define PACE_SLICE_NS 1000000 // aim for a sleep every millisecond
+#define PACE_MAX_BEHIND_NS 50000000 // further behind than this and we stop trying to catch up
+
+uint64_t pace_hz;
+int64_t pace_budget;
+
+static int64_t slice; // instructions per slice
+static uint64_t deadline; // when the current slice should end
+static uint64_t slice_start; // deadline the current slice started from
+
+static struct {
+	uint64_t instructions, slices, rebases;
+	uint64_t start, excluded_ns; // wall time, minus the time we gave up on
+	uint64_t late_ns, late_ns_max; // how long after the deadline we actually woke
+	double late_sq; // for the standard deviation
+} stats;
+
+void pace_start(uint64_t hz) {
+	pace_hz = hz;
+	slice = hz * PACE_SLICE_NS / 1000000000;
+	if (slice < 1) slice = 1;
+	pace_budget = slice;
+	stats.start = now_ns();
+	deadline = slice_start = stats.start;
+}
+
+void pace_rebase(void) {
+	if (!pace_hz) return;
+	uint64_t now = now_ns();
+	if (now > slice_start) stats.excluded_ns += now - slice_start;
+	deadline = slice_start = now;
+	pace_budget = slice;
+	stats.rebases++;
+}
+
+void pace_wait(void) {
+	// the slice may have overrun (compiled blocks don't stop mid-block), so charge
+	//	for what actually ran
+	uint64_t ran = slice - pace_budget;
+	stats.instructions += ran;
+	stats.slices++;
+	deadline = slice_start + ran * 1000000000 / pace_hz;
+
+	uint64_t now = now_ns();
+	if (now > deadline + PACE_MAX_BEHIND_NS) {
+		// we were stopped for a while; don't run flat out to make up for it
+		stats.excluded_ns += now - deadline;
+		deadline = now;
+		stats.rebases++;
+	} else if (now < deadline) {
+		// a ^C cuts this short with EINTR, which is what we want
+		struct timespec ts = { deadline / 1000000000, deadline % 1000000000 };
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		uint64_t late = now_ns() - deadline;
+		if ((int64_t) late > 0) {
+			stats.late_ns += late;
+			stats.late_sq += (double) late * late;
+			if (late > stats.late_ns_max) stats.late_ns_max = late;
+		}
+	}
+
+	slice_start = deadline;
+	pace_budget = slice;
+}
+
+void pace_print_stats(FILE* out) {
+	if (!pace_hz) return;
+	uint64_t elapsed = now_ns() - stats.start - stats.excluded_ns;
+	double achieved = elapsed ? stats.instructions * 1e9 / elapsed : 0.0;
+	double mean = stats.slices ? (double) stats.late_ns / stats.slices : 0.0;
+	double variance = stats.slices ? stats.late_sq / stats.slices - mean * mean : 0.0;
+	double deviation = variance > 0 ? sqrt(variance) : 0.0;
+	fprintf(out, "clock: %llu Hz target, %.0f Hz achieved (%.2f%%)\n", (unsigned long long) pace_hz,
+		achieved, achieved * 100 / pace_hz);
+	fprintf(out, "  %llu slices of %lld instructions, %llu rebased after stalls\n",
+		(unsigned long long) stats.slices, (long long) slice, (unsigned long long) stats.rebases);
+	fprintf(out, "  wakeup jitter: %.1f us avg, %.1f us stddev, %.1f us max\n",
+		mean / 1000, deviation / 1000, stats.late_ns_max / 1000.0);
+}
@@ -0,0 +1,32 @@
+#ifndef PACE_H
+#define PACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Clock-rate pacing for turbo mode. Instructions run in slices of about a
+//	millisecond's worth, and after each slice we sleep until an absolute deadline
+//	that advances by exactly the time those instructions should have taken, so
+//	oversleeping on one slice is made up on the next instead of piling up. If we
+//	fall far behind (the guest was blocked on input, or paused in single-step
+//	mode), the deadline is rebased to now rather than racing to catch up.
+
+extern uint64_t pace_hz; // 0 when pacing is off
+extern int64_t pace_budget; // instructions left in the current slice
+
+void pace_start(uint64_t hz);
+
+// sleep until the end of the slice that just ran out
+void pace_wait(void);
+
+// account for `n` instructions run in turbo mode
+static inline void pace_account(int n) {
+	if ((pace_budget -= n) <= 0) pace_wait();
+}
+
+// forget about lost time; called after anything that blocks the guest
+void pace_rebase(void);
+
+void pace_print_stats(FILE* out);
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+// unix only
+#include <dlfcn.h>
+
+#include "plugin.h"
+#include "lc3vm_plugin.h"
+#include "jit.h"
+
+int plugins_loaded;
+uint8_t plugin_exec[MEMORY_MAX];
+uint8_t plugin_memory[MEMORY_MAX];
+int plugin_exec_any, plugin_memory_any;
+int plugin_traps;
+int plugin_counting;
+int plugin_stepping;
+uint64_t plugin_counts[MEMORY_MAX];
+
+static struct lc3vm_plugin plugins[PLUGIN_MAX];
+
+static int index_of(const struct lc3vm_plugin* self) {
+	return self - plugins;
+}
+
+static void watch_exec(struct lc3vm_plugin* self, uint16_t from, uint16_t to) {
+	plugin_exec_any = plugin_stepping = 1;
+	for (uint32_t a = from; a <= to; a++) {
+		plugin_exec[a] |= 1 << index_of(self);
+		// blocks compiled before we were asked; install() keeps them from coming back
+		if (jit_code[a]) jit_invalidate(a);
+	}
+}
+
+static void watch_memory(struct lc3vm_plugin* self, uint16_t from, uint16_t to) {
+	for (uint32_t a = from; a <= to; a++) plugin_memory[a] |= 1 << index_of(self);
+	plugin_memory_any = 1;
+}
+
+static const uint64_t* exec_counts(struct lc3vm_plugin* self) {
+	(void) self;
+	plugin_counting = plugin_stepping = 1;
+	jit_sync_counts();
+	return plugin_counts;
+}
+
+int plugin_load(const char* spec) {
+	if (plugins_loaded == PLUGIN_MAX) {
+		fprintf(stderr, "Too many plugins (at most %d).\n", PLUGIN_MAX);
+		return 0;
+	}
+	char* path = strdup(spec);
+	char* args = strchr(path, ':');
+	if (args) *args++ = '\0';
+
+	void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		fprintf(stderr, "Failed to load plugin: %s\n", dlerror());
+		free(path);
+		return 0;
+	}
+	int (*init)(struct lc3vm_plugin*);
+	*(void**) &init = dlsym(handle, "lc3vm_plugin_init");
+	if (!init) {
+		fprintf(stderr, "%s isn't an lc3vm plugin (no lc3vm_plugin_init).\n", path);
+		dlclose(handle);
+		free(path);
+		return 0;
+	}
+
+	struct lc3vm_plugin* self = &plugins[plugins_loaded];
+	memset(self, 0, sizeof(*self));
+	self->version = LC3VM_PLUGIN_VERSION;
+	self->args = args ? strdup(args) : "";
+	self->memory = memory;
+	self->reg = reg;
+	self->watch_exec = watch_exec;
+	self->watch_memory = watch_memory;
+	self->exec_counts = exec_counts;
+	if (!init(self)) {
+		fprintf(stderr, "Plugin %s declined to load.\n", path);
+		dlclose(handle);
+		free(path);
+		return 0;
+	}
+	free(path); // args points into its own copy
+	if (self->on_trap) plugin_traps = 1;
+	plugins_loaded++;
+	return 1;
+}
+
+void plugin_start(void) {
+	for (int i = 0; i < plugins_loaded; i++) {
+		if (plugins[i].on_start) plugins[i].on_start(&plugins[i]);
+	}
+}
+
+void plugin_exit(void) {
+	if (plugin_counting) jit_sync_counts();
+	for (int i = 0; i < plugins_loaded; i++) {
+		if (plugins[i].on_exit) plugins[i].on_exit(&plugins[i]);
+	}
+}
+
+void plugin_exec_hook(uint16_t pc, uint16_t instr) {
+	for (int i = 0; i < plugins_loaded; i++) {
+		if (plugin_exec[pc] & 1 << i && plugins[i].on_exec) plugins[i].on_exec(&plugins[i], pc, instr);
+	}
+}
+
+void plugin_read(uint16_t address, uint16_t value) {
+	for (int i = 0; i < plugins_loaded; i++) {
+		if (plugin_memory[address] & 1 << i && plugins[i].on_read) plugins[i].on_read(&plugins[i], address, value);
+	}
+}
+
+void plugin_write(uint16_t address, uint16_t from, uint16_t to) {
+	for (int i = 0; i < plugins_loaded; i++) {
+		if (plugin_memory[address] & 1 << i && plugins[i].on_write) plugins[i].on_write(&plugins[i], address, from, to);
+	}
+}
+
+void plugin_trap(uint16_t vector) {
+	for (int i = 0; i < plugins_loaded; i++) {
+		if (plugins[i].on_trap) plugins[i].on_trap(&plugins[i], vector);
+	}
+}
+
+void plugin_block(uint16_t start, uint16_t count) {
+	for (int i = 0; i < plugins_loaded; i++) {
+		if (plugins[i].on_block) plugins[i].on_block(&plugins[i], start, count);
+	}
+}
+
+int plugin_compilable(uint16_t start, uint16_t count) {
+	if (!plugin_exec_any) return 1;
+	for (int i = 0; i < count; i++) {
+		if (plugin_exec[(uint16_t) (start + i)]) return 0;
+	}
+	return 1;
+}
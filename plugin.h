@@ -0,0 +1,45 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stdint.h>
+
+#include "lc3.h"
+
+// The engine's side of lc3vm_plugin.h. Each loaded plugin gets a bit in the
+//	watch masks, so the hooks in the interpreter and mem_read/mem_write only call
+//	out for addresses somebody asked about.
+
+#define PLUGIN_MAX 8
+
+extern int plugins_loaded;
+extern uint8_t plugin_exec[MEMORY_MAX];		// which plugins watch each instruction address
+extern uint8_t plugin_memory[MEMORY_MAX];	// which plugins watch each data address
+extern int plugin_exec_any, plugin_memory_any;	// whether those have any bits set at all
+extern int plugin_traps;			// somebody has on_trap
+extern int plugin_counting;			// somebody asked for exec_counts()
+extern int plugin_stepping;			// plugin_counting || plugin_exec_any
+extern uint64_t plugin_counts[MEMORY_MAX];
+
+// load path[:args]; 0 (after saying why) if it won't load
+int plugin_load(const char* spec);
+
+void plugin_start(void);
+void plugin_exit(void);
+
+void plugin_exec_hook(uint16_t pc, uint16_t instr);
+void plugin_read(uint16_t address, uint16_t value);
+void plugin_write(uint16_t address, uint16_t from, uint16_t to);
+void plugin_trap(uint16_t vector);
+void plugin_block(uint16_t start, uint16_t count);
+
+// whether compiled code may cover start..start+count-1
+int plugin_compilable(uint16_t start, uint16_t count);
+
+// called for every interpreted instruction while plugin_stepping, so a plugin that
+//	neither counts nor watches instructions costs nothing per instruction
+static inline void plugin_step(uint16_t pc, uint16_t instr) {
+	if (plugin_counting) plugin_counts[pc]++;
+	if (plugin_exec_any && plugin_exec[pc]) plugin_exec_hook(pc, instr);
+}
+
+#endif
@@ -0,0 +1,51 @@
+; sum loop: computes and prints, then halts
+        .ORIG x3000
+        LEA R0, MSG
+        PUTS
+        AND R1, R1, #0
+        LD R2, COUNT
+OUTER   LD R3, INNER
+LOOP    ADD R1, R1, #1
+        ADD R4, R1, #0
+        ST R4, TMP
+        LD R5, TMP
+        ADD R3, R3, #-1
+        BRp LOOP
+        ADD R2, R2, #-1
+        BRp OUTER
+        ADD R0, R1, #0
+        JSR PRHEX
+        LD R0, NL
+        OUT
+        HALT
+; print R0 as 4 hex digits
+PRHEX   ST R7, SAVE7
+        ADD R1, R0, #0
+        AND R2, R2, #0
+        ADD R2, R2, #4
+PH1     AND R0, R0, #0
+        AND R3, R3, #0
+        ADD R3, R3, #4
+PH2     ADD R0, R0, R0
+        ADD R1, R1, #0
+        BRzp PH3
+        ADD R0, R0, #1
+PH3     ADD R1, R1, R1
+        ADD R3, R3, #-1
+        BRp PH2
+        LEA R4, HEX
+        ADD R4, R4, R0
+        LDR R0, R4, #0
+        OUT
+        ADD R2, R2, #-1
+        BRp PH1
+        LD R7, SAVE7
+        RET
+SAVE7   .FILL #0
+TMP     .FILL #0
+COUNT   .FILL #20000
+INNER   .FILL #1000
+NL      .FILL #10
+HEX     .STRINGZ "0123456789ABCDEF"
+MSG     .STRINGZ "bench\n"
+        .END
@@ -0,0 +1,14 @@
+// A plugin that asks for nothing, so running with it measures what the plugin
+//	hooks cost when nobody's watching. Build and compare against a plain run:
+//
+//		make plugins/noop.so
+//		echo c | time ./lc3vm plugins/loop.obj
+//		echo c | time ./lc3vm --plugin plugins/noop.so plugins/loop.obj
+//
+//	(loop.obj runs about 120M instructions; add --no-jit for the interpreter.)
+
+#include "lc3vm_plugin.h"
+
+int lc3vm_plugin_init(struct lc3vm_plugin* self) {
+	return self->version == LC3VM_PLUGIN_VERSION;
+}
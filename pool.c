@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+// unix only
+#include <sys/mman.h>
+
+#include "pool.h"
+
+#define SLAB_BYTES (1 << 20) // what a slab grows by once the warm objects run out
+#define LINE 64
+
+// map `count` objects, fault them in and put them on the free list
+static int grow(struct pool* pool, int count) {
+	size_t bytes = count * pool->size;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+	uint8_t* slab = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (slab == MAP_FAILED) return 0;
+#ifndef MAP_POPULATE
+	// touch every page ourselves; they're still zero afterwards
+	for (size_t i = 0; i < bytes; i += 4096) slab[i] = 0;
+#endif
+	for (int i = count - 1; i >= 0; i--) {
+		void* object = slab + i * pool->size;
+		*(void**) object = pool->free;
+		pool->free = object;
+	}
+	pool->slabs++;
+	pool->objects += count;
+	return 1;
+}
+
+void pool_init(struct pool* pool, size_t size, int warm) {
+	memset(pool, 0, sizeof(*pool));
+	if (size < sizeof(void*)) size = sizeof(void*);
+	pool->size = (size + LINE - 1) / LINE * LINE;
+	if (warm > 0) grow(pool, warm);
+}
+
+void* pool_take(struct pool* pool) {
+	if (!pool->free) {
+		int count = SLAB_BYTES / pool->size;
+		if (!grow(pool, count > 0 ? count : 1)) return NULL;
+	}
+	void* object = pool->free;
+	pool->free = *(void**) object;
+	pool->in_use++;
+	return object;
+}
+
+void pool_give(struct pool* pool, void* object) {
+	if (!object) return;
+	*(void**) object = pool->free;
+	pool->free = object;
+	pool->in_use--;
+}
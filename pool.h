@@ -0,0 +1,26 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Fixed-size object pools for machine state that comes and goes often, like the
+//	snapshots single-step mode takes before every instruction. Objects are carved
+//	out of big anonymous mappings, so they start out zeroed, and the slabs are
+//	faulted in up front; a released object goes on a free list rather than back
+//	to the system, so after warm-up taking one is a pointer pop, with no malloc,
+//	mmap or page faults. Objects that come back hold whatever they held before.
+
+struct pool {
+	size_t size; // of each object, rounded up to a cache line
+	void* free; // linked through each free object's first word
+	int slabs, objects, in_use;
+};
+
+// `warm` objects are mapped and faulted in straight away
+void pool_init(struct pool* pool, size_t size, int warm);
+
+// NULL only if the system is out of memory
+void* pool_take(struct pool* pool);
+void pool_give(struct pool* pool, void* object);
+
+#endif
@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prof.h"
+#include "sym.h"
+#include "disasm.h"
+
+#define PROF_TOP_BLOCKS 15
+#define PROF_TOP_LOOPS 10
+#define PROF_LISTING 12 // most instructions to disassemble per block or loop
+
+int prof_enabled;
+uint64_t prof_exec[MEMORY_MAX];
+uint8_t prof_header[MEMORY_MAX];
+uint16_t prof_last;
+
+static uint16_t entry_pc;
+static int started; // there's no transfer into the very first instruction
+static uint8_t leader[MEMORY_MAX];
+static uint8_t called[MEMORY_MAX]; // subroutine entry points
+
+enum {
+	K_BRANCH = 0,	// BR, or JMP through anything but R7
+	K_CALL,		// JSR/JSRR
+	K_RETURN,	// RET
+	K_TRAP
+};
+
+struct edge {
+	uint16_t from, to;
+	uint8_t kind, used;
+	uint64_t count;
+};
+
+static struct edge* edges;
+static int edge_count, edge_capacity; // capacity is a power of two
+
+struct trips {
+	uint64_t run; // trips in the run that's going on now
+	uint64_t histogram[PROF_BUCKETS];
+};
+
+static struct trips* trips[MEMORY_MAX];
+
+void prof_start(uint16_t entry) {
+	prof_enabled = 1;
+	entry_pc = entry;
+	leader[entry] = 1;
+	called[entry] = 1;
+}
+
+static int bucket(uint64_t n) {
+	int b = 63 - __builtin_clzll(n);
+	return b < PROF_BUCKETS ? b : PROF_BUCKETS - 1;
+}
+
+static int kind_of(uint16_t instr) {
+	switch (instr >> 12) {
+	case OP_JSR:
+		return K_CALL;
+	case OP_JMP:
+		return ((instr >> 6) & 0x7) == R_R7 ? K_RETURN : K_BRANCH;
+	case OP_TRAP:
+		return K_TRAP;
+	case OP_BR:
+		return K_BRANCH;
+	default:
+		return -1; // fell through
+	}
+}
+
+static void grow_edges(void) {
+	struct edge* old = edges;
+	int old_capacity = edge_capacity;
+	edge_capacity = edge_capacity ? edge_capacity * 2 : 1024;
+	edges = calloc(edge_capacity, sizeof(*edges));
+	for (int i = 0; i < old_capacity; i++) {
+		if (!old[i].used) continue;
+		uint32_t h = ((uint32_t) old[i].from << 16 | old[i].to) * 2654435761u;
+		int j = h & (edge_capacity - 1);
+		while (edges[j].used) j = (j + 1) & (edge_capacity - 1);
+		edges[j] = old[i];
+	}
+	free(old);
+}
+
+static void count_edge(uint16_t from, uint16_t to, int kind) {
+	if (edge_count * 2 >= edge_capacity) grow_edges();
+	uint32_t h = ((uint32_t) from << 16 | to) * 2654435761u;
+	int j = h & (edge_capacity - 1);
+	while (edges[j].used && (edges[j].from != from || edges[j].to != to)) j = (j + 1) & (edge_capacity - 1);
+	if (!edges[j].used) {
+		edges[j].used = 1;
+		edges[j].from = from;
+		edges[j].to = to;
+		edges[j].kind = kind;
+		edge_count++;
+	}
+	edges[j].count++;
+}
+
+void prof_transfer(uint16_t from, uint16_t to) {
+	if (!started) {
+		started = 1;
+		return;
+	}
+	int kind = kind_of(memory[from]);
+	if (kind >= 0) {
+		leader[to] = 1;
+		if (kind == K_CALL) called[to] = 1;
+		count_edge(from, to, kind);
+	}
+
+	// trip counts, from plain branches only; a call or return going backwards isn't a loop
+	struct trips* t = trips[to];
+	if (kind == K_BRANCH && to <= from) {
+		if (!t) {
+			t = trips[to] = calloc(1, sizeof(*t));
+			t->run = 1; // the trip that got us here the first time
+			prof_header[to] = 1;
+		}
+		t->run++;
+	} else if (t && t->run) {
+		t->histogram[bucket(t->run)]++;
+		t->run = 1;
+	}
+}
+
+// the report works on a graph of the blocks seen so far, with links for
+//	branches, traps and fall-throughs inside each subroutine
+
+struct block {
+	uint16_t start, end; // end is the last instruction
+	int npreds, first_pred; // into `preds`
+	int rpo, idom;
+	int visited;
+};
+
+static struct block* blocks;
+static int nblocks;
+static int* owner; // address to block, or -1
+static int* preds;
+
+struct link {
+	int from, to;
+	uint64_t count;
+};
+
+static struct link* links;
+static int nlinks;
+
+static int is_transfer(uint16_t instr) {
+	return kind_of(instr) >= 0;
+}
+
+static void build_blocks(void) {
+	nblocks = 0;
+	blocks = calloc(MEMORY_MAX, sizeof(*blocks));
+	owner = malloc(MEMORY_MAX * sizeof(*owner));
+	for (int a = 0; a < MEMORY_MAX; a++) owner[a] = -1;
+
+	for (int a = 0; a < MEMORY_MAX; a++) {
+		if (!leader[a] || !prof_exec[a]) continue;
+		struct block* b = &blocks[nblocks];
+		b->start = b->end = a;
+		// a block runs to its first transfer, or up to the next block
+		while (!is_transfer(memory[b->end]) && b->end < MEMORY_MAX - 1 && !leader[b->end + 1]) b->end++;
+		for (int i = b->start; i <= b->end; i++) owner[i] = nblocks;
+		nblocks++;
+	}
+}
+
+static void add_link(int from, int to, uint64_t count) {
+	if (from < 0 || to < 0) return;
+	links[nlinks].from = from;
+	links[nlinks].to = to;
+	links[nlinks].count = count;
+	nlinks++;
+}
+
+static void build_links(void) {
+	nlinks = 0;
+	links = malloc((edge_count + nblocks) * sizeof(*links));
+	for (int i = 0; i < edge_capacity; i++) {
+		struct edge* e = &edges[i];
+		if (!e->used) continue;
+		switch (e->kind) {
+		case K_BRANCH:
+			add_link(owner[e->from], owner[e->to], e->count);
+			break;
+		case K_TRAP:
+			// only a trap that falls through to the next instruction joins two
+			//	blocks; an interrupted GETC runs again, so its edge goes back to
+			//	itself and is left out
+			if (e->to == (uint16_t) (e->from + 1)) add_link(owner[e->from], owner[e->to], e->count);
+			break;
+		case K_CALL:
+			// step over the call, to wherever it comes back to
+			add_link(owner[e->from], owner[(uint16_t) (e->from + 1)], e->count);
+			break;
+		case K_RETURN:
+			break;
+		}
+	}
+
+	// blocks that were split by a later branch into their middle
+	for (int b = 0; b < nblocks; b++) {
+		uint16_t last = blocks[b].end;
+		if (!is_transfer(memory[last]) && last < MEMORY_MAX - 1 && owner[last + 1] >= 0) {
+			add_link(b, owner[last + 1], prof_exec[last]);
+		}
+	}
+
+	// predecessor lists
+	for (int i = 0; i < nlinks; i++) blocks[links[i].to].npreds++;
+	int total = 0;
+	for (int b = 0; b < nblocks; b++) {
+		blocks[b].first_pred = total;
+		total += blocks[b].npreds;
+		blocks[b].npreds = 0;
+	}
+	preds = malloc((total + 1) * sizeof(*preds));
+	for (int i = 0; i < nlinks; i++) {
+		struct block* to = &blocks[links[i].to];
+		preds[to->first_pred + to->npreds++] = links[i].from;
+	}
+}
+
+// Cooper, Harvey and Kennedy's iterative dominators, over reverse postorder
+static int* order; // blocks in reverse postorder
+
+#define UNDONE (-1) // idom of a block we haven't got to yet
+#define ENTRY (-2) // a virtual entry above all the roots, for blocks reached from more than one
+
+static int up(int b) {
+	return blocks[b].idom == b ? ENTRY : blocks[b].idom;
+}
+
+// roots are numbered separately, so two walks from under different roots only
+//	meet at the virtual entry
+static int intersect(int a, int b) {
+	while (a != b && a != ENTRY && b != ENTRY) {
+		while (a != ENTRY && b != ENTRY && blocks[a].rpo > blocks[b].rpo) a = up(a);
+		while (a != ENTRY && b != ENTRY && blocks[b].rpo > blocks[a].rpo) b = up(b);
+	}
+	return a == b ? a : ENTRY;
+}
+
+static void find_dominators(void) {
+	// successor lists, for the depth-first search
+	int* nsuccs = calloc(nblocks + 1, sizeof(int));
+	for (int i = 0; i < nlinks; i++) nsuccs[links[i].from + 1]++;
+	for (int b = 0; b < nblocks; b++) nsuccs[b + 1] += nsuccs[b];
+	int* succs = malloc((nlinks + 1) * sizeof(int));
+	int* fill = calloc(nblocks, sizeof(int));
+	for (int i = 0; i < nlinks; i++) succs[nsuccs[links[i].from] + fill[links[i].from]++] = links[i].to;
+
+	// each subroutine is its own graph; roots get themselves as idom
+	order = malloc(nblocks * sizeof(int));
+	int* stack = malloc(nblocks * sizeof(int));
+	int* next = calloc(nblocks, sizeof(int));
+	int postorder = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int root = 0; root < nblocks; root++) {
+			// entry points first; then anything only reachable through a cycle
+			if (blocks[root].visited) continue;
+			if (pass == 0 && !called[blocks[root].start] && blocks[root].npreds) continue;
+			blocks[root].visited = 1;
+			blocks[root].idom = root;
+			int depth = 0;
+			stack[depth++] = root;
+			while (depth) {
+				int b = stack[depth - 1];
+				if (nsuccs[b] + next[b] < nsuccs[b + 1]) {
+					int s = succs[nsuccs[b] + next[b]++];
+					if (!blocks[s].visited) {
+						blocks[s].visited = 1;
+						blocks[s].idom = UNDONE;
+						stack[depth++] = s;
+					}
+				} else {
+					blocks[b].rpo = postorder++;
+					depth--;
+				}
+			}
+		}
+	}
+	for (int b = 0; b < nblocks; b++) {
+		blocks[b].rpo = nblocks - 1 - blocks[b].rpo;
+		order[blocks[b].rpo] = b;
+	}
+
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int i = 0; i < nblocks; i++) {
+			int b = order[i];
+			if (blocks[b].idom == b) continue; // a root
+			int idom = UNDONE;
+			for (int p = 0; p < blocks[b].npreds; p++) {
+				int pred = preds[blocks[b].first_pred + p];
+				if (blocks[pred].idom == UNDONE) continue;
+				idom = idom == UNDONE ? pred : intersect(pred, idom);
+			}
+			if (idom != UNDONE && blocks[b].idom != idom) {
+				blocks[b].idom = idom;
+				changed = 1;
+			}
+		}
+	}
+
+	free(nsuccs);
+	free(succs);
+	free(fill);
+	free(stack);
+	free(next);
+}
+
+static int dominates(int a, int b) {
+	while (1) {
+		if (a == b) return 1;
+		if (blocks[b].idom == b || blocks[b].idom < 0) return 0;
+		b = blocks[b].idom;
+	}
+}
+
+struct loop {
+	int header;
+	uint8_t* body; // per block
+	int nblocks, size, depth;
+	uint64_t executed, iterations, entries;
+};
+
+static uint64_t block_executed(int b) {
+	return prof_exec[blocks[b].start] * (blocks[b].end - blocks[b].start + 1);
+}
+
+static void list_instructions(FILE* out, uint16_t start, uint16_t end, int* budget) {
+	for (int a = start; a <= end && *budget > 0; a++, (*budget)--) {
+		char text[32], name[80];
+		disassemble(a, memory[a], text, sizeof(text));
+		sym_format(a, name, sizeof(name));
+		fprintf(out, "      x%04X %-16s %-22s %12llu\n", a, name, text, (unsigned long long) prof_exec[a]);
+	}
+}
+
+static int by_executed(const void* a, const void* b) {
+	uint64_t x = ((const struct loop*) a)->executed, y = ((const struct loop*) b)->executed;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void report_blocks(FILE* out, uint64_t total) {
+	int top[PROF_TOP_BLOCKS];
+	int n = 0;
+	for (int b = 0; b < nblocks; b++) {
+		int j;
+		if (n < PROF_TOP_BLOCKS) j = n++;
+		else if (block_executed(b) > block_executed(top[n - 1])) j = n - 1;
+		else continue;
+		while (j > 0 && block_executed(top[j - 1]) < block_executed(b)) {
+			top[j] = top[j - 1];
+			j--;
+		}
+		top[j] = b;
+	}
+
+	fprintf(out, "\n  %-22s %12s %4s %12s %7s\n", "hottest blocks", "runs", "size", "instructions", "share");
+	for (int i = 0; i < n; i++) {
+		struct block* b = &blocks[top[i]];
+		char name[80];
+		sym_format(b->start, name, sizeof(name));
+		fprintf(out, "  x%04X %-16s %12llu %4d %12llu %6.2f%%\n", b->start, name,
+			(unsigned long long) prof_exec[b->start], b->end - b->start + 1,
+			(unsigned long long) block_executed(top[i]), block_executed(top[i]) * 100.0 / total);
+		int budget = PROF_LISTING;
+		list_instructions(out, b->start, b->end, &budget);
+	}
+}
+
+static void report_loops(FILE* out, uint64_t total) {
+	struct loop* loops = calloc(nblocks, sizeof(*loops));
+	int nloops = 0;
+	int* loop_of = malloc(nblocks * sizeof(int)); // header block to loop
+	for (int b = 0; b < nblocks; b++) loop_of[b] = -1;
+	int* work = malloc((nblocks + 1) * sizeof(int));
+
+	for (int i = 0; i < nlinks; i++) {
+		struct link* l = &links[i];
+		if (!dominates(l->to, l->from)) continue; // not a back-edge
+
+		int h = l->to;
+		if (loop_of[h] < 0) {
+			loop_of[h] = nloops;
+			loops[nloops].header = h;
+			loops[nloops].body = calloc(nblocks, 1);
+			loops[nloops].body[h] = 1;
+			nloops++;
+		}
+		struct loop* loop = &loops[loop_of[h]];
+		loop->iterations += l->count;
+
+		// the natural loop: everything that reaches the back-edge without going through the header
+		int depth = 0;
+		if (!loop->body[l->from]) {
+			loop->body[l->from] = 1;
+			work[depth++] = l->from;
+		}
+		while (depth) {
+			int b = work[--depth];
+			for (int p = 0; p < blocks[b].npreds; p++) {
+				int pred = preds[blocks[b].first_pred + p];
+				if (!loop->body[pred]) {
+					loop->body[pred] = 1;
+					work[depth++] = pred;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < nloops; i++) {
+		struct loop* loop = &loops[i];
+		for (int b = 0; b < nblocks; b++) {
+			if (!loop->body[b]) continue;
+			loop->nblocks++;
+			loop->size += blocks[b].end - blocks[b].start + 1;
+			loop->executed += block_executed(b);
+		}
+		for (int j = 0; j < nlinks; j++) {
+			if (links[j].to == loop->header && !loop->body[links[j].from]) loop->entries += links[j].count;
+		}
+		for (int j = 0; j < nloops; j++) {
+			if (j != i && loops[j].body[loop->header]) loop->depth++;
+		}
+	}
+	qsort(loops, nloops, sizeof(*loops), by_executed);
+
+	fprintf(out, "\n  %d loops\n", nloops);
+	for (int i = 0; i < nloops && i < PROF_TOP_LOOPS; i++) {
+		struct loop* loop = &loops[i];
+		uint16_t start = blocks[loop->header].start;
+		char name[80];
+		sym_format(start, name, sizeof(name));
+		fprintf(out, "  x%04X %-16s depth %d, %d blocks, %d instructions, %llu executed (%.2f%%)\n",
+			start, name, loop->depth, loop->nblocks, loop->size,
+			(unsigned long long) loop->executed, loop->executed * 100.0 / total);
+		fprintf(out, "      entered %llu times, %llu back-edges taken, %.1f trips per entry\n",
+			(unsigned long long) loop->entries, (unsigned long long) loop->iterations,
+			loop->entries ? (double) (loop->entries + loop->iterations) / loop->entries : 0.0);
+
+		struct trips* t = trips[start];
+		if (t) {
+			// the run that's going on now counts too
+			uint64_t histogram[PROF_BUCKETS];
+			memcpy(histogram, t->histogram, sizeof(histogram));
+			if (t->run) histogram[bucket(t->run)]++;
+			fprintf(out, "      trips:");
+			for (int j = 0; j < PROF_BUCKETS; j++) {
+				if (!histogram[j]) continue;
+				if (j == 0) fprintf(out, " 1:%llu", (unsigned long long) histogram[j]);
+				else if (j == PROF_BUCKETS - 1) fprintf(out, " %d+:%llu", 1 << j, (unsigned long long) histogram[j]);
+				else fprintf(out, " %d-%d:%llu", 1 << j, (2 << j) - 1, (unsigned long long) histogram[j]);
+			}
+			fprintf(out, "\n");
+		}
+
+		int budget = PROF_LISTING;
+		for (int b = 0; b < nblocks; b++) {
+			if (loop->body[b]) list_instructions(out, blocks[b].start, blocks[b].end, &budget);
+		}
+		if (budget == 0 && loop->size > PROF_LISTING) fprintf(out, "      ...\n");
+	}
+
+	for (int i = 0; i < nloops; i++) free(loops[i].body);
+	free(loops);
+	free(loop_of);
+	free(work);
+}
+
+void prof_report(FILE* out) {
+	uint64_t total = 0;
+	for (int a = 0; a < MEMORY_MAX; a++) total += prof_exec[a];
+	if (!total) {
+		fprintf(out, "profile: nothing has run yet\n");
+		return;
+	}
+
+	build_blocks();
+	build_links();
+	find_dominators();
+	fprintf(out, "profile: %llu instructions in %d blocks\n", (unsigned long long) total, nblocks);
+	report_blocks(out, total);
+	report_loops(out, total);
+
+	free(blocks);
+	free(owner);
+	free(preds);
+	free(links);
+	free(order);
+}
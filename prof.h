@@ -0,0 +1,42 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Basic-block and loop profiler. While the guest runs we count executions per
+//	instruction and note every control transfer along with where it went; any
+//	address control lands on starts a block. At report time the blocks and
+//	transfers become a control-flow graph per subroutine (calls are stepped over,
+//	like a compiler would see them), back-edges whose target dominates their
+//	source give the natural loops, and each loop gets its body, entry and
+//	iteration counts. Trip counts are tracked as the guest runs: a backward
+//	branch to an address is one more trip, and any other arrival there ends the
+//	previous run.
+
+#define PROF_BUCKETS 17 // trip counts 1, 2-3, 4-7, ... 65536 and up
+
+extern int prof_enabled;
+extern uint64_t prof_exec[MEMORY_MAX];
+extern uint8_t prof_header[MEMORY_MAX]; // targets of backward branches
+extern uint16_t prof_last; // the previous instruction
+
+void prof_transfer(uint16_t from, uint16_t to);
+
+// called before each instruction; `entry` says whether the previous one was a
+//	branch, jump, call or trap, so control may not have just fallen through
+static inline void prof_step(uint16_t pc, int entry) {
+	prof_exec[pc]++;
+	// falling into a loop header still ends its last run
+	if (entry || prof_header[pc]) prof_transfer(prof_last, pc);
+	prof_last = pc;
+}
+
+void prof_start(uint16_t entry);
+
+// hot blocks, then loops, with disassembly
+void prof_report(FILE* out);
+
+#endif
@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+// unix only
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "record.h"
+#include "trace.h"
+#include "io.h"
+
+#define RECORD_VERSION 1
+#define RECORD_INTERRUPTED 0xFFFE
+
+int record_enabled;
+int recording, replaying;
+uint64_t record_count;
+uint64_t record_next;
+uint8_t record_dirty[MEMORY_MAX / RECORD_PAGE];
+
+static FILE* file;
+static uint64_t interval;
+static uint32_t empty_polls; // not written out yet
+
+static void put8(uint8_t v) {
+	fputc(v, file);
+}
+
+static void put16(uint16_t v) {
+	fputc(v & 0xFF, file);
+	fputc(v >> 8, file);
+}
+
+static void put32(uint32_t v) {
+	put16(v & 0xFFFF);
+	put16(v >> 16);
+}
+
+static void put64(uint64_t v) {
+	put32(v & 0xFFFFFFFF);
+	put32(v >> 32);
+}
+
+static int get16(FILE* in, uint16_t* v) {
+	int lo = fgetc(in), hi = fgetc(in);
+	if (hi == EOF) return 0;
+	*v = lo | hi << 8;
+	return 1;
+}
+
+static int get32(FILE* in, uint32_t* v) {
+	uint16_t lo, hi;
+	if (!get16(in, &lo) || !get16(in, &hi)) return 0;
+	*v = lo | (uint32_t) hi << 16;
+	return 1;
+}
+
+static int get64(FILE* in, uint64_t* v) {
+	uint32_t lo, hi;
+	if (!get32(in, &lo) || !get32(in, &hi)) return 0;
+	*v = lo | (uint64_t) hi << 32;
+	return 1;
+}
+
+static void flush_polls(void) {
+	if (!empty_polls) return;
+	put8('P');
+	put32(empty_polls);
+	empty_polls = 0;
+}
+
+static void checkpoint(void) {
+	flush_polls();
+	int npages = 0;
+	for (int page = 0; page < MEMORY_MAX / RECORD_PAGE; page++) npages += record_dirty[page];
+
+	put8('C');
+	put64(record_count);
+	for (int i = 0; i < R_COUNT; i++) put16(reg[i]);
+	put16(npages);
+	for (int page = 0; page < MEMORY_MAX / RECORD_PAGE; page++) {
+		if (!record_dirty[page]) continue;
+		put8(page);
+		for (int i = page * RECORD_PAGE; i < (page + 1) * RECORD_PAGE; i++) put16(memory[i]);
+		record_dirty[page] = 0;
+	}
+}
+
+int record_open(const char* path, uint64_t every) {
+	file = fopen(path, "wb");
+	if (!file) return 0;
+	setvbuf(file, NULL, _IOFBF, 1 << 20);
+	fwrite("LC3R", 1, 4, file);
+	put16(RECORD_VERSION);
+	put16(R_COUNT);
+
+	// the first checkpoint has all of memory
+	memset(record_dirty, 1, sizeof(record_dirty));
+	interval = every;
+	record_count = 0;
+	checkpoint();
+	record_next = interval;
+	recording = record_enabled = 1;
+	return 1;
+}
+
+void record_close(void) {
+	if (!recording) return;
+	flush_polls();
+	put8('E');
+	put64(record_count);
+	fclose(file);
+	recording = record_enabled = 0;
+}
+
+void record_key(int key) {
+	flush_polls();
+	put8('K');
+	put16(key == GUEST_STOPPED ? RECORD_INTERRUPTED : (uint16_t) key);
+}
+
+void record_poll(int found, uint16_t key) {
+	if (!found) {
+		if (++empty_polls == UINT32_MAX) flush_polls();
+		return;
+	}
+	flush_polls();
+	put8('Q');
+	put16(key);
+}
+
+// replaying
+
+static uint64_t trace_from, trace_to;
+static const char* trace_path;
+static uint32_t pending_polls; // empty polls left over from the last 'P'
+
+// the run has gone somewhere the recording didn't, so the rest of this stretch's
+//	trace would be wrong; fail, and regen reports it
+static void lost_sync(const char* why) {
+	fprintf(stderr, "regen: input log out of step at instruction %llu (%s)\n",
+		(unsigned long long) record_count, why);
+	exit(1);
+}
+
+// the next input record, or 0 if this stretch has none left
+static int next_input(uint16_t* value, uint32_t* count) {
+	int tag = fgetc(file);
+	switch (tag) {
+	case 'K':
+	case 'Q':
+		return get16(file, value) ? tag : 0;
+	case 'P':
+		return get32(file, count) ? tag : 0;
+	default:
+		if (tag != EOF) ungetc(tag, file);
+		return 0;
+	}
+}
+
+int replay_key(void) {
+	uint16_t value;
+	uint32_t count;
+	if (pending_polls) lost_sync("expected a KBSR poll");
+	int tag = next_input(&value, &count);
+	if (tag != 'K') {
+		lost_sync("expected a key");
+		return EOF;
+	}
+	if (value == RECORD_INTERRUPTED) return GUEST_STOPPED;
+	return value == 0xFFFF ? EOF : value;
+}
+
+int replay_poll(uint16_t* key) {
+	if (pending_polls) {
+		pending_polls--;
+		return 0;
+	}
+	uint16_t value;
+	uint32_t count;
+	int tag = next_input(&value, &count);
+	if (tag == 'P' && count) {
+		pending_polls = count - 1;
+		return 0;
+	} else if (tag == 'Q') {
+		*key = value;
+		return 1;
+	}
+	lost_sync("expected a KBSR poll");
+	return 0;
+}
+
+static void replay_boundary(void) {
+	if (!trace_enabled && record_count >= trace_from) {
+		if (!trace_open(trace_path)) {
+			fprintf(stderr, "regen: can't write %s\n", trace_path);
+			exit(1);
+		}
+		trace_set_seq(record_count);
+		record_next = trace_to;
+	}
+	if (record_count >= trace_to) {
+		next_state = S_OFF;
+		record_next = UINT64_MAX;
+	}
+}
+
+void record_boundary(void) {
+	if (replaying) {
+		replay_boundary();
+	} else {
+		checkpoint();
+		record_next = record_count + interval;
+	}
+}
+
+// read a checkpoint's registers and pages into the machine
+static int load_checkpoint(FILE* in, uint64_t* count, int apply) {
+	uint16_t npages;
+	uint16_t registers[R_COUNT];
+	if (!get64(in, count)) return 0;
+	for (int i = 0; i < R_COUNT; i++) {
+		if (!get16(in, &registers[i])) return 0;
+	}
+	if (!get16(in, &npages)) return 0;
+	for (int i = 0; i < npages; i++) {
+		int page = fgetc(in);
+		if (page == EOF) return 0;
+		if (!apply) {
+			if (fseek(in, RECORD_PAGE * 2, SEEK_CUR) != 0) return 0;
+			continue;
+		}
+		for (int a = page * RECORD_PAGE; a < (page + 1) * RECORD_PAGE; a++) {
+			if (!get16(in, &memory[a])) return 0;
+		}
+	}
+	if (apply) memcpy(reg, registers, sizeof(registers));
+	return 1;
+}
+
+static int read_header(FILE* in) {
+	char magic[4];
+	uint16_t version, count;
+	return fread(magic, 1, 4, in) == 4 && !memcmp(magic, "LC3R", 4)
+		&& get16(in, &version) && version == RECORD_VERSION && get16(in, &count) && count == R_COUNT;
+}
+
+// skip over a record we don't care about; returns its tag, or 0 at the end
+static int skip_record(FILE* in, uint64_t* count) {
+	int tag = fgetc(in);
+	uint16_t v16;
+	uint32_t v32;
+	switch (tag) {
+	case 'C':
+		return load_checkpoint(in, count, 0) ? tag : 0;
+	case 'K':
+	case 'Q':
+		return get16(in, &v16) ? tag : 0;
+	case 'P':
+		return get32(in, &v32) ? tag : 0;
+	case 'E':
+		return get64(in, count) ? tag : 0;
+	default:
+		return 0;
+	}
+}
+
+int replay_open(const char* path, int segment, uint64_t from, uint64_t to, const char* out_path) {
+	file = fopen(path, "rb");
+	if (!file || !read_header(file)) return 0;
+
+	// every checkpoint up to ours, since each only has the pages that changed
+	int seen = 0;
+	while (seen <= segment) {
+		int tag = fgetc(file);
+		uint64_t count;
+		if (tag == 'C') {
+			if (!load_checkpoint(file, &count, 1)) return 0;
+			record_count = count;
+			seen++;
+		} else {
+			if (tag == EOF || tag == 'E') return 0;
+			ungetc(tag, file);
+			if (!skip_record(file, &count)) return 0;
+		}
+	}
+
+	trace_from = from;
+	trace_to = to;
+	trace_path = out_path;
+	replaying = record_enabled = 1;
+	record_next = from;
+	if (record_count >= from) replay_boundary();
+	return 1;
+}
+
+// regen: one process per stretch between checkpoints, each rerunning it with
+//	the recorded input and writing its part of the trace, then glued together
+
+static int append_part(FILE* out, const char* part, int keep_header) {
+	FILE* in = fopen(part, "rb");
+	if (!in) return 0;
+	if (!keep_header && fseek(in, TRACE_HEADER_BYTES, SEEK_SET) != 0) {
+		fclose(in);
+		return 0;
+	}
+	static char buffer[1 << 16];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) fwrite(buffer, 1, n, out);
+	fclose(in);
+	return 1;
+}
+
+static void regen_usage(void) {
+	printf("Usage: lc3vm regen [options] RECORDING TRACE\n");
+	printf("  --jobs N\t\tRerun this many stretches at once (default: one per CPU).\n");
+	printf("  --from N\t\tStart the trace at instruction N instead of the beginning.\n");
+	printf("  --to N\t\tEnd the trace before instruction N instead of at the end.\n");
+}
+
+int regen_main(int argc, char** argv, const char* self) {
+	static const struct option options[] = {
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "from", required_argument, NULL, 'f' },
+		{ "to", required_argument, NULL, 't' },
+		{ NULL, 0, NULL, 0 }
+	};
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t from = 0, to = UINT64_MAX;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "j:", options, NULL)) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'f':
+			from = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			to = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			regen_usage();
+			return 2;
+		}
+	}
+	if (argc - optind != 2 || jobs < 1 || from >= to) {
+		regen_usage();
+		return 2;
+	}
+	const char* recording_path = argv[optind];
+	const char* trace_out = argv[optind + 1];
+
+	// where the checkpoints are
+	FILE* in = fopen(recording_path, "rb");
+	if (!in || !read_header(in)) {
+		fprintf(stderr, "regen: %s isn't a recording\n", recording_path);
+		return 2;
+	}
+	uint64_t* starts = NULL;
+	int nsegments = 0, capacity = 0;
+	uint64_t end = 0;
+	int tag;
+	uint64_t count;
+	while ((tag = skip_record(in, &count)) != 0) {
+		if (tag == 'C') {
+			if (nsegments == capacity) {
+				capacity = capacity ? capacity * 2 : 64;
+				starts = realloc(starts, capacity * sizeof(*starts));
+			}
+			starts[nsegments++] = count;
+		} else if (tag == 'E') {
+			end = count;
+			break;
+		}
+	}
+	fclose(in);
+	if (tag != 'E') {
+		// the recorder never finished; we can still rerun up to the last checkpoint
+		fprintf(stderr, "regen: %s has no end record; stopping at the last checkpoint\n", recording_path);
+		if (!nsegments) return 1;
+		end = starts[--nsegments];
+	}
+	if (to > end) to = end;
+
+	// run the stretches that overlap [from, to)
+	uint64_t began = now_ns();
+	char (*parts)[4096] = calloc(nsegments, sizeof(*parts));
+	int* wanted = calloc(nsegments, sizeof(int));
+	int running = 0, failed = 0, total = 0;
+	for (int k = 0; k < nsegments && !failed; k++) {
+		uint64_t seg_start = starts[k], seg_end = k + 1 < nsegments ? starts[k + 1] : end;
+		uint64_t a = seg_start > from ? seg_start : from, b = seg_end < to ? seg_end : to;
+		if (a >= b) continue;
+		wanted[k] = 1;
+		total++;
+		snprintf(parts[k], sizeof(parts[k]), "%s.part%d", trace_out, k);
+
+		while (running >= jobs) {
+			int status;
+			if (wait(&status) < 0) break;
+			running--;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+		}
+
+		char segment[128];
+		snprintf(segment, sizeof(segment), "%d,%llu,%llu", k, (unsigned long long) a, (unsigned long long) b);
+		pid_t pid = fork();
+		if (pid == 0) {
+			int null = open("/dev/null", O_RDWR);
+			dup2(null, STDIN_FILENO);
+			dup2(null, STDOUT_FILENO);
+			execl(self, "lc3vm", "--replay", recording_path, "--segment", segment, "--replay-trace", parts[k], (char*) NULL);
+			_exit(127);
+		} else if (pid < 0) {
+			failed = 1;
+		} else {
+			running++;
+		}
+	}
+	while (running > 0) {
+		int status;
+		if (wait(&status) < 0) break;
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+	}
+
+	// glue the parts together; only the first one's starting state is needed
+	int first = 1;
+	FILE* out = failed ? NULL : fopen(trace_out, "wb");
+	if (out) {
+		for (int k = 0; k < nsegments; k++) {
+			if (!wanted[k]) continue;
+			if (!append_part(out, parts[k], first)) failed = 1;
+			first = 0;
+		}
+		fclose(out);
+	} else {
+		failed = 1;
+	}
+	for (int k = 0; k < nsegments; k++) {
+		if (wanted[k]) unlink(parts[k]);
+	}
+
+	if (failed) {
+		fprintf(stderr, "regen: couldn't rebuild the trace\n");
+		return 1;
+	}
+	printf("regen: instructions %llu to %llu from %d stretch%s on %ld job%s in %.2fs\n",
+		(unsigned long long) (from < end ? from : end), (unsigned long long) to, total, total == 1 ? "" : "es",
+		jobs, jobs == 1 ? "" : "s", (now_ns() - began) / 1e9);
+	return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Lightweight recording: instead of a full trace, --record keeps a checkpoint of
+//	the machine every so many instructions (the registers plus whichever 256-word
+//	pages were written since the last one) and a log of everything the guest
+//	read from the outside world: keys from GETC/IN and the result of every KBSR
+//	poll, with runs of empty polls folded together. That's enough to rerun any
+//	stretch between two checkpoints exactly, which is what `lc3vm regen` does,
+//	one process per stretch, to rebuild the full trace afterwards.
+//
+// The file is "LC3R", u16 version and u16 R_COUNT, then tagged records:
+//	'C' u64 instructions, R_COUNT u16 registers, u16 npages, then npages * (u8 page, 256 u16 words)
+//	'K' u16 key			a GETC/IN read (0xFFFF at end of input, 0xFFFE if ^C interrupted it)
+//	'P' u32 count			that many KBSR polls found no key
+//	'Q' u16 key			a KBSR poll found this key
+//	'E' u64 instructions		the end of the recording
+// all little-endian. Inputs belong to the stretch after the checkpoint before them.
+
+#define RECORD_PAGE 256
+
+extern int record_enabled; // recording or replaying; either way we count instructions
+extern int recording, replaying;
+extern uint64_t record_count; // instructions executed
+extern uint64_t record_next; // when record_boundary() wants to hear from us next
+extern uint8_t record_dirty[MEMORY_MAX / RECORD_PAGE];
+
+void record_boundary(void);
+
+static inline void record_account(int n) {
+	record_count += n;
+	if (record_count >= record_next) record_boundary();
+}
+
+static inline void record_store(uint16_t address) {
+	record_dirty[address / RECORD_PAGE] = 1;
+}
+
+// recording
+int record_open(const char* path, uint64_t interval);
+void record_close(void);
+void record_key(int key);
+void record_poll(int found, uint16_t key);
+
+// replaying the stretch after checkpoint `segment`, writing a trace of the
+//	instructions in [from, to) to trace_path; loads the machine state
+int replay_open(const char* path, int segment, uint64_t from, uint64_t to, const char* trace_path);
+int replay_key(void);
+int replay_poll(uint16_t* key); // 1 if the poll found a key
+
+// lc3vm regen [options] RECORDING TRACE
+int regen_main(int argc, char** argv, const char* self);
+
+#endif
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+
+#include "lc3.h"
+#include "trace.h"
+#include "events.h"
+#include "disasm.h"
+#include "sym.h"
+
+// Backward dynamic slicing: which earlier instructions fed the value a register
+//	or memory word holds at some point in a trace. We walk the trace backwards
+//	keeping the set of registers and words that are still live (wanted, but not
+//	yet explained); an instruction that writes one of them is in the slice, and
+//	swaps what it wrote for what it read, address operands included (the base of
+//	LDR/STR, the pointer of LDI/STI). BR reads the flags, so slicing COND at a
+//	branch explains which way it went.
+//
+//	Records are variable length, so a first pass reads the trace forwards and
+//	indexes it in chunks, noting the registers and memory pages each chunk
+//	writes. The backward walk only decodes the chunks that write something
+//	still live and steps over the rest.
+
+#define CHUNK 4096 // records per index entry
+#define PAGE_BITS 8 // words per page in the index: 256
+#define PAGES (MEMORY_MAX >> PAGE_BITS)
+
+struct chunk {
+	long offset;
+	uint64_t first; // record number
+	int count;
+	uint16_t regs; // registers any record in it writes
+	uint64_t pages[PAGES / 64]; // pages it writes
+};
+
+static struct chunk* chunks;
+static int nchunks, chunk_capacity;
+
+static uint16_t live_regs;
+static uint64_t live_words[MEMORY_MAX / 64];
+static uint32_t live_in_page[PAGES];
+static uint64_t live_pages[PAGES / 64];
+static uint32_t nlive_words;
+
+static uint64_t instances[MEMORY_MAX]; // slice members per address
+static uint16_t instructions[MEMORY_MAX];
+
+static const char* reg_names[R_COUNT] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND" };
+
+static int is_live(uint16_t address) {
+	return live_words[address / 64] >> (address % 64) & 1;
+}
+
+static void set_live(uint16_t address, int live) {
+	if (is_live(address) == live) return;
+	live_words[address / 64] ^= 1ULL << (address % 64);
+	int page = address >> PAGE_BITS;
+	if (live) {
+		nlive_words++;
+		if (!live_in_page[page]++) live_pages[page / 64] |= 1ULL << (page % 64);
+	} else {
+		nlive_words--;
+		if (!--live_in_page[page]) live_pages[page / 64] &= ~(1ULL << (page % 64));
+	}
+}
+
+// the registers an instruction writes, as a mask
+static uint16_t reg_defs(const struct step_event* ev) {
+	uint16_t regs = 0;
+	if (ev->fields & EV_DR) regs |= 1 << ev->dr;
+	if (ev->fields & EV_COND) regs |= 1 << R_COND;
+	if (ev->op == OP_JSR || ev->op == OP_TRAP) regs |= 1 << R_R7;
+	for (int i = 0; i < ev->nreg; i++) regs |= 1 << ev->regs[i].reg; // what traps did to R0
+	return regs & ~(1 << R_PC);
+}
+
+// the memory it writes is its store's address, if it's a store, and every
+//	change in ev->mem (which also covers MMIO and bulk READs)
+static int is_store(const struct step_event* ev) {
+	return ev->op == OP_ST || ev->op == OP_STI || ev->op == OP_STR;
+}
+
+static void add_uses(const struct step_event* ev) {
+	switch (ev->op) {
+	case OP_ADD:
+	case OP_AND:
+		live_regs |= 1 << ev->sr;
+		if (ev->fields & EV_SR2) live_regs |= 1 << ev->sr2;
+		break;
+	case OP_NOT:
+		live_regs |= 1 << ev->sr;
+		break;
+	case OP_BR:
+		live_regs |= 1 << R_COND;
+		break;
+	case OP_LD:
+		set_live(ev->address, 1);
+		break;
+	case OP_LDI:
+		set_live(ev->pointer, 1);
+		set_live(ev->address, 1);
+		break;
+	case OP_LDR:
+		live_regs |= 1 << ev->base;
+		set_live(ev->address, 1);
+		break;
+	case OP_ST:
+		live_regs |= 1 << ev->sr;
+		break;
+	case OP_STI:
+		live_regs |= 1 << ev->sr;
+		set_live(ev->pointer, 1);
+		break;
+	case OP_STR:
+		live_regs |= 1 << ev->sr | 1 << ev->base;
+		break;
+	case OP_TRAP:
+		// the count WRITE returns depends on what it was asked for; input is where slices end
+		if (ev->trap == TRAP_WRITE) live_regs |= 1 << R_R1 | 1 << R_R2;
+		break;
+	}
+}
+
+// 1 if the record is in the slice
+static int visit(const struct step_event* ev) {
+	uint16_t regs = reg_defs(ev);
+	int relevant = (regs & live_regs) || (is_store(ev) && is_live(ev->address));
+	for (uint32_t i = 0; i < ev->nmem && !relevant; i++) relevant = is_live(ev->mem[i].address);
+	if (!relevant) return 0;
+	live_regs &= ~regs;
+	if (is_store(ev)) set_live(ev->address, 0);
+	for (uint32_t i = 0; i < ev->nmem; i++) set_live(ev->mem[i].address, 0);
+	add_uses(ev);
+	return 1;
+}
+
+static int chunk_matters(const struct chunk* c) {
+	if (c->regs & live_regs) return 1;
+	for (int i = 0; i < PAGES / 64; i++) {
+		if (c->pages[i] & live_pages[i]) return 1;
+	}
+	return 0;
+}
+
+static struct chunk* new_chunk(long offset, uint64_t first) {
+	if (nchunks == chunk_capacity) {
+		chunk_capacity = chunk_capacity ? 2 * chunk_capacity : 256;
+		chunks = realloc(chunks, chunk_capacity * sizeof(*chunks));
+	}
+	struct chunk* c = &chunks[nchunks++];
+	memset(c, 0, sizeof(*c));
+	c->offset = offset;
+	c->first = first;
+	return c;
+}
+
+// the forward pass; returns the number of records, or -1 if the trace is damaged
+static int64_t build_index(FILE* in) {
+	struct step_event ev = { 0 };
+	struct chunk* c = NULL;
+	uint64_t total = 0;
+	while (1) {
+		long offset = ftell(in);
+		int result = event_read_binary(&ev, in);
+		if (result < 0) return -1;
+		if (!result) break;
+		if (!c || c->count == CHUNK) c = new_chunk(offset, total);
+		c->regs |= reg_defs(&ev);
+		if (is_store(&ev)) c->pages[(ev.address >> PAGE_BITS) / 64] |= 1ULL << ((ev.address >> PAGE_BITS) % 64);
+		for (uint32_t i = 0; i < ev.nmem; i++) {
+			int page = ev.mem[i].address >> PAGE_BITS;
+			c->pages[page / 64] |= 1ULL << (page % 64);
+		}
+		c->count++;
+		total++;
+	}
+	return total;
+}
+
+static void print_event(FILE* out, const struct step_event* ev) {
+	char text[32], name[80];
+	disassemble(ev->pc, ev->instr, text, sizeof(text));
+	sym_format(ev->pc, name, sizeof(name));
+	fprintf(out, "  #%-10llu x%04X %-16s %-20s", (unsigned long long) ev->seq, ev->pc, name, text);
+	for (int i = 0; i < ev->nreg; i++) {
+		if (ev->regs[i].reg != R_PC) fprintf(out, " %s=x%04X", reg_names[ev->regs[i].reg], ev->regs[i].to);
+	}
+	for (uint32_t i = 0; i < ev->nmem; i++) fprintf(out, " [x%04X]=x%04X", ev->mem[i].address, ev->mem[i].to);
+	fprintf(out, "\n");
+}
+
+// R0-R7 or COND, else a symbol or a hex address (x3000, 0x3000 or 3000)
+static int parse_target(const char* text, uint16_t* address) {
+	for (int i = 0; i < R_COUNT; i++) {
+		if (i != R_PC && !strcasecmp(text, reg_names[i])) return i;
+	}
+	if (sym_find(text, address)) return R_COUNT;
+	const char* digits = text;
+	if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) digits += 2;
+	else if (digits[0] == 'x' || digits[0] == 'X') digits++;
+	char* end;
+	unsigned long value = strtoul(digits, &end, 16);
+	if (!*digits || *end || value >= MEMORY_MAX) return -1;
+	*address = value;
+	return R_COUNT;
+}
+
+static void usage(void) {
+	printf("Usage: lc3vm slice [options] TRACE REG|ADDR [at N]\n");
+	printf("  Find the instructions whose results flowed into REG (R0-R7 or COND) or the memory\n");
+	printf("  word at ADDR just before record N of TRACE runs (default: at the end of it).\n");
+	printf("  --max N\t\tList at most the last N instructions in the slice (default 200).\n");
+	printf("  --sym FILE\t\tName addresses with an assembler symbol table, and allow them as ADDR.\n");
+}
+
+int slice_main(int argc, char** argv) {
+	static const struct option options[] = {
+		{ "max", required_argument, NULL, 'x' },
+		{ "sym", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int max = 200;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'x':
+			max = atoi(optarg);
+			break;
+		case 's':
+			if (!sym_load(optarg)) fprintf(stderr, "slice: can't read symbols from %s\n", optarg);
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+	int args = argc - optind;
+	if ((args != 2 && args != 4) || (args == 4 && strcmp(argv[optind + 2], "at")) || max < 0) {
+		usage();
+		return 2;
+	}
+	const char* path = argv[optind];
+	uint16_t address = 0;
+	int target = parse_target(argv[optind + 1], &address);
+	if (target < 0) {
+		fprintf(stderr, "slice: %s isn't a register, symbol or address\n", argv[optind + 1]);
+		return 2;
+	}
+
+	FILE* in = fopen(path, "rb");
+	if (!in) {
+		fprintf(stderr, "slice: can't open %s\n", path);
+		return 2;
+	}
+	uint16_t initial_reg[R_COUNT];
+	uint16_t* initial_memory = malloc(MEMORY_MAX * sizeof(uint16_t));
+	if (!trace_read_header(in, initial_reg, initial_memory)) {
+		fprintf(stderr, "slice: %s isn't a trace or binary event stream\n", path);
+		return 2;
+	}
+	int64_t total = build_index(in);
+	if (total < 0) {
+		fprintf(stderr, "slice: %s is truncated or corrupt\n", path);
+		return 2;
+	}
+	uint64_t at = args == 4 ? strtoull(argv[optind + 3], NULL, 10) : (uint64_t) total;
+	if (at > (uint64_t) total) {
+		fprintf(stderr, "slice: %s only has %lld records\n", path, (long long) total);
+		return 2;
+	}
+
+	if (target == R_COUNT) set_live(address, 1);
+	else live_regs = 1 << target;
+
+	// the newest `max` members, kept as they're found (newest first)
+	struct step_event* listed = calloc(max ? max : 1, sizeof(*listed));
+	int nlisted = 0;
+	struct step_event* records = calloc(CHUNK, sizeof(*records));
+	uint64_t members = 0;
+	int skipped = 0, read = 0, considered = 0;
+	for (int c = nchunks - 1; c >= 0 && (live_regs || nlive_words); c--) {
+		struct chunk* chunk = &chunks[c];
+		if (chunk->first >= at) continue;
+		considered++;
+		if (!chunk_matters(chunk)) {
+			skipped++;
+			continue;
+		}
+		read++;
+		fseek(in, chunk->offset, SEEK_SET);
+		int count = chunk->count;
+		if (chunk->first + count > at) count = at - chunk->first;
+		for (int i = 0; i < count; i++) {
+			if (event_read_binary(&records[i], in) <= 0) {
+				fprintf(stderr, "slice: %s changed while we were reading it\n", path);
+				return 2;
+			}
+			records[i].seq = chunk->first + i; // plain event streams may not number from 0
+		}
+		for (int i = count - 1; i >= 0 && (live_regs || nlive_words); i--) {
+			if (!visit(&records[i])) continue;
+			members++;
+			instances[records[i].pc]++;
+			instructions[records[i].pc] = records[i].instr;
+			if (nlisted < max) event_copy(&listed[nlisted++], &records[i]);
+		}
+	}
+
+	printf("slice of %s before record %llu:\n", argv[optind + 1], (unsigned long long) at);
+	if (members > (uint64_t) nlisted) printf("  (%llu older records not listed)\n", (unsigned long long) (members - nlisted));
+	for (int i = nlisted - 1; i >= 0; i--) print_event(stdout, &listed[i]);
+
+	int distinct = 0;
+	for (int pc = 0; pc < MEMORY_MAX; pc++) distinct += instances[pc] > 0;
+	if (distinct) printf("\ninstructions in the slice:\n");
+	for (int pc = 0; pc < MEMORY_MAX; pc++) {
+		if (!instances[pc]) continue;
+		char text[32], name[80];
+		disassemble(pc, instructions[pc], text, sizeof(text));
+		sym_format(pc, name, sizeof(name));
+		printf("  x%04X %-16s %-20s %10llu time%s\n", pc, name, text,
+			(unsigned long long) instances[pc], instances[pc] == 1 ? "" : "s");
+	}
+
+	if (live_regs || nlive_words) {
+		printf("\nfrom the initial state:");
+		for (int i = 0; i < R_COUNT; i++) {
+			if (live_regs >> i & 1) printf(" %s=x%04X", reg_names[i], initial_reg[i]);
+		}
+		int shown = 0;
+		for (int a = 0; a < MEMORY_MAX; a++) {
+			if (!is_live(a)) continue;
+			if (shown++ == 16) {
+				printf(" ...");
+				break;
+			}
+			printf(" [x%04X]=x%04X", a, initial_memory[a]);
+		}
+		printf("\n");
+	}
+
+	printf("\nslice: %llu of %llu records (%d instructions); decoded %d of %d chunks and skipped %d\n",
+		(unsigned long long) members, (unsigned long long) at, distinct, read, considered, skipped);
+	return 0;
+}
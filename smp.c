@@ -0,0 +1,622 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+// unix only
+#include <unistd.h>
+#include <poll.h>
+
+#include "smp.h"
+#include "io.h"
+#include "latency.h"
+#include "status.h"
+#include "pace.h"
+#include "trace.h"
+#include "record.h"
+#include "heat.h"
+#include "prof.h"
+#include "plugin.h"
+#include "native.h"
+#include "fb.h"
+#include "commands.h"
+
+#define SCHEDULE_VERSION 1
+#define STRIDE (1 << 16) // virtual time a weight-1 core spends per instruction
+
+int smp_cores = 1;
+int smp_current;
+int64_t smp_budget;
+
+static uint16_t regs[SMP_MAX][R_COUNT];
+static uint8_t halted[SMP_MAX];
+static int running; // cores that haven't halted
+static int deterministic;
+static uint64_t quantum;
+static uint64_t rng;
+static FILE* record_file;
+static FILE* replay_file;
+static uint64_t quanta;
+static uint32_t current_length; // of the current quantum, so far as we know
+
+// the fair scheduler
+static int fair;
+static uint32_t weight[SMP_MAX];
+static uint8_t batch[SMP_MAX];
+static uint64_t pass[SMP_MAX]; // virtual time used so far
+static uint64_t virtual_time; // pass of the last core picked
+static uint8_t waiting[SMP_MAX]; // its last KBSR check came up empty
+static int woken = -1; // a waiting core we've seen input for
+static uint64_t arrival_ns;
+static uint64_t executed[SMP_MAX];
+
+// with --latency, a thread watches stdin so a key is timed from when it arrived
+//	rather than from whenever the next quantum boundary got round to noticing it
+static pthread_t watcher;
+static atomic_int watching;
+static pthread_mutex_t seen_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t seen_taken = PTHREAD_COND_INITIALIZER;
+static uint64_t seen_ns; // when input showed up; 0 until then
+
+// --core-threads: each round, every core's quantum is run ahead on its own host
+//	thread from the memory the round started with, writing into private copies
+//	of the pages it stores to. Then the cores take their turns in order as
+//	usual, and a core whose run touched no page that was written earlier in the
+//	round gets its results as they are, since going first would have made no
+//	difference; one that did runs its quantum again on the interpreter. A run
+//	stops early at anything only the interpreter can do (traps, device
+//	registers), and the interpreter takes the quantum from there.
+int smp_tracking;
+uint8_t smp_written[MEMORY_MAX / SMP_PAGE];
+
+struct run {
+	uint16_t reg[R_COUNT];
+	uint32_t length, ran;
+	uint8_t touched[MEMORY_MAX / SMP_PAGE]; // read or written
+	uint16_t* page[MEMORY_MAX / SMP_PAGE]; // our copy of each page we wrote
+	uint16_t copies[MEMORY_MAX / SMP_PAGE][SMP_PAGE];
+};
+
+static int threads = 1;
+static struct run* runs; // one per core
+static int order[SMP_MAX]; // this round's turns
+static int turns, turns_taken;
+
+static pthread_t workers[SMP_MAX];
+static int nworkers;
+static pthread_mutex_t round_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t round_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t round_done = PTHREAD_COND_INITIALIZER;
+static int round_number, jobs_taken, jobs_done, quitting;
+static uint64_t kept, run_again; // quanta whose run ahead we could use, and couldn't
+
+// xorshift64*, seeded from the clock, so free-running schedules differ run to run
+static uint64_t random64(void) {
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 0x2545F4914F6CDD1DULL;
+}
+
+static void put32(FILE* out, uint32_t v) {
+	for (int i = 0; i < 4; i++) fputc(v >> (8 * i) & 0xFF, out);
+}
+
+static int get32(FILE* in, uint32_t* v) {
+	*v = 0;
+	for (int i = 0; i < 4; i++) {
+		int c = fgetc(in);
+		if (c == EOF) return 0;
+		*v |= (uint32_t) c << (8 * i);
+	}
+	return 1;
+}
+
+static int next_running(int after) {
+	for (int i = 1; i <= smp_cores; i++) {
+		int core = (after + i) % smp_cores;
+		if (!halted[core]) return core;
+	}
+	return after;
+}
+
+// a schedule we can't follow any more; carry on round robin rather than stopping the guest
+static void abandon_replay(const char* why) {
+	fprintf(stderr, "Schedule replay stopped after %llu quanta: %s. Continuing round robin.\n",
+		(unsigned long long) quanta, why);
+	fclose(replay_file);
+	replay_file = NULL;
+	deterministic = 1;
+}
+
+// a core input just arrived for, else the best class that isn't waiting on
+//	input, and within that whoever is furthest behind on its share. Waiting
+//	cores still get a turn when there's nothing else, to poll.
+static int pick_fair(void) {
+	if (woken >= 0 && !halted[woken]) return woken;
+	int best = -1, best_rank = 0;
+	for (int i = 0; i < smp_cores; i++) {
+		if (halted[i]) continue;
+		int rank = 2 * waiting[i] + batch[i];
+		if (best < 0 || rank < best_rank || (rank == best_rank && pass[i] < pass[best])) {
+			best = i;
+			best_rank = rank;
+		}
+	}
+	return best < 0 ? smp_current : best;
+}
+
+static void* watch_input(void* arg) {
+	(void) arg;
+	struct pollfd in = { STDIN_FILENO, POLLIN, 0 };
+	while (atomic_load(&watching)) {
+		// the same input stays readable until someone reads it, so wait for the scheduler to take it first
+		pthread_mutex_lock(&seen_lock);
+		while (seen_ns && atomic_load(&watching)) pthread_cond_wait(&seen_taken, &seen_lock);
+		pthread_mutex_unlock(&seen_lock);
+		if (poll(&in, 1, 50) > 0) {
+			pthread_mutex_lock(&seen_lock);
+			seen_ns = now_ns();
+			pthread_mutex_unlock(&seen_lock);
+		}
+	}
+	return NULL;
+}
+
+// when the input the watcher saw arrived (now if it hasn't seen any), and let it look for more
+static uint64_t take_arrival(void) {
+	pthread_mutex_lock(&seen_lock);
+	uint64_t when = seen_ns ? seen_ns : now_ns();
+	seen_ns = 0;
+	pthread_cond_signal(&seen_taken);
+	pthread_mutex_unlock(&seen_lock);
+	return when;
+}
+
+// between quanta the scheduler checks the console for the cores that are waiting
+//	on it, so a key doesn't have to wait for their turn to come round
+static void check_input(void) {
+	if (woken >= 0) return;
+	int candidate = -1;
+	for (int i = 0; i < smp_cores; i++) {
+		if (waiting[i] && !halted[i] && (candidate < 0 || batch[candidate] > batch[i])) candidate = i;
+	}
+	if (candidate >= 0 && check_key()) {
+		woken = candidate;
+		arrival_ns = atomic_load(&watching) ? take_arrival() : now_ns();
+	} else if (atomic_load(&watching)) {
+		take_arrival(); // whatever it saw, a core that was polling has read it by now
+	}
+}
+
+// choose who runs next and for how long
+static void plan(int* core, uint32_t* length) {
+	if (replay_file) {
+		int c = fgetc(replay_file);
+		uint32_t n;
+		if (c == EOF || !get32(replay_file, &n)) {
+			abandon_replay("the schedule ended");
+		} else if (c >= smp_cores || halted[c] || !n) {
+			abandon_replay("it doesn't match this run");
+		} else {
+			*core = c;
+			*length = n;
+			return;
+		}
+	}
+	if (fair) {
+		*core = pick_fair();
+		*length = quantum;
+	} else if (deterministic) {
+		*core = next_running(smp_current);
+		*length = quantum;
+	} else {
+		int pick = random64() % running;
+		*core = 0;
+		for (int i = 0; i < smp_cores; i++) {
+			if (halted[i]) continue;
+			if (pick-- == 0) {
+				*core = i;
+				break;
+			}
+		}
+		*length = 1 + random64() % (2 * quantum);
+	}
+}
+
+static inline uint16_t sext(uint16_t x, int bits) {
+	return (int16_t) (x << (16 - bits)) >> (16 - bits);
+}
+
+static inline void set_cc(uint16_t* r, int dr) {
+	r[R_COND] = !r[dr] ? FL_ZRO : r[dr] >> 15 ? FL_NEG : FL_POS;
+}
+
+static inline uint16_t run_read(struct run* u, uint16_t a) {
+	u->touched[a / SMP_PAGE] = 1;
+	uint16_t* copy = u->page[a / SMP_PAGE];
+	return copy ? copy[a % SMP_PAGE] : memory[a];
+}
+
+static inline void run_write(struct run* u, uint16_t a, uint16_t v) {
+	int n = a / SMP_PAGE;
+	if (!u->page[n]) {
+		u->page[n] = u->copies[n];
+		memcpy(u->page[n], memory + n * SMP_PAGE, sizeof(u->copies[n]));
+		u->touched[n] = 1;
+	}
+	u->page[n][a % SMP_PAGE] = v;
+}
+
+// the same as the interpreter does, up to the first instruction it can't do
+//	on its own; memory isn't written by anyone while this runs
+static void run_ahead(struct run* u) {
+	uint16_t* r = u->reg;
+	uint32_t n;
+	for (n = 0; n < u->length; n++) {
+		uint16_t pc = r[R_PC];
+		if (pc >= MMIO_BASE) break;
+		uint16_t instr = run_read(u, pc);
+		uint16_t dr = (instr >> 9) & 0x7, sr1 = (instr >> 6) & 0x7;
+		uint16_t next = pc + 1, a;
+		switch (instr >> 12) {
+		case OP_ADD:
+			r[dr] = r[sr1] + ((instr >> 5) & 1 ? sext(instr & 0x1F, 5) : r[instr & 0x7]);
+			set_cc(r, dr);
+			break;
+		case OP_AND:
+			r[dr] = r[sr1] & ((instr >> 5) & 1 ? sext(instr & 0x1F, 5) : r[instr & 0x7]);
+			set_cc(r, dr);
+			break;
+		case OP_NOT:
+			r[dr] = ~r[sr1];
+			set_cc(r, dr);
+			break;
+		case OP_BR:
+			if (dr & r[R_COND]) next += sext(instr & 0x1FF, 9);
+			break;
+		case OP_JMP:
+			next = r[sr1];
+			break;
+		case OP_JSR:
+			r[R_R7] = next; // before JSRR reads its register, as in the interpreter
+			next = (instr >> 11) & 1 ? next + sext(instr & 0x7FF, 11) : r[sr1];
+			break;
+		case OP_LD:
+		case OP_LDI:
+			a = next + sext(instr & 0x1FF, 9);
+			if (a >= MMIO_BASE) goto stop;
+			if (instr >> 12 == OP_LDI) {
+				a = run_read(u, a);
+				if (a >= MMIO_BASE) goto stop;
+			}
+			r[dr] = run_read(u, a);
+			set_cc(r, dr);
+			break;
+		case OP_LDR:
+			a = r[sr1] + sext(instr & 0x3F, 6);
+			if (a >= MMIO_BASE) goto stop;
+			r[dr] = run_read(u, a);
+			set_cc(r, dr);
+			break;
+		case OP_LEA:
+			r[dr] = next + sext(instr & 0x1FF, 9);
+			set_cc(r, dr);
+			break;
+		case OP_ST:
+		case OP_STI:
+			a = next + sext(instr & 0x1FF, 9);
+			if (a >= MMIO_BASE) goto stop;
+			if (instr >> 12 == OP_STI) {
+				a = run_read(u, a);
+				if (a >= MMIO_BASE) goto stop;
+			}
+			run_write(u, a, r[dr]);
+			break;
+		case OP_STR:
+			a = r[sr1] + sext(instr & 0x3F, 6);
+			if (a >= MMIO_BASE) goto stop;
+			run_write(u, a, r[dr]);
+			break;
+		default:
+			goto stop; // traps, and the opcodes that stop the machine
+		}
+		r[R_PC] = next;
+	}
+stop:
+	u->ran = n;
+}
+
+// take this round's runs until there are none left
+static void do_jobs(void) {
+	pthread_mutex_lock(&round_lock);
+	while (jobs_taken < turns) {
+		struct run* u = &runs[order[jobs_taken++]];
+		pthread_mutex_unlock(&round_lock);
+		run_ahead(u);
+		pthread_mutex_lock(&round_lock);
+		if (++jobs_done == turns) pthread_cond_signal(&round_done);
+	}
+	pthread_mutex_unlock(&round_lock);
+}
+
+static void* worker(void* arg) {
+	(void) arg;
+	int seen = 0;
+	for (;;) {
+		pthread_mutex_lock(&round_lock);
+		while (!quitting && seen == round_number) pthread_cond_wait(&round_start, &round_lock);
+		seen = round_number;
+		int quit = quitting;
+		pthread_mutex_unlock(&round_lock);
+		if (quit) return NULL;
+		do_jobs();
+	}
+}
+
+// nothing is watching instruction by instruction, so a quantum can be run anywhere
+static int unobserved(void) {
+	return state == S_TURBO && !trace_enabled && !record_enabled && !heat_enabled && !prof_enabled
+		&& !plugins_loaded && !native_enabled && !fb_enabled && !breakpoint_count;
+}
+
+// run every core's quantum for the round starting with the current one
+static void start_round(void) {
+	turns = turns_taken = 0;
+	for (int i = 0, core = smp_current; i < running; i++, core = next_running(core)) {
+		struct run* u = &runs[core];
+		memcpy(u->reg, core == smp_current ? reg : regs[core], sizeof(u->reg));
+		u->length = quantum;
+		memset(u->touched, 0, sizeof(u->touched));
+		memset(u->page, 0, sizeof(u->page));
+		order[turns++] = core;
+	}
+
+	pthread_mutex_lock(&round_lock);
+	jobs_taken = jobs_done = 0;
+	round_number++;
+	pthread_cond_broadcast(&round_start);
+	pthread_mutex_unlock(&round_lock);
+	do_jobs();
+	pthread_mutex_lock(&round_lock);
+	while (jobs_done < turns) pthread_cond_wait(&round_done, &round_lock);
+	pthread_mutex_unlock(&round_lock);
+
+	memset(smp_written, 0, sizeof(smp_written));
+	smp_tracking = 1;
+}
+
+// the current core's turn in a round: use what it ran ahead if nothing earlier
+//	in the round got in its way. Returns 1 if that covered the whole quantum.
+static int take_turn(void) {
+	if (threads < 2 || !deterministic || fair || replay_file || running < 2) return 0;
+	if (!unobserved() || (turns_taken < turns && order[turns_taken] != smp_current)) {
+		turns = turns_taken = smp_tracking = 0; // the interpreter has it from here
+		return 0;
+	}
+	if (turns_taken == turns) start_round();
+	struct run* u = &runs[order[turns_taken++]];
+
+	for (int n = 0; n < MEMORY_MAX / SMP_PAGE; n++) {
+		if (u->touched[n] && smp_written[n]) {
+			run_again++; // it has to see what was written first
+			return 0;
+		}
+	}
+	kept++;
+	for (int n = 0; n < MEMORY_MAX / SMP_PAGE; n++) {
+		if (!u->page[n]) continue;
+		memcpy(memory + n * SMP_PAGE, u->page[n], sizeof(u->copies[n]));
+		smp_written[n] = 1;
+	}
+	memcpy(reg, u->reg, sizeof(reg));
+	count_retired(u->ran);
+	if (pace_hz) pace_account(u->ran);
+	smp_budget -= u->ran;
+	return !smp_budget;
+}
+
+// what the last quantum actually ran, which is what a replay has to follow
+static void end_accounting(void) {
+	// a negative budget means compiled code ran past the end of the quantum
+	uint32_t ran = (int64_t) current_length - smp_budget;
+	if (record_file && ran) { // a core that yielded straight away didn't really get a turn
+		fputc(smp_current, record_file);
+		put32(record_file, ran);
+	}
+	executed[smp_current] += ran;
+	pass[smp_current] += ran * (STRIDE / weight[smp_current]);
+}
+
+static void begin_quantum(void) {
+	if (quanta) end_accounting();
+	if (fair) check_input();
+
+	int core;
+	uint32_t length;
+	for (;;) {
+		plan(&core, &length);
+		quanta++;
+		if (core != smp_current) {
+			memcpy(regs[smp_current], reg, sizeof(reg));
+			memcpy(reg, regs[core], sizeof(reg));
+			if (state == S_STEP && quanta > 1) printf("Switched to core %d.\n", core);
+			smp_current = core;
+		}
+		smp_budget = current_length = length;
+		if (!take_turn()) break;
+		end_accounting(); // all done ahead of time; on to the next
+	}
+
+	if (fair) {
+		if (core == woken) {
+			latency_wakeup(now_ns() - arrival_ns);
+			woken = -1;
+		}
+		// a core that sat waiting doesn't get to make up for lost time all at once
+		if (pass[core] < virtual_time) pass[core] = virtual_time;
+		virtual_time = pass[core];
+	}
+}
+
+int smp_parallel(int n) {
+	if (n < 1 || n > SMP_MAX) return 0;
+	threads = n;
+	return 1;
+}
+
+int smp_start(int cores, uint64_t quantum_length, int fixed, const char* record_path, const char* replay_path) {
+	if (record_path) {
+		record_file = fopen(record_path, "wb");
+		if (!record_file) return 0;
+		fwrite("LC3S", 1, 4, record_file);
+		fputc(SCHEDULE_VERSION, record_file);
+		fputc(cores, record_file);
+	}
+	if (replay_path) {
+		replay_file = fopen(replay_path, "rb");
+		char magic[4];
+		if (!replay_file || fread(magic, 1, 4, replay_file) != 4 || memcmp(magic, "LC3S", 4)
+			|| fgetc(replay_file) != SCHEDULE_VERSION || fgetc(replay_file) != cores) {
+			fprintf(stderr, "%s isn't a schedule for %d cores.\n", replay_path, cores);
+			return 0;
+		}
+	}
+
+	smp_cores = cores;
+	running = cores;
+	quantum = quantum_length ? quantum_length : 1;
+	deterministic = fixed;
+	rng = (uint64_t) time(NULL) * 0x9E3779B97F4A7C15ULL ^ (uint64_t) getpid();
+	if (!rng) rng = 1;
+
+	for (int i = 0; i < cores; i++) {
+		if (!weight[i]) weight[i] = 1;
+	}
+
+	if (fair && latency_enabled) {
+		atomic_store(&watching, 1);
+		if (pthread_create(&watcher, NULL, watch_input, NULL) != 0) atomic_store(&watching, 0);
+	}
+
+	if (threads > 1) {
+		runs = malloc(cores * sizeof(*runs));
+		if (!runs) return 0;
+		// we take jobs too, so one thread fewer
+		while (nworkers < threads - 1 && pthread_create(&workers[nworkers], NULL, worker, NULL) == 0) nworkers++;
+	}
+
+	// every core boots the same way
+	for (int i = 0; i < cores; i++) memcpy(regs[i], reg, sizeof(reg));
+	smp_current = cores - 1; // so round robin starts with core 0
+	begin_quantum();
+	return 1;
+}
+
+void smp_stop(void) {
+	if (atomic_load(&watching)) {
+		pthread_mutex_lock(&seen_lock);
+		atomic_store(&watching, 0);
+		pthread_cond_signal(&seen_taken);
+		pthread_mutex_unlock(&seen_lock);
+		pthread_join(watcher, NULL);
+	}
+	if (nworkers) {
+		pthread_mutex_lock(&round_lock);
+		quitting = 1;
+		pthread_cond_broadcast(&round_start);
+		pthread_mutex_unlock(&round_lock);
+		for (int i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+		nworkers = 0;
+	}
+	if (quanta) end_accounting();
+	quanta = 0;
+	if (record_file) fclose(record_file);
+	if (replay_file) fclose(replay_file);
+	record_file = replay_file = NULL;
+}
+
+void smp_switch(void) {
+	if (!running) return;
+	begin_quantum();
+}
+
+// stop the current quantum at the end of this instruction (which hasn't been
+//	counted yet)
+static void end_quantum(void) {
+	current_length -= smp_budget - 1;
+	smp_budget = 1;
+}
+
+int smp_halt(void) {
+	halted[smp_current] = 1;
+	if (!--running) return 0;
+	end_quantum();
+	return 1;
+}
+
+void smp_polled(int found) {
+	waiting[smp_current] = !found;
+	if (!found) end_quantum(); // it has nothing to do until a key comes
+}
+
+void smp_yield(void) {
+	current_length -= smp_budget;
+	smp_budget = 0;
+	smp_switch();
+}
+
+int smp_others_runnable(void) {
+	for (int i = 0; i < smp_cores; i++) {
+		if (i != smp_current && !halted[i] && !waiting[i]) return 1;
+	}
+	return 0;
+}
+
+// a comma-separated list with one entry per core; missing entries are left alone
+static int parse_list(const char* list, int is_classes) {
+	int core = 0;
+	for (const char* p = list; *p; core++) {
+		if (core == SMP_MAX) return 0;
+		if (is_classes) {
+			if (*p == 'i') batch[core] = 0;
+			else if (*p == 'b') batch[core] = 1;
+			else return 0;
+			while (*p && *p != ',') p++;
+		} else {
+			char* end;
+			long w = strtol(p, &end, 10);
+			if (end == p || w < 1 || w > STRIDE) return 0;
+			weight[core] = w;
+			p = end;
+		}
+		if (*p == ',') p++;
+		else if (*p) return 0;
+	}
+	return 1;
+}
+
+int smp_fair(const char* weights, const char* classes) {
+	if (weights && !parse_list(weights, 0)) return 0;
+	if (classes && !parse_list(classes, 1)) return 0;
+	fair = 1;
+	return 1;
+}
+
+void smp_print_stats(FILE* out) {
+	if (smp_cores == 1) return;
+	uint64_t total = 0;
+	for (int i = 0; i < smp_cores; i++) total += executed[i];
+	fprintf(out, "cores:  class        weight   instructions   share\n");
+	for (int i = 0; i < smp_cores; i++) {
+		fprintf(out, "  %2d    %-11s %7u %14llu %6.1f%%%s\n", i, !fair ? "-" : batch[i] ? "batch" : "interactive", weight[i],
+			(unsigned long long) executed[i], total ? 100.0 * executed[i] / total : 0.0,
+			halted[i] ? "  halted" : waiting[i] ? "  waiting for input" : "");
+	}
+	if (threads > 1) {
+		fprintf(out, "run ahead on %d threads: %llu quanta kept, %llu run again\n", threads,
+			(unsigned long long) kept, (unsigned long long) run_again);
+	}
+}
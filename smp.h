@@ -0,0 +1,91 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Multiple cores sharing one memory. Every core has its own register file and
+//	they take turns on the interpreter in quanta: the running core's registers
+//	live in reg[], and switching cores swaps them out. Each core starts at the
+//	entry point and can tell which one it is by reading MR_CORE.
+//
+//	By default the next core and the length of its quantum are picked at random,
+//	the way host threads would get scheduled, so races show up. --deterministic
+//	runs the cores round robin in fixed quanta instead, and a schedule recorded
+//	from any run with --schedule-record can be played back with --schedule-replay
+//	to get exactly the same interleaving again (given the same input).
+//
+//	--core-threads lets deterministic quanta run at the same time on host threads
+//	without changing what they do: each round every core runs its quantum ahead
+//	against the memory the round started with, and a core keeps that result
+//	unless a page it touched was written by a core whose turn came before it, in
+//	which case it runs again in turn. That's only while nothing is watching
+//	instructions one at a time (tracing, profiling, plugins, breakpoints and the
+//	like), and it pays off once quanta are long enough to cover the hand-off.
+//
+//	--core-weights and --core-classes switch to a fair scheduler instead, for
+//	mixing interactive programs with batch ones. Interactive cores run ahead of
+//	batch ones, and within a class each core gets instructions in proportion to
+//	its weight (stride scheduling over fixed quanta). Cores waiting for input
+//	stop counting as runnable; the scheduler checks the console for them
+//	between quanta and runs one first thing once a key arrives.
+//
+//	Under any scheduler, a core whose KBSR check finds no key gives up the rest
+//	of its quantum, and one that would block in GETC, IN or READ gives it up
+//	without running the trap, so it never holds up the host waiting for a key.
+
+#define SMP_MAX 16
+#define SMP_PAGE 256
+
+extern int smp_cores; // 1 when there's no SMP
+extern int smp_current;
+extern int64_t smp_budget; // instructions left in the current quantum
+
+// pages stored to so far in the current round of --core-threads quanta, while
+//	smp_tracking is on
+extern int smp_tracking;
+extern uint8_t smp_written[MEMORY_MAX / SMP_PAGE];
+
+static inline void smp_store(uint16_t address) {
+	smp_written[address / SMP_PAGE] = 1;
+}
+
+// with --deterministic, run up to `threads` cores' quanta at once; 0 if it's out of range
+int smp_parallel(int threads);
+
+// use the fair scheduler; the lists give each core's weight (default 1) and
+//	class (i for interactive, the default, or b for batch). 0 if they don't parse.
+int smp_fair(const char* weights, const char* classes);
+
+// 0 (after saying why) if the schedule files can't be opened
+int smp_start(int cores, uint64_t quantum, int deterministic, const char* record_path, const char* replay_path);
+void smp_stop(void);
+
+// the current quantum ran out: pick the next core and switch to it
+void smp_switch(void);
+
+static inline void smp_account(int n) {
+	if ((smp_budget -= n) <= 0) smp_switch();
+}
+
+// the current core executed HALT; it stops at the end of this instruction.
+//	Returns 0 if it was the last one running.
+int smp_halt(void);
+
+// the current core checked KBSR and `found` a key or didn't; if not, its
+//	quantum ends with this instruction
+void smp_polled(int found);
+
+// the current core can't go on until a key comes (see guest_key_ready()): switch
+//	now, without counting the instruction it was about to run
+void smp_yield(void);
+
+// whether a core other than the current one hasn't halted and isn't waiting for input
+int smp_others_runnable(void);
+
+// instructions each core has run, and its share
+void smp_print_stats(FILE* out);
+
+#endif
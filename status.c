@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+// unix only
+#include <unistd.h>
+
+#include "lc3.h"
+#include "status.h"
+#include "sym.h"
+#include "io.h"
+
+#define STATUS_PERIOD_NS 250000000 // four updates a second
+
+atomic_uint_least64_t instructions_retired;
+atomic_uint_least64_t input_wait_ns;
+atomic_uint_least64_t output_bytes;
+
+static pthread_t thread;
+static atomic_int running;
+static int on_tty; // draw on a reserved bottom line instead of printing lines
+static int rows;
+static int shown; // whether the status line is on screen right now
+
+static void reserve_line(int reserve) {
+	if (reserve) {
+		// make room in case the cursor is on the last line
+		term_write("\n\033[A", 4);
+		term_reserve(-1, 1);
+	} else {
+		term_reserve(-1, 0);
+		char buffer[32];
+		int length = snprintf(buffer, sizeof(buffer), "\0337\033[%d;1H\033[2K\0338", rows);
+		term_write(buffer, length);
+	}
+}
+
+static void draw(uint64_t count, double mips) {
+	// the interpreter thread owns the PC; a 16-bit read is never torn
+	uint16_t pc = ((volatile uint16_t*) reg)[R_PC];
+	char symbol[80];
+	sym_format(pc, symbol, sizeof(symbol));
+
+	char text[256];
+	int length = snprintf(text, sizeof(text),
+		"[lc3vm] PC x%04X %-20s %12llu instrs %8.2f MIPS  input wait %.1fs  output %llu B",
+		pc, symbol, (unsigned long long) count, mips,
+		atomic_load_explicit(&input_wait_ns, memory_order_relaxed) / 1e9,
+		(unsigned long long) atomic_load_explicit(&output_bytes, memory_order_relaxed));
+
+	char buffer[320];
+	if (on_tty) {
+		length = snprintf(buffer, sizeof(buffer), "\0337\033[%d;1H\033[7m%.*s\033[K\033[0m\0338", rows, length, text);
+	} else {
+		length = snprintf(buffer, sizeof(buffer), "%s\n", text);
+	}
+	term_write(buffer, length);
+}
+
+static void* status_thread(void* unused) {
+	(void) unused;
+	uint64_t last_count = atomic_load_explicit(&instructions_retired, memory_order_relaxed);
+	uint64_t last_time = now_ns();
+	while (atomic_load(&running)) {
+		struct timespec period = { 0, STATUS_PERIOD_NS };
+		nanosleep(&period, NULL);
+
+		uint64_t count = atomic_load_explicit(&instructions_retired, memory_order_relaxed);
+		uint64_t time = now_ns();
+		double mips = (count - last_count) / ((time - last_time) / 1e3);
+		last_count = count;
+		last_time = time;
+
+		// only in turbo mode; single-step mode has its own narration
+		if (*(volatile int*) &state == S_TURBO) {
+			if (on_tty && !shown) reserve_line(1);
+			shown = 1;
+			draw(count, mips);
+		} else if (shown) {
+			if (on_tty) reserve_line(0);
+			shown = 0;
+		}
+	}
+	return NULL;
+}
+
+void status_start(void) {
+	rows = term_rows();
+	on_tty = rows > 2;
+
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, status_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		fprintf(stderr, "couldn't start the status thread\n");
+	}
+}
+
+void status_stop(void) {
+	if (!atomic_load(&running)) return;
+	atomic_store(&running, 0);
+	pthread_join(thread, NULL);
+	if (shown && on_tty) reserve_line(0);
+	shown = 0;
+}
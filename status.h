@@ -0,0 +1,27 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Turbo-mode status line: a thread wakes up a few times a second and shows
+//	where the guest is and how fast it's going, either on a reserved bottom line
+//	of the terminal or, when stderr isn't a terminal, as plain lines on stderr.
+//	The only thing the interpreter does for it is bump the retired-instruction count.
+
+extern atomic_uint_least64_t instructions_retired;	// instructions executed, all modes
+extern atomic_uint_least64_t input_wait_ns;	// time spent blocked on guest input
+extern atomic_uint_least64_t output_bytes;	// characters the guest has written
+
+// only the interpreter thread writes it, so this doesn't need a locked add
+static inline void count_retired(uint64_t n) {
+	atomic_store_explicit(&instructions_retired, atomic_load_explicit(&instructions_retired, memory_order_relaxed) + n,
+		memory_order_relaxed);
+}
+
+void status_start(void);
+
+// give the terminal back (the reserved line's scroll region) before exiting
+void status_stop(void);
+
+#endif
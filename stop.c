@@ -0,0 +1,33 @@
+#include <stdatomic.h>
+// unix only
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "stop.h"
+
+atomic_int stop_flag;
+static int wake_pipe[2] = { -1, -1 };
+
+void stop_init(void) {
+	if (pipe(wake_pipe) == 0) {
+		fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+	}
+}
+
+void request_stop(void) {
+	atomic_store(&stop_flag, 1);
+	// wake up anyone waiting on input; if the pipe is full they're already awake
+	char c = 0;
+	if (wake_pipe[1] >= 0 && write(wake_pipe[1], &c, 1) < 0) return;
+}
+
+void clear_stop(void) {
+	char buffer[64];
+	while (wake_pipe[0] >= 0 && read(wake_pipe[0], buffer, sizeof(buffer)) > 0);
+	atomic_store(&stop_flag, 0);
+}
+
+int stop_fd(void) {
+	return wake_pipe[0];
+}
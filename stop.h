@@ -0,0 +1,28 @@
+#ifndef STOP_H
+#define STOP_H
+
+#include <stdatomic.h>
+
+// Stop requests: ^C, or any thread that wants the guest paused, sets a flag that
+//	the interpreter checks after every instruction and compiled code checks at
+//	every block boundary (and so at every loop back-edge). Anything that blocks on
+//	guest input also waits on stop_fd(), so a stop never waits for a keypress.
+
+extern atomic_int stop_flag;
+
+static inline int stop_requested(void) {
+	return atomic_load_explicit(&stop_flag, memory_order_relaxed);
+}
+
+// async-signal-safe, and safe to call from any thread
+void request_stop(void);
+
+// called once the stop has been dealt with
+void clear_stop(void);
+
+// becomes readable when a stop is requested
+int stop_fd(void);
+
+void stop_init(void);
+
+#endif
@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+// unix only
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "sweep.h"
+#include "io.h"
+
+#define PAGES (MEMORY_MAX / SWEEP_PAGE)
+#define SWEEP_MAX_VMS 256
+
+// how a VM's run ended, as reported to the coordinator
+enum {
+	RUNNING = 'r',
+	STOPPED = 'h',	// HALT, or something the VM couldn't run
+	STARVED = 'i',	// GETC or IN with the case's input all used up
+	LIMIT = 't',	// ran the most instructions we allow a case
+	LOST = 'x'	// died without telling us (^C, a crash)
+};
+
+int sweeping;
+uint8_t sweep_dirty[PAGES];
+uint64_t sweep_count, sweep_next;
+
+static uint64_t every, limit;
+static int forked;
+static uint64_t fork_count; // instructions before the first input, shared by every case
+
+// the guest's output since the last report, or since the start before the fork
+static char* output;
+static size_t output_length, output_cap;
+
+// our case's input, once we're a child
+static const char* input;
+static size_t input_length, input_next;
+static int to_parent = -1, from_parent = -1;
+static uint64_t reported; // instructions covered by earlier reports
+
+static uint64_t page_hash[PAGES];
+
+struct sweep_case {
+	char* input;
+	size_t input_length;
+	char* output;
+	size_t output_length, output_cap;
+	uint64_t instructions;
+	int status;
+	int merged_into; // -1 if it ran to the end in its own VM
+	uint64_t merged_at;
+	int next; // the next case carried by the same VM
+};
+
+struct report {
+	int status;
+	uint64_t executed; // since the previous report
+	uint64_t fingerprint;
+	uint32_t output_length;
+};
+
+static struct sweep_case* cases;
+static int ncases;
+
+// FNV-1a, finished off with splitmix's mixer so that similar states spread out
+static uint64_t hash_add(uint64_t h, uint64_t v) {
+	return (h ^ v) * 0x100000001B3ULL;
+}
+
+static uint64_t hash_finish(uint64_t h) {
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBULL;
+	return h ^ h >> 31;
+}
+
+// 64 bits, so telling two different states apart fails about once in 2^64 pairs
+static uint64_t fingerprint(void) {
+	uint64_t h = 0xCBF29CE484222325ULL;
+	for (int page = 0; page < PAGES; page++) {
+		if (sweep_dirty[page]) {
+			uint64_t ph = 0xCBF29CE484222325ULL;
+			for (int i = page * SWEEP_PAGE; i < (page + 1) * SWEEP_PAGE; i++) ph = hash_add(ph, memory[i]);
+			page_hash[page] = ph;
+			sweep_dirty[page] = 0;
+		}
+		h = hash_add(h, page_hash[page]);
+	}
+	for (int i = 0; i < R_COUNT; i++) h = hash_add(h, reg[i]);
+
+	// two VMs only behave the same from here on if they'll read the same input
+	h = hash_add(h, input_length - input_next);
+	for (size_t i = input_next; i < input_length; i++) h = hash_add(h, (uint8_t) input[i]);
+	return hash_finish(h);
+}
+
+static void append(char** buffer, size_t* length, size_t* cap, const char* data, size_t n) {
+	if (*length + n > *cap) {
+		*cap = (*length + n) * 2 + 64;
+		*buffer = realloc(*buffer, *cap);
+	}
+	memcpy(*buffer + *length, data, n);
+	*length += n;
+}
+
+static int write_all(int fd, const void* data, size_t n) {
+	const char* p = data;
+	while (n > 0) {
+		ssize_t written = write(fd, p, n);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return 0;
+		p += written;
+		n -= written;
+	}
+	return 1;
+}
+
+static int read_all(int fd, void* data, size_t n) {
+	char* p = data;
+	while (n > 0) {
+		ssize_t got = read(fd, p, n);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return 0;
+		p += got;
+		n -= got;
+	}
+	return 1;
+}
+
+// a case is one line, with \n, \t, \\ and \xHH escapes
+static int load_cases(const char* path) {
+	FILE* file = fopen(path, "r");
+	if (!file) return 0;
+	char* line = NULL;
+	size_t line_cap = 0;
+	ssize_t n;
+	while ((n = getline(&line, &line_cap, file)) >= 0) {
+		if (n && line[n - 1] == '\n') line[--n] = '\0';
+		cases = realloc(cases, (ncases + 1) * sizeof(*cases));
+		struct sweep_case* c = &cases[ncases++];
+		memset(c, 0, sizeof(*c));
+		c->input = malloc(n + 1);
+		c->merged_into = -1;
+		c->status = LOST;
+		size_t length = 0;
+		for (ssize_t i = 0; i < n; i++) {
+			char ch = line[i];
+			if (ch == '\\' && i + 1 < n) {
+				char e = line[++i];
+				if (e == 'n') ch = '\n';
+				else if (e == 't') ch = '\t';
+				else if (e == 'r') ch = '\r';
+				else if (e == 'x' && i + 2 < n) {
+					char hex[3] = { line[i + 1], line[i + 2], '\0' };
+					ch = strtol(hex, NULL, 16);
+					i += 2;
+				} else ch = e;
+			}
+			c->input[length++] = ch;
+		}
+		c->input_length = length;
+	}
+	free(line);
+	fclose(file);
+	return ncases > 0;
+}
+
+int sweep_start(const char* cases_path, uint64_t every_n, uint64_t limit_n) {
+	if (!load_cases(cases_path)) return 0;
+	every = every_n;
+	limit = limit_n;
+	sweep_count = 0;
+	sweep_next = limit;
+	sweeping = 1;
+	return 1;
+}
+
+static void print_escaped(const char* s, size_t n, size_t most) {
+	for (size_t i = 0; i < n && i < most; i++) {
+		unsigned char ch = s[i];
+		if (ch == '\n') printf("\\n");
+		else if (ch == '\t') printf("\\t");
+		else if (ch == '\\') printf("\\\\");
+		else if (ch < 32 || ch >= 127) printf("\\x%02X", ch);
+		else putchar(ch);
+	}
+	if (n > most) printf("...");
+}
+
+static const char* describe(int status) {
+	switch (status) {
+	case STOPPED: return "stopped";
+	case STARVED: return "ran out of input";
+	case LIMIT: return "hit the instruction limit";
+	default: return "was lost";
+	}
+}
+
+// cases that ended the same way, with the same output, are listed together
+static void report_results(uint64_t executed, int merges) {
+	uint64_t total = 0;
+	for (int i = 0; i < ncases; i++) total += cases[i].instructions;
+	printf("\nSwept %d case%s: %d merged after converging, %llu instruction%s run instead of %llu.\n",
+		ncases, ncases == 1 ? "" : "s", merges, (unsigned long long) executed, executed == 1 ? "" : "s",
+		(unsigned long long) total);
+
+	int* group = malloc(ncases * sizeof(int));
+	for (int i = 0; i < ncases; i++) {
+		group[i] = i;
+		for (int j = 0; j < i; j++) {
+			struct sweep_case* a = &cases[j];
+			struct sweep_case* b = &cases[i];
+			if (group[j] == j && b->status == a->status && b->instructions == a->instructions
+				&& b->output_length == a->output_length && !memcmp(b->output, a->output, a->output_length)) {
+				group[i] = j;
+				break;
+			}
+		}
+	}
+	for (int i = 0; i < ncases; i++) {
+		if (group[i] != i) continue;
+		struct sweep_case* a = &cases[i];
+		int members = 0;
+		for (int j = i; j < ncases; j++) members += group[j] == i;
+		printf("\ncase%s %d", members > 1 ? "s" : "", i + 1);
+		for (int j = i + 1; j < ncases; j++) {
+			if (group[j] == i) printf(", %d", j + 1);
+		}
+		printf(": %s after %llu instruction%s\n", describe(a->status), (unsigned long long) a->instructions,
+			a->instructions == 1 ? "" : "s");
+		if (members == 1) {
+			printf("  input:  \"");
+			print_escaped(a->input, a->input_length, 60);
+			printf("\"\n");
+		}
+		for (int j = i; j < ncases; j++) {
+			if (group[j] != i || cases[j].merged_into < 0) continue;
+			printf("  case %d joined case %d after %llu instruction%s\n", j + 1, cases[j].merged_into + 1,
+				(unsigned long long) cases[j].merged_at, cases[j].merged_at == 1 ? "" : "s");
+		}
+		printf("  output: \"");
+		print_escaped(a->output, a->output_length, 400);
+		printf("\"\n");
+	}
+	free(group);
+}
+
+// the coordinator's VMs, indexed by the case each one started with
+static int* pids;
+static int* from_vm;
+static int* to_vm;
+static int* first; // the cases each VM is carrying
+static int* running;
+
+// states VMs have reported, so one that comes to the same state later can join
+//	the VM that was there first (a lossy table: a miss only costs a merge)
+#define SEEN_SIZE (1 << 16)
+struct seen {
+	uint64_t fingerprint;
+	int vm;
+	uint64_t instructions; // the VM's first case's, and its output, when it was there
+	size_t output_length;
+};
+static struct seen* seen;
+
+// the VM carrying VM v's cases now, v itself unless it was merged into another
+static int carrier(int v) {
+	while (cases[v].merged_into >= 0) v = cases[v].merged_into;
+	return v;
+}
+
+// VMs running at once; the rest of the cases wait for one to finish
+static int max_vms(void) {
+	int most = SWEEP_MAX_VMS;
+	struct rlimit files;
+	// each takes two of our descriptors, and we keep a few for ourselves
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY && files.rlim_cur < 2 * (rlim_t) most + 32) {
+		most = files.rlim_cur > 34 ? (int) (files.rlim_cur - 32) / 2 : 1;
+	}
+	return most;
+}
+
+// a case we can't run would be reported as lost when it wasn't, so stop the whole sweep
+static void give_up(const char* what) {
+	perror(what);
+	for (int v = 0; v < ncases; v++) {
+		if (running[v]) kill(pids[v], SIGKILL);
+	}
+	restore_input_buffering();
+	exit(1);
+}
+
+// fork a VM for case i from the state we split at; returns 1 in the VM
+static int start_vm(int i) {
+	int up[2], down[2];
+	if (pipe(up) != 0) give_up("sweep: pipe");
+	if (pipe(down) != 0) {
+		close(up[0]), close(up[1]);
+		give_up("sweep: pipe");
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(up[0]), close(up[1]), close(down[0]), close(down[1]);
+		give_up("sweep: fork");
+	}
+	if (pid == 0) {
+		// let go of everyone else's pipes and carry on running
+		for (int j = 0; j < ncases; j++) {
+			if (running[j]) close(from_vm[j]), close(to_vm[j]);
+		}
+		close(up[0]);
+		close(down[1]);
+		to_parent = up[1];
+		from_parent = down[0];
+		input = cases[i].input;
+		input_length = cases[i].input_length;
+		input_next = 0;
+		signal(SIGINT, SIG_DFL); // ^C ends the sweep, and the coordinator reports what it has
+		signal(SIGPIPE, SIG_DFL);
+		return 1;
+	}
+	close(up[1]);
+	close(down[0]);
+	pids[i] = pid;
+	from_vm[i] = up[0];
+	to_vm[i] = down[1];
+	first[i] = i;
+	running[i] = 1;
+	return 0;
+}
+
+// the coordinator's side of a sweep; runs in the original process and only
+//	returns in the VMs it forks. It stays as it was at the split, so VMs for
+//	later cases can be forked from it as earlier ones finish.
+static void coordinate(const char* prefix, size_t prefix_length) {
+	pids = malloc(ncases * sizeof(int));
+	from_vm = malloc(ncases * sizeof(int));
+	to_vm = malloc(ncases * sizeof(int));
+	first = malloc(ncases * sizeof(int));
+	running = calloc(ncases, sizeof(int));
+	seen = calloc(SEEN_SIZE, sizeof(*seen));
+	uint64_t* fingerprints = malloc(ncases * sizeof(uint64_t));
+
+	for (int i = 0; i < ncases; i++) {
+		append(&cases[i].output, &cases[i].output_length, &cases[i].output_cap, prefix, prefix_length);
+		cases[i].instructions = fork_count;
+		cases[i].next = -1;
+	}
+
+	int most = max_vms();
+	int started = 0, live = 0;
+	for (; started < ncases && live < most; started++, live++) {
+		if (start_vm(started)) return;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	uint64_t executed = fork_count;
+	int merges = 0;
+	char* chunk = NULL;
+	size_t chunk_cap = 0;
+	int* order = malloc(ncases * sizeof(int));
+	while (live) {
+		int nrunning = 0;
+		for (int v = 0; v < ncases; v++) {
+			if (!running[v]) continue;
+			struct report r;
+			int ok = read_all(from_vm[v], &r, sizeof(r));
+			if (ok && r.output_length > chunk_cap) {
+				chunk_cap = r.output_length;
+				chunk = realloc(chunk, chunk_cap);
+			}
+			if (ok) ok = read_all(from_vm[v], chunk, r.output_length);
+			if (!ok) {
+				r.status = LOST;
+				r.executed = 0;
+				r.output_length = 0;
+			}
+			executed += r.executed;
+			for (int c = first[v]; c >= 0; c = cases[c].next) {
+				struct sweep_case* sc = &cases[c];
+				sc->instructions += r.executed;
+				append(&sc->output, &sc->output_length, &sc->output_cap, chunk, r.output_length);
+				if (r.status != RUNNING) sc->status = r.status;
+			}
+			if (r.status == RUNNING) {
+				fingerprints[v] = r.fingerprint;
+				order[nrunning++] = v;
+			} else {
+				running[v] = 0;
+				live--;
+				close(from_vm[v]);
+				close(to_vm[v]);
+				waitpid(pids[v], NULL, 0);
+			}
+		}
+
+		// a VM in a state some VM has been in before, this round or earlier, goes
+		//	the same way from here: drop it, and its cases follow the other's
+		for (int i = 0; i < nrunning; i++) {
+			int drop = order[i];
+			struct seen* e = &seen[fingerprints[drop] % SEEN_SIZE];
+			int keep = e->fingerprint == fingerprints[drop] ? carrier(e->vm) : -1;
+			if (keep < 0 || keep == drop || (!running[keep] && cases[keep].status == LOST)) {
+				e->fingerprint = fingerprints[drop];
+				e->vm = drop;
+				e->instructions = cases[drop].instructions;
+				e->output_length = cases[drop].output_length;
+				continue;
+			}
+			char quit = 'q';
+			write_all(to_vm[drop], &quit, 1);
+			close(from_vm[drop]);
+			close(to_vm[drop]);
+			waitpid(pids[drop], NULL, 0);
+			running[drop] = 0;
+			live--;
+			merges++;
+
+			// what the other did since it was here, which is nothing if that was this round
+			struct sweep_case* k = &cases[e->vm];
+			for (int c = first[drop]; c >= 0; c = cases[c].next) {
+				struct sweep_case* sc = &cases[c];
+				sc->merged_into = keep;
+				sc->merged_at = sc->instructions;
+				sc->instructions += k->instructions - e->instructions;
+				append(&sc->output, &sc->output_length, &sc->output_cap, k->output + e->output_length,
+					k->output_length - e->output_length);
+				if (!running[keep]) sc->status = k->status;
+			}
+			if (running[keep]) {
+				// it carries on for the dropped one's cases too
+				int tail = first[keep];
+				while (cases[tail].next >= 0) tail = cases[tail].next;
+				cases[tail].next = first[drop];
+			}
+		}
+		for (int i = 0; i < nrunning; i++) {
+			if (!running[order[i]]) continue;
+			char go = 'c';
+			write_all(to_vm[order[i]], &go, 1);
+		}
+
+		// cases still waiting take the places of the VMs that finished
+		for (; started < ncases && live < most; started++, live++) {
+			if (start_vm(started)) return;
+		}
+	}
+
+	report_results(executed, merges);
+	restore_input_buffering();
+	exit(0);
+}
+
+// the first input: this is where the cases start to differ
+static void split(void) {
+	forked = 1;
+	fork_count = sweep_count;
+	char* prefix = output;
+	size_t prefix_length = output_length;
+	output = NULL;
+	output_length = output_cap = 0;
+	coordinate(prefix, prefix_length);
+
+	// we're a VM now; everything counts from here
+	free(prefix);
+	memset(sweep_dirty, 1, sizeof(sweep_dirty));
+	sweep_count = 0;
+	reported = 0;
+	sweep_next = every < limit ? every : limit;
+}
+
+static void send_report(int status) {
+	struct report r;
+	memset(&r, 0, sizeof(r));
+	r.status = status;
+	r.executed = sweep_count - reported;
+	r.fingerprint = status == RUNNING ? fingerprint() : 0;
+	r.output_length = output_length;
+	reported = sweep_count;
+	if (!write_all(to_parent, &r, sizeof(r)) || !write_all(to_parent, output, output_length)) _exit(1);
+	output_length = 0;
+}
+
+static void finish(int status) {
+	if (!forked) {
+		// the program never asked for input, so every case goes the same way
+		for (int i = 0; i < ncases; i++) {
+			struct sweep_case* c = &cases[i];
+			append(&c->output, &c->output_length, &c->output_cap, output, output_length);
+			c->instructions = sweep_count;
+			c->status = status;
+		}
+		report_results(sweep_count, 0);
+		restore_input_buffering();
+		exit(0);
+	}
+	send_report(status);
+	_exit(0);
+}
+
+void sweep_finish(void) {
+	finish(STOPPED);
+}
+
+void sweep_boundary(void) {
+	if (!forked || sweep_count >= limit) finish(LIMIT);
+
+	send_report(RUNNING);
+	char command;
+	if (!read_all(from_parent, &command, 1) || command != 'c') _exit(0); // merged into another VM
+	sweep_next = sweep_count + every;
+	if (sweep_next > limit) sweep_next = limit;
+}
+
+int sweep_getchar(void) {
+	if (!forked) split();
+	if (input_next == input_length) finish(STARVED);
+	return (uint8_t) input[input_next++];
+}
+
+int sweep_poll(uint16_t* key) {
+	if (!forked) split();
+	if (input_next == input_length) return 0;
+	*key = (uint8_t) input[input_next++];
+	return 1;
+}
+
+void sweep_output(char c) {
+	if (output_length == output_cap) {
+		output_cap = output_cap ? output_cap * 2 : 4096;
+		output = realloc(output, output_cap);
+	}
+	output[output_length++] = c;
+}
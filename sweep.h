@@ -0,0 +1,46 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Input sweeps: run the program once per input case, where each case is a line
+//	of a file. The program runs as usual until it first asks for input; then
+//	the original process stays at that point to coordinate, and forks a VM per
+//	case from it, a bounded number at a time.
+//	Every so many instructions each VM reports a fingerprint of its state (the
+//	registers, a hash per 256-word page kept up to date as pages are written,
+//	and the input it hasn't read yet) and waits. VMs whose fingerprints match
+//	have converged, so all but one are told to exit and the survivor carries on
+//	for all of their cases. At the end each case gets its own output and count.
+
+#define SWEEP_PAGE 256
+
+extern int sweeping;
+extern uint8_t sweep_dirty[MEMORY_MAX / SWEEP_PAGE];
+extern uint64_t sweep_count, sweep_next;
+
+void sweep_boundary(void);
+
+static inline void sweep_account(int n) {
+	sweep_count += n;
+	if (sweep_count >= sweep_next) sweep_boundary();
+}
+
+static inline void sweep_store(uint16_t address) {
+	sweep_dirty[address / SWEEP_PAGE] = 1;
+}
+
+// `every` instructions between fingerprints, `limit` instructions at most per case
+int sweep_start(const char* cases_path, uint64_t every, uint64_t limit);
+
+// the guest's input and output while sweeping
+int sweep_getchar(void);
+int sweep_poll(uint16_t* key); // 1 if there's a key
+void sweep_output(char c);
+
+// the VM stopped (HALT, or a bad instruction); doesn't return
+void sweep_finish(void);
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sym.h"
+
+#define SYM_NAME_MAX 64
+
+struct symbol {
+	uint16_t address;
+	char name[SYM_NAME_MAX];
+};
+
+static struct symbol* symbols;
+static int symbol_count, symbol_capacity;
+
+static int by_address(const void* a, const void* b) {
+	return (int) ((const struct symbol*) a)->address - (int) ((const struct symbol*) b)->address;
+}
+
+int sym_load(const char* path) {
+	FILE* file = fopen(path, "r");
+	if (!file) return 0;
+
+	// lines look like "//	LOOP              3005"; everything else is a header
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		char name[SYM_NAME_MAX];
+		unsigned address;
+		if (sscanf(line, "// %63s %x", name, &address) != 2) continue;
+		if (address > 0xFFFF) continue;
+
+		if (symbol_count == symbol_capacity) {
+			symbol_capacity = symbol_capacity ? symbol_capacity * 2 : 64;
+			symbols = realloc(symbols, symbol_capacity * sizeof(*symbols));
+		}
+		symbols[symbol_count].address = address;
+		strcpy(symbols[symbol_count].name, name);
+		symbol_count++;
+	}
+	fclose(file);
+
+	qsort(symbols, symbol_count, sizeof(*symbols), by_address);
+	return 1;
+}
+
+int sym_load_for_image(const char* image_path) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s", image_path);
+	char* dot = strrchr(path, '.');
+	char* slash = strrchr(path, '/');
+	if (!dot || (slash && dot < slash)) dot = path + strlen(path);
+	if (dot - path + 5 > (long) sizeof(path)) return 0;
+	strcpy(dot, ".sym");
+	return sym_load(path);
+}
+
+const char* sym_lookup(uint16_t address, uint16_t* offset) {
+	// binary search for the last symbol at or before the address
+	int lo = 0, hi = symbol_count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (symbols[mid].address <= address) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return NULL;
+	if (offset) *offset = address - symbols[lo - 1].address;
+	return symbols[lo - 1].name;
+}
+
+int sym_find(const char* name, uint16_t* address) {
+	for (int i = 0; i < symbol_count; i++) {
+		if (!strcmp(symbols[i].name, name)) {
+			*address = symbols[i].address;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void sym_format(uint16_t address, char* out, int size) {
+	uint16_t offset;
+	const char* name = sym_lookup(address, &offset);
+	if (!name) {
+		out[0] = '\0';
+	} else if (offset) {
+		snprintf(out, size, "%s+%u", name, offset);
+	} else {
+		snprintf(out, size, "%s", name);
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef SYM_H
+#define SYM_H
+
+#include <stdint.h>
+
+// Symbols from the assembler's .sym files (foo.obj comes with foo.sym), used to
+//	put names on addresses in the debugger's output.
+
+// load the symbol table that belongs with an image file, if there is one
+int sym_load_for_image(const char* image_path);
+
+int sym_load(const char* path);
+
+// name of the closest symbol at or before `address`, with the distance to it in
+//	*offset; NULL if there's no symbol before it
+const char* sym_lookup(uint16_t address, uint16_t* offset);
+
+// the address of the symbol called `name`; 0 if there isn't one
+int sym_find(const char* name, uint16_t* address);
+
+// format `address` as "NAME" or "NAME+3", or an empty string
+void sym_format(uint16_t address, char* out, int size);
+
+#endif
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "taint.h"
+#include "sym.h"
+#include "disasm.h"
+
+#define TAINT_MAX_OUTPUTS 4096 // tainted output characters we keep for the report
+#define ECHO (-2) // an output character that's the input it's tagged with (IN echoes)
+
+int taint_enabled;
+uint64_t taint_reg[R_COUNT];
+uint64_t taint_mem[MEMORY_MAX];
+uint64_t taint_last;
+
+static int inputs[TAINT_BITS - 1]; // the character behind each tag bit but the shared one
+static uint64_t input_count;
+static int reading; // TRAP_GETC or TRAP_IN while one is waiting for its key, else 0
+
+// conditional branches and jumps through registers
+static uint64_t control_runs[MEMORY_MAX];
+static uint64_t control_tainted[MEMORY_MAX];
+static uint64_t control_tags[MEMORY_MAX];
+
+static struct {
+	uint64_t position; // in everything the guest printed
+	uint64_t tag;
+	int c;
+} outputs[TAINT_MAX_OUTPUTS];
+static int noutputs;
+static uint64_t printed, tainted_printed;
+
+static uint64_t tag_of(uint64_t position) {
+	return 1ULL << (position < TAINT_BITS - 1 ? position : TAINT_BITS - 1);
+}
+
+static void output(int c, uint64_t tag) {
+	if (tag) {
+		tainted_printed++;
+		if (noutputs < TAINT_MAX_OUTPUTS) {
+			outputs[noutputs].position = printed;
+			outputs[noutputs].tag = tag;
+			outputs[noutputs].c = c;
+			noutputs++;
+		}
+	}
+	printed++;
+}
+
+uint64_t taint_input(int c) {
+	if (input_count < TAINT_BITS - 1) inputs[input_count] = c;
+	taint_last = tag_of(input_count++);
+	// only now, since a GETC or IN that's stopped while it waits runs again from the start
+	if (reading) {
+		taint_reg[R_R0] = taint_reg[R_COND] = taint_last;
+		if (reading == TRAP_IN) output(ECHO, taint_last);
+		reading = 0;
+	}
+	return taint_last;
+}
+
+static void control(uint16_t pc, uint64_t tag) {
+	control_runs[pc]++;
+	if (tag) {
+		control_tainted[pc]++;
+		control_tags[pc] |= tag;
+	}
+}
+
+static void store(uint16_t address, uint16_t sr) {
+	taint_mem[address] = taint_reg[sr];
+	if (address == MR_DDR) output((uint8_t) reg[sr], taint_reg[sr]);
+}
+
+// what the output traps print, from the registers and memory they'll print it from
+static void trap(uint16_t vector) {
+	uint64_t* t = taint_reg;
+	switch (vector) {
+	case TRAP_GETC:
+		reading = TRAP_GETC; // R0 gets the tag of the character once it's read
+		break;
+	case TRAP_OUT:
+		output((uint8_t) reg[R_R0], t[R_R0]);
+		break;
+	case TRAP_PUTS:
+		for (uint16_t a = reg[R_R0]; memory[a]; a++) output((uint8_t) memory[a], taint_mem[a]);
+		break;
+	case TRAP_IN:
+		printed += strlen("Enter a character: ");
+		reading = TRAP_IN; // and the echo
+		break;
+	case TRAP_PUTSP:
+		for (uint16_t a = reg[R_R0]; memory[a]; a++) {
+			output((uint8_t) memory[a], taint_mem[a]);
+			if (memory[a] >> 8) output((uint8_t) (memory[a] >> 8), taint_mem[a]);
+		}
+		break;
+	case TRAP_HALT:
+		printed += strlen("HALT\n");
+		break;
+	case TRAP_READ:
+		// the characters themselves get their tags as they're stored
+		t[R_R0] = t[R_COND] = 0;
+		break;
+	case TRAP_WRITE:
+		// a non-blocking WRITE that finds the terminal busy still counts as printed
+		for (int i = 0; i < reg[R_R1]; i++) {
+			uint16_t a = reg[R_R0] + (reg[R_R2] & BULK_PACKED ? i / 2 : i);
+			output((uint8_t) (reg[R_R2] & BULK_PACKED && i % 2 ? memory[a] >> 8 : memory[a]), taint_mem[a]);
+		}
+		t[R_R0] = t[R_COND] = 0;
+		break;
+	}
+}
+
+void taint_step(uint16_t instr) {
+	uint64_t* t = taint_reg;
+	uint16_t dr = (instr >> 9) & 0x7; // also SR for stores, and the condition for BR
+	uint16_t sr1 = (instr >> 6) & 0x7; // also BaseR
+	uint16_t pc_offset = sign_extend(instr & 0x1FF, 9);
+	uint16_t offset = sign_extend(instr & 0x3F, 6);
+	reading = 0; // whatever was reading before has finished, or been stopped and moved on from
+
+	switch (instr >> 12) {
+	case OP_ADD:
+	case OP_AND:
+		t[dr] = t[R_COND] = t[sr1] | ((instr >> 5) & 1 ? 0 : t[instr & 0x7]);
+		break;
+	case OP_NOT:
+		t[dr] = t[R_COND] = t[sr1];
+		break;
+	case OP_BR:
+		// BRnzp and the all-clear NOP don't depend on anything
+		if (dr != 0 && dr != 0x7) control(reg[R_PC] - 1, t[R_COND]);
+		break;
+	case OP_JMP:
+		control(reg[R_PC] - 1, t[sr1]);
+		break;
+	case OP_JSR:
+		if (!((instr >> 11) & 1)) control(reg[R_PC] - 1, t[sr1]);
+		t[R_R7] = 0;
+		break;
+	case OP_LD:
+		t[dr] = t[R_COND] = taint_mem[(uint16_t) (reg[R_PC] + pc_offset)];
+		break;
+	case OP_LDI:
+		{
+			uint16_t pointer = reg[R_PC] + pc_offset;
+			t[dr] = t[R_COND] = taint_mem[memory[pointer]] | taint_mem[pointer];
+		}
+		break;
+	case OP_LDR:
+		t[dr] = t[R_COND] = taint_mem[(uint16_t) (reg[sr1] + offset)] | t[sr1];
+		break;
+	case OP_LEA:
+		t[dr] = t[R_COND] = 0;
+		break;
+	case OP_ST:
+		store(reg[R_PC] + pc_offset, dr);
+		break;
+	case OP_STI:
+		store(memory[(uint16_t) (reg[R_PC] + pc_offset)], dr);
+		break;
+	case OP_STR:
+		store(reg[sr1] + offset, dr);
+		break;
+	case OP_TRAP:
+		t[R_R7] = 0;
+		trap(instr & 0xFF);
+		break;
+	}
+}
+
+static void print_char(FILE* out, int c) {
+	if (c == EOF || c == 0xFFFF) fprintf(out, "EOF");
+	else if (c == '\n') fprintf(out, "'\\n'");
+	else if (c == '\t') fprintf(out, "'\\t'");
+	else if (c == '\'' || c == '\\') fprintf(out, "'\\%c'", c);
+	else if (c < 32 || c >= 127) fprintf(out, "'\\x%02X'", c & 0xFF);
+	else fprintf(out, "'%c'", c);
+}
+
+// input positions as ranges, like "0-3,5,63+"
+static void format_tag(uint64_t tag, char* out, int size) {
+	int length = 0;
+	*out = '\0';
+	for (int i = 0; i < TAINT_BITS && length < size; i++) {
+		if (!(tag >> i & 1)) continue;
+		int last = i;
+		while (last + 1 < TAINT_BITS - 1 && tag >> (last + 1) & 1) last++;
+		const char* separator = length ? "," : "";
+		if (i == TAINT_BITS - 1) length += snprintf(out + length, size - length, "%s%d+", separator, i);
+		else if (last == i) length += snprintf(out + length, size - length, "%s%d", separator, i);
+		else length += snprintf(out + length, size - length, "%s%d-%d", separator, i, last);
+		i = last;
+	}
+}
+
+static int output_char(int i) {
+	if (outputs[i].c != ECHO) return outputs[i].c;
+	int position = __builtin_ctzll(outputs[i].tag);
+	return position < TAINT_BITS - 1 && (uint64_t) position < input_count ? inputs[position] : '?';
+}
+
+void taint_report(FILE* out) {
+	int branches = 0;
+	for (int pc = 0; pc < MEMORY_MAX; pc++) branches += control_tainted[pc] > 0;
+	fprintf(out, "taint: %llu input characters read; %llu of %llu output characters and %d branches or jumps depended on them\n",
+		(unsigned long long) input_count, (unsigned long long) tainted_printed, (unsigned long long) printed, branches);
+
+	if (branches) {
+		fprintf(out, "\ntainted branches and jumps:\n");
+		fprintf(out, "  address  symbol              runs    tainted  inputs            instruction\n");
+	}
+	for (int pc = 0; pc < MEMORY_MAX; pc++) {
+		if (!control_tainted[pc]) continue;
+		char name[80], text[64], inputs_text[200];
+		sym_format(pc, name, sizeof(name));
+		disassemble(pc, memory[pc], text, sizeof(text));
+		format_tag(control_tags[pc], inputs_text, sizeof(inputs_text));
+		fprintf(out, "  0x%04X   %-16s %7llu %10llu  %-16s  %s\n", pc, name, (unsigned long long) control_runs[pc],
+			(unsigned long long) control_tainted[pc], inputs_text, text);
+	}
+
+	if (noutputs) fprintf(out, "\ntainted output (position: characters <- inputs):\n");
+	for (int i = 0; i < noutputs; ) {
+		// a run of neighbouring characters with the same tag goes on one line
+		int j = i + 1;
+		while (j < noutputs && outputs[j].tag == outputs[i].tag
+			&& outputs[j].position == outputs[j - 1].position + 1) j++;
+		fprintf(out, "  %llu", (unsigned long long) outputs[i].position);
+		if (j - i > 1) fprintf(out, "-%llu", (unsigned long long) outputs[j - 1].position);
+		fprintf(out, ": ");
+		for (int k = i; k < j; k++) {
+			if (k > i) fputc(' ', out);
+			print_char(out, output_char(k));
+		}
+		char inputs_text[200];
+		format_tag(outputs[i].tag, inputs_text, sizeof(inputs_text));
+		fprintf(out, " <- %s\n", inputs_text);
+		i = j;
+	}
+	if (tainted_printed > (uint64_t) noutputs) {
+		fprintf(out, "  (and %llu more)\n", (unsigned long long) (tainted_printed - noutputs));
+	}
+
+	if (input_count) fprintf(out, "\ninputs:");
+	for (uint64_t i = 0; i < input_count && i < TAINT_BITS - 1; i++) {
+		fprintf(out, " %llu=", (unsigned long long) i);
+		print_char(out, inputs[i]);
+	}
+	if (input_count > TAINT_BITS - 1) fprintf(out, " %d+=...", TAINT_BITS - 1);
+	if (input_count) fputc('\n', out);
+}
@@ -0,0 +1,39 @@
+#ifndef TAINT_H
+#define TAINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Dynamic taint tracking: which outputs and branches depend on which input
+//	characters. Every register and memory word has a shadow tag, a bitset of the
+//	input positions its value came from (bit i for the i-th character read, with
+//	everything from the 64th on sharing the top bit). Reading input introduces a
+//	tag; ALU ops, loads and stores carry tags along with the data, and a load
+//	through a tainted pointer picks up the pointer's tag as well, so a table
+//	lookup remembers what indexed it. Conditional branches on tainted flags,
+//	jumps through tainted registers and tainted output characters are collected
+//	for the report.
+//
+//	The tags are worked out by a shadow interpreter that looks at each
+//	instruction just before the real one runs it. Compiled code doesn't call
+//	it, so --taint turns off the JIT.
+
+#define TAINT_BITS 64
+
+extern int taint_enabled;
+extern uint64_t taint_reg[R_COUNT];
+extern uint64_t taint_mem[MEMORY_MAX];
+extern uint64_t taint_last; // tag of the character read most recently
+
+// the guest just took `c` (EOF counts) from the console; returns its tag
+uint64_t taint_input(int c);
+
+// propagate tags for `instr` (the PC has already moved past it) before it runs
+void taint_step(uint16_t instr);
+
+// tainted branches and jumps, then tainted output, then the input they came from
+void taint_report(FILE* out);
+
+#endif
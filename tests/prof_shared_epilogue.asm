@@ -0,0 +1,15 @@
+; The profiler's dominator pass used to hang on this: SHARED is branched to
+;	both from SUB, which is a root because it's called, and from the main
+;	program, which is another root.
+;	printf 'c\n' | ./lc3vm --no-jit --profile=/dev/null prof_shared_epilogue.obj
+        .ORIG x3000
+        JSR SUB
+        AND R0, R0, #0
+        BRz SHARED
+SUB     BRnzp SHARED
+SHARED  ADD R2, R2, #1
+        ADD R3, R2, #-2
+        BRz DONE
+        RET
+DONE    HALT
+        .END
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "events.h"
+
+#define TRACE_VERSION 1
+
+int trace_enabled;
+
+static FILE* out;
+static uint64_t seq;
+static uint16_t saved_reg[R_COUNT];
+static struct step_event ev;
+static uint32_t nstores, capacity;
+static struct event_mem* stores;
+static uint32_t slot[MEMORY_MAX]; // where in stores each address is, plus 1
+
+static void put16(uint16_t v) {
+	fputc(v & 0xFF, out);
+	fputc(v >> 8, out);
+}
+
+int trace_open(const char* path) {
+	out = fopen(path, "wb");
+	if (!out) return 0;
+	setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+	fwrite("LC3T", 1, 4, out);
+	put16(TRACE_VERSION);
+	put16(R_COUNT);
+	for (int i = 0; i < R_COUNT; i++) put16(reg[i]);
+	for (int i = 0; i < MEMORY_MAX; i++) put16(memory[i]);
+	event_write_header(out);
+	trace_enabled = 1;
+	return 1;
+}
+
+void trace_close(void) {
+	if (!out) return;
+	fclose(out);
+	out = NULL;
+	trace_enabled = 0;
+}
+
+void trace_set_seq(uint64_t next) {
+	seq = next;
+}
+
+void trace_begin(void) {
+	memcpy(saved_reg, reg, sizeof(reg));
+	for (uint32_t i = 0; i < nstores; i++) slot[stores[i].address] = 0;
+	nstores = 0;
+}
+
+void trace_store(uint16_t address, uint16_t from, uint16_t to) {
+	// the same word twice in one instruction (KBSR polling, packed READs) keeps its first from
+	if (slot[address]) {
+		stores[slot[address] - 1].to = to;
+		return;
+	}
+	if (nstores == capacity) {
+		capacity = capacity ? 2 * capacity : 64;
+		stores = realloc(stores, capacity * sizeof(*stores));
+	}
+	slot[address] = nstores + 1;
+	stores[nstores].address = address;
+	stores[nstores].from = from;
+	stores[nstores].to = to;
+	nstores++;
+}
+
+void trace_record(uint16_t instr) {
+	// the only pointer an LDI/STI could have changed is the one it stored through
+	event_decode_fields(&ev, saved_reg[R_PC], instr, memory, saved_reg);
+	if (ev.op == OP_STI) {
+		if (slot[ev.pointer]) ev.address = stores[slot[ev.pointer] - 1].from;
+	}
+	ev.seq = seq++;
+	for (uint32_t i = 0; i < nstores; i++) {
+		if (stores[i].from != stores[i].to) event_add_mem(&ev, stores[i].address, stores[i].from, stores[i].to);
+	}
+	event_add_regs(&ev, saved_reg);
+	event_write_binary(&ev, out);
+}
+
+static uint16_t get16(const uint8_t* p) {
+	return p[0] | p[1] << 8;
+}
+
+int trace_read_header(FILE* in, uint16_t* registers, uint16_t* memory_out) {
+	memset(registers, 0, R_COUNT * sizeof(uint16_t));
+	memset(memory_out, 0, MEMORY_MAX * sizeof(uint16_t));
+
+	uint8_t magic[4];
+	if (fread(magic, 1, 4, in) != 4) return 0;
+	if (!memcmp(magic, "LC3E", 4)) {
+		// a bare event stream; put the magic back for the event reader
+		if (fseek(in, 0, SEEK_SET) != 0) return 0;
+		return event_read_header(in);
+	}
+	if (memcmp(magic, "LC3T", 4)) return 0;
+
+	uint8_t header[4];
+	if (fread(header, 1, 4, in) != 4 || get16(header) != TRACE_VERSION || get16(header + 2) != R_COUNT) return 0;
+	static uint8_t saved[(R_COUNT + MEMORY_MAX) * 2];
+	if (fread(saved, 1, sizeof(saved), in) != sizeof(saved)) return 0;
+	for (int i = 0; i < R_COUNT; i++) registers[i] = get16(saved + 2 * i);
+	for (int i = 0; i < MEMORY_MAX; i++) memory_out[i] = get16(saved + 2 * (R_COUNT + i));
+	return event_read_header(in);
+}
@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Instruction traces. --trace records every instruction the guest executes, in
+//	any mode, without the per-instruction memory snapshots single-step mode
+//	takes: registers are compared before and after, and stores are logged as they
+//	happen. A trace is "LC3T", a u16 version, u16 R_COUNT, the registers and all
+//	of memory at the start (u16s, little-endian), then a binary event stream
+//	exactly as --events-format binary writes it. `lc3vm trace-diff` reads two of
+//	them back.
+
+extern int trace_enabled;
+
+int trace_open(const char* path);
+void trace_close(void);
+void trace_set_seq(uint64_t seq); // number of the next record
+
+// everything before the first record
+#define TRACE_HEADER_BYTES (8 + 2 * (R_COUNT + MEMORY_MAX) + 6)
+
+// before and after each instruction
+void trace_begin(void);
+void trace_record(uint16_t instr);
+
+// every change to memory while the instruction runs
+void trace_store(uint16_t address, uint16_t from, uint16_t to);
+
+// reading traces back; plain binary event streams work too, just without the
+//	starting state (which then reads as all zeros)
+int trace_read_header(FILE* in, uint16_t* registers, uint16_t* memory_out);
+
+// lc3vm trace-diff [options] A B
+int trace_diff_main(int argc, char** argv);
+
+// lc3vm slice [options] TRACE REG|ADDR [at N]
+int slice_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "lc3.h"
+#include "trace.h"
+#include "events.h"
+#include "disasm.h"
+#include "sym.h"
+
+// Streams two traces side by side, holding only a window of lookahead and the
+// machine state each trace has reached (replayed from its deltas). Records
+// match when they're the same instruction at the same address with the same
+// effects. When the instructions differ, control flow has diverged; with
+// --resync we look ahead for the nearest point where both traces run the same
+// run of addresses again and carry on from there.
+
+struct reader {
+	const char* path;
+	FILE* file;
+	uint16_t reg[R_COUNT];
+	uint16_t* memory;
+	uint64_t consumed; // records applied to reg and memory
+	struct step_event* ahead; // ring buffer of records read but not applied
+	int head, length, capacity;
+	int done;
+};
+
+static int window = 4096; // how far ahead to look for a resync point
+static int match_length = 8; // instructions in a row that have to line up
+static int context = 8;
+
+static int open_reader(struct reader* r, const char* path) {
+	r->path = path;
+	r->file = fopen(path, "rb");
+	if (!r->file) {
+		fprintf(stderr, "trace-diff: can't open %s\n", path);
+		return 0;
+	}
+	r->memory = malloc(MEMORY_MAX * sizeof(uint16_t));
+	if (!trace_read_header(r->file, r->reg, r->memory)) {
+		fprintf(stderr, "trace-diff: %s isn't a trace or binary event stream\n", path);
+		return 0;
+	}
+	r->capacity = window + match_length + 1;
+	r->ahead = calloc(r->capacity, sizeof(*r->ahead));
+	return 1;
+}
+
+// the record `k` places ahead of the current one, or NULL past the end
+static const struct step_event* peek(struct reader* r, int k) {
+	while (r->length <= k && !r->done) {
+		int result = event_read_binary(&r->ahead[(r->head + r->length) % r->capacity], r->file);
+		if (result < 0) fprintf(stderr, "trace-diff: %s is truncated or corrupt after record %llu\n",
+			r->path, (unsigned long long) (r->consumed + r->length));
+		if (result <= 0) r->done = 1;
+		else r->length++;
+	}
+	return k < r->length ? &r->ahead[(r->head + k) % r->capacity] : NULL;
+}
+
+static void advance(struct reader* r) {
+	const struct step_event* ev = peek(r, 0);
+	if (!ev) return;
+	for (int i = 0; i < ev->nreg; i++) r->reg[ev->regs[i].reg] = ev->regs[i].to;
+	for (uint32_t i = 0; i < ev->nmem; i++) r->memory[ev->mem[i].address] = ev->mem[i].to;
+	r->head = (r->head + 1) % r->capacity;
+	r->length--;
+	r->consumed++;
+}
+
+static int same_instruction(const struct step_event* a, const struct step_event* b) {
+	return a->pc == b->pc && a->instr == b->instr;
+}
+
+static int same_effect(const struct step_event* a, const struct step_event* b) {
+	if (a->fields != b->fields || a->cond != b->cond || a->result != b->result || a->address != b->address) return 0;
+	if (a->nreg != b->nreg || a->nmem != b->nmem) return 0;
+	for (int i = 0; i < a->nreg; i++) {
+		if (a->regs[i].reg != b->regs[i].reg || a->regs[i].to != b->regs[i].to) return 0;
+	}
+	for (uint32_t i = 0; i < a->nmem; i++) {
+		if (a->mem[i].address != b->mem[i].address || a->mem[i].to != b->mem[i].to) return 0;
+	}
+	return 1;
+}
+
+static const char* reg_names[R_COUNT] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND" };
+
+static void print_event(FILE* out, const char* label, uint64_t index, const struct step_event* ev) {
+	char text[32], name[80];
+	disassemble(ev->pc, ev->instr, text, sizeof(text));
+	sym_format(ev->pc, name, sizeof(name));
+	fprintf(out, "  %s#%-10llu x%04X %-16s %-20s", label, (unsigned long long) index, ev->pc, name, text);
+	for (int i = 0; i < ev->nreg; i++) {
+		if (ev->regs[i].reg != R_PC) fprintf(out, " %s=x%04X", reg_names[ev->regs[i].reg], ev->regs[i].to);
+	}
+	for (uint32_t i = 0; i < ev->nmem; i++) fprintf(out, " [x%04X]=x%04X", ev->mem[i].address, ev->mem[i].to);
+	fprintf(out, "\n");
+}
+
+static void print_memory(FILE* out, struct reader* a, struct reader* b, uint16_t address) {
+	fprintf(out, "  memory around x%04X (A | B):\n", address);
+	for (int i = -3; i <= 3; i++) {
+		uint16_t at = address + i;
+		char name[80];
+		sym_format(at, name, sizeof(name));
+		fprintf(out, "    x%04X %-16s x%04X | x%04X%s\n", at, name, a->memory[at], b->memory[at],
+			a->memory[at] != b->memory[at] ? "  *" : "");
+	}
+}
+
+static void print_state(FILE* out, struct reader* a, struct reader* b) {
+	fprintf(out, "  registers before (A | B):\n");
+	for (int i = 0; i < R_COUNT; i++) {
+		fprintf(out, "    %-4s x%04X | x%04X%s\n", reg_names[i], a->reg[i], b->reg[i], a->reg[i] != b->reg[i] ? "  *" : "");
+	}
+}
+
+// the first address the two records disagree about, for the memory view
+static int interesting_address(const struct step_event* x, const struct step_event* y, uint16_t* address) {
+	for (uint32_t i = 0; i < x->nmem || i < y->nmem; i++) {
+		if (i >= x->nmem) return *address = y->mem[i].address, 1;
+		if (i >= y->nmem || x->mem[i].address != y->mem[i].address || x->mem[i].to != y->mem[i].to) {
+			return *address = x->mem[i].address, 1;
+		}
+	}
+	if (x->fields & EV_ADDRESS) return *address = x->address, 1;
+	if (y->fields & EV_ADDRESS) return *address = y->address, 1;
+	return 0;
+}
+
+static void print_divergence(FILE* out, const char* what, struct reader* a, struct reader* b,
+	struct step_event* history, uint64_t* history_index, int nhistory, int history_head) {
+	const struct step_event* x = peek(a, 0);
+	const struct step_event* y = peek(b, 0);
+	fprintf(out, "\n%s at A#%llu / B#%llu\n", what, (unsigned long long) a->consumed, (unsigned long long) b->consumed);
+	if (nhistory) fprintf(out, "  last %d in common:\n", nhistory);
+	for (int i = 0; i < nhistory; i++) {
+		int k = (history_head + context - nhistory + i) % context;
+		print_event(out, "  ", history_index[k], &history[k]);
+	}
+	print_event(out, "A", a->consumed, x);
+	print_event(out, "B", b->consumed, y);
+	print_state(out, a, b);
+	uint16_t address;
+	if (interesting_address(x, y, &address)) print_memory(out, a, b, address);
+}
+
+// the nearest (i, j) where A from i and B from j run the same addresses for
+//	match_length instructions (or both end together)
+static int find_resync(struct reader* a, struct reader* b, int* skip_a, int* skip_b) {
+	for (int d = 1; d < 2 * window; d++) {
+		for (int i = 0; i <= d; i++) {
+			int j = d - i;
+			if (i >= window || j >= window) continue;
+			int k;
+			for (k = 0; k < match_length; k++) {
+				const struct step_event* x = peek(a, i + k);
+				const struct step_event* y = peek(b, j + k);
+				if (!x || !y || !same_instruction(x, y)) break;
+			}
+			// a shorter match counts if both traces end right after it
+			if (k == match_length || (k > 0 && !peek(a, i + k) && !peek(b, j + k))) {
+				*skip_a = i;
+				*skip_b = j;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void usage(void) {
+	printf("Usage: lc3vm trace-diff [options] A B\n");
+	printf("  --resync\t\tKeep going after control flow diverges, by realigning the traces.\n");
+	printf("  --window N\t\tHow many records ahead to look for a realignment (default 4096).\n");
+	printf("  --match N\t\tHow many instructions in a row have to line up (default 8).\n");
+	printf("  --max N\t\tStop after N divergences (default 10).\n");
+	printf("  --context N\t\tHow many common instructions to show before each divergence (default 8).\n");
+	printf("  --sym FILE\t\tName addresses with an assembler symbol table.\n");
+}
+
+int trace_diff_main(int argc, char** argv) {
+	static const struct option options[] = {
+		{ "resync", no_argument, NULL, 'r' },
+		{ "window", required_argument, NULL, 'w' },
+		{ "match", required_argument, NULL, 'm' },
+		{ "max", required_argument, NULL, 'x' },
+		{ "context", required_argument, NULL, 'c' },
+		{ "sym", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int resync = 0;
+	int max = 10;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			resync = 1;
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'm':
+			match_length = atoi(optarg);
+			break;
+		case 'x':
+			max = atoi(optarg);
+			break;
+		case 'c':
+			context = atoi(optarg);
+			break;
+		case 's':
+			if (!sym_load(optarg)) fprintf(stderr, "trace-diff: can't read symbols from %s\n", optarg);
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+	if (argc - optind != 2 || window < 1 || match_length < 1 || context < 1) {
+		usage();
+		return 2;
+	}
+
+	struct reader a = { 0 }, b = { 0 };
+	if (!open_reader(&a, argv[optind]) || !open_reader(&b, argv[optind + 1])) return 2;
+
+	struct step_event* history = calloc(context, sizeof(*history));
+	uint64_t* history_index = malloc(context * sizeof(*history_index));
+	int nhistory = 0, history_head = 0;
+
+	int divergences = 0;
+	int state_diverged = 0;
+	uint64_t compared = 0, value_only = 0;
+	while (1) {
+		const struct step_event* x = peek(&a, 0);
+		const struct step_event* y = peek(&b, 0);
+		if (!x && !y) break;
+		if (!x || !y) {
+			printf("\n%s ends at record %llu; %s keeps going (x%04X next)\n", x ? "B" : "A",
+				(unsigned long long) (x ? b.consumed : a.consumed), x ? "A" : "B", x ? x->pc : y->pc);
+			divergences++;
+			break;
+		}
+
+		if (same_instruction(x, y)) {
+			if (!same_effect(x, y)) {
+				// once the state differs, the values keep differing; only report the first
+				if (!state_diverged) {
+					print_divergence(stdout, "state diverges", &a, &b, history, history_index, nhistory, history_head);
+					state_diverged = 1;
+				} else {
+					value_only++;
+				}
+			}
+			event_copy(&history[history_head], x);
+			history_index[history_head] = a.consumed;
+			history_head = (history_head + 1) % context;
+			if (nhistory < context) nhistory++;
+			advance(&a);
+			advance(&b);
+			compared++;
+			continue;
+		}
+
+		divergences++;
+		const char* what = x->pc == y->pc ? "the code differs" : "control flow diverges";
+		print_divergence(stdout, what, &a, &b, history, history_index, nhistory, history_head);
+		if (!resync || divergences >= max) break;
+
+		int skip_a, skip_b;
+		if (!find_resync(&a, &b, &skip_a, &skip_b)) {
+			printf("  no realignment within %d records\n", window);
+			break;
+		}
+		printf("  realigned after skipping %d records of A and %d of B\n", skip_a, skip_b);
+		while (skip_a--) advance(&a);
+		while (skip_b--) advance(&b);
+		nhistory = 0;
+	}
+
+	printf("\ntrace-diff: %llu records compared, %d control-flow divergence%s, %s",
+		(unsigned long long) compared, divergences, divergences == 1 ? "" : "s",
+		state_diverged ? "state diverged" : "state never diverged");
+	if (value_only) printf(" (%llu later records differ only in values)", (unsigned long long) value_only);
+	printf("\n");
+	return divergences || state_diverged ? 1 : 0;
+}
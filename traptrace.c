@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "traptrace.h"
+#include "lc3.h"
+#include "status.h"
+#include "sym.h"
+
+#define TRAPTRACE_VERSION 1
+#define RING 4096 // records; a power of two
+#define WRITER_PERIOD_NS 20000000 // 20ms
+
+int traptrace_enabled;
+uint8_t traptrace_wanted[256];
+
+struct record {
+	uint64_t retired;
+	uint16_t pc, r0_in, r0_out, r1, r2;
+	uint8_t vector, flags, length;
+	char text[TRAPTRACE_TEXT];
+};
+
+static struct record ring[RING];
+static atomic_uint_least64_t head, tail; // the interpreter publishes at head, the writer frees at tail
+static struct record* current; // the trap in progress, if we're logging it
+static pthread_t thread;
+static atomic_int running;
+static FILE* out;
+static int binary;
+
+static const char* names[] = { "GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT", "READ", "WRITE" };
+
+static const char* name_of(uint8_t vector) {
+	return vector >= TRAP_GETC && vector <= TRAP_WRITE ? names[vector - TRAP_GETC] : NULL;
+}
+
+// up to TRAPTRACE_TEXT characters from guest memory: one per word, or two when packed
+static void capture(struct record* r, uint16_t address, int count, int packed, int stop_at_zero) {
+	for (int i = 0; count < 0 || i < count; i++) {
+		uint16_t word = memory[(uint16_t) (address + (packed ? i / 2 : i))];
+		char c = packed && i % 2 ? word >> 8 : word & 0xFF;
+		if (stop_at_zero && (packed ? !c : !word)) break;
+		if (r->length == TRAPTRACE_TEXT) {
+			r->flags |= 1;
+			break;
+		}
+		r->text[r->length++] = c;
+	}
+}
+
+void traptrace_begin(uint8_t vector) {
+	if (!traptrace_wanted[vector]) return;
+	uint64_t at = atomic_load_explicit(&head, memory_order_relaxed);
+	// the writer's behind; it'll catch up within a period
+	while (at - atomic_load_explicit(&tail, memory_order_acquire) == RING) sched_yield();
+
+	struct record* r = current = &ring[at % RING];
+	r->retired = atomic_load_explicit(&instructions_retired, memory_order_relaxed);
+	r->pc = reg[R_PC] - 1;
+	r->vector = vector;
+	r->r0_in = reg[R_R0];
+	r->r1 = reg[R_R1];
+	r->r2 = reg[R_R2];
+	r->flags = r->length = 0;
+	switch (vector) {
+	case TRAP_OUT:
+		r->text[r->length++] = reg[R_R0] & 0xFF;
+		break;
+	case TRAP_PUTS:
+		capture(r, reg[R_R0], -1, 0, 1);
+		break;
+	case TRAP_PUTSP:
+		capture(r, reg[R_R0], -1, 1, 1);
+		break;
+	case TRAP_WRITE:
+		capture(r, reg[R_R0], reg[R_R1], reg[R_R2] & BULK_PACKED, 0);
+		break;
+	}
+}
+
+void traptrace_end(void) {
+	struct record* r = current;
+	if (!r) return;
+	current = NULL;
+	if (reg[R_PC] == r->pc) return; // stopped while waiting for input; it'll run again
+	r->r0_out = reg[R_R0];
+	if ((r->vector == TRAP_GETC || r->vector == TRAP_IN) && r->r0_out != 0xFFFF) {
+		r->text[r->length++] = r->r0_out & 0xFF;
+	} else if (r->vector == TRAP_READ && r->r0_out != 0xFFFF) {
+		capture(r, r->r0_in, r->r0_out, r->r2 & BULK_PACKED, 0);
+	}
+	atomic_store_explicit(&head, atomic_load_explicit(&head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+static void put(uint64_t v, int bytes) {
+	for (int i = 0; i < bytes; i++) fputc(v >> (8 * i) & 0xFF, out);
+}
+
+static void write_binary(const struct record* r) {
+	put(r->retired, 8);
+	put(r->pc, 2);
+	put(r->vector, 1);
+	put(r->flags, 1);
+	put(r->r0_in, 2);
+	put(r->r0_out, 2);
+	put(r->r1, 2);
+	put(r->r2, 2);
+	put(r->length, 1);
+	fwrite(r->text, 1, r->length, out);
+}
+
+static void write_char(char c) {
+	if (c == '\n') fputs("\\n", out);
+	else if (c == '\t') fputs("\\t", out);
+	else if (c == '"' || c == '\\' || c == '\'') fprintf(out, "\\%c", c);
+	else if ((unsigned char) c < 32 || (unsigned char) c >= 127) fprintf(out, "\\x%02X", (unsigned char) c);
+	else fputc(c, out);
+}
+
+static void write_string(const struct record* r) {
+	fputc('"', out);
+	for (int i = 0; i < r->length; i++) write_char(r->text[i]);
+	fputc('"', out);
+	if (r->flags & 1) fputs("...", out);
+}
+
+static void write_text(const struct record* r) {
+	char name[80];
+	sym_format(r->pc, name, sizeof(name));
+	fprintf(out, "[%10llu] x%04X %-16s ", (unsigned long long) r->retired, r->pc, name);
+	const char* trap = name_of(r->vector);
+	switch (r->vector) {
+	case TRAP_GETC:
+	case TRAP_IN:
+		fprintf(out, "%s() = ", trap);
+		if (r->length) {
+			fputc('\'', out);
+			write_char(r->text[0]);
+			fprintf(out, "' (x%04X)\n", r->r0_out);
+		} else {
+			fprintf(out, "EOF\n");
+		}
+		break;
+	case TRAP_OUT:
+		fprintf(out, "OUT('");
+		write_char(r->text[0]);
+		fprintf(out, "')\n");
+		break;
+	case TRAP_PUTS:
+	case TRAP_PUTSP:
+		fprintf(out, "%s(x%04X ", trap, r->r0_in);
+		write_string(r);
+		fprintf(out, ")\n");
+		break;
+	case TRAP_HALT:
+		fprintf(out, "HALT()\n");
+		break;
+	case TRAP_READ:
+	case TRAP_WRITE:
+		{
+			const char* flags[] = { "0", "packed", "nonblock", "packed|nonblock" };
+			fprintf(out, "%s(x%04X, %u, %s) = ", trap, r->r0_in, r->r1, flags[r->r2 & (BULK_PACKED | BULK_NONBLOCK)]);
+		}
+		if (r->r0_out == 0xFFFF) {
+			fprintf(out, "EOF\n");
+		} else {
+			fprintf(out, "%u ", r->r0_out);
+			write_string(r);
+			fputc('\n', out);
+		}
+		break;
+	default:
+		fprintf(out, "TRAP x%02X(R0=x%04X) = x%04X\n", r->vector, r->r0_in, r->r0_out);
+		break;
+	}
+}
+
+static void drain(void) {
+	uint64_t end = atomic_load_explicit(&head, memory_order_acquire);
+	uint64_t at = atomic_load_explicit(&tail, memory_order_relaxed);
+	if (at == end) return;
+	for (; at != end; at++) {
+		if (binary) write_binary(&ring[at % RING]);
+		else write_text(&ring[at % RING]);
+	}
+	atomic_store_explicit(&tail, at, memory_order_release);
+	fflush(out);
+}
+
+static void* writer_thread(void* unused) {
+	(void) unused;
+	while (atomic_load(&running)) {
+		struct timespec period = { 0, WRITER_PERIOD_NS };
+		nanosleep(&period, NULL);
+		drain();
+	}
+	drain();
+	return NULL;
+}
+
+static int parse_filter(const char* filter) {
+	if (!filter) {
+		memset(traptrace_wanted, 1, sizeof(traptrace_wanted));
+		return 1;
+	}
+	while (*filter) {
+		size_t n = strcspn(filter, ",");
+		char item[16];
+		if (!n || n >= sizeof(item)) return 0;
+		memcpy(item, filter, n);
+		item[n] = '\0';
+		int found = 0;
+		for (int v = TRAP_GETC; v <= TRAP_WRITE; v++) {
+			if (!strcasecmp(item, names[v - TRAP_GETC])) traptrace_wanted[v] = found = 1;
+		}
+		if (!found) {
+			char* end;
+			long v = strtol(item[0] == 'x' || item[0] == 'X' ? item + 1 : item, &end, 16);
+			if (*end || v < 0 || v > 0xFF) return 0;
+			traptrace_wanted[v] = 1;
+		}
+		filter += n;
+		if (*filter == ',') filter++;
+	}
+	return 1;
+}
+
+int traptrace_start(const char* filter, const char* path, int binary_format) {
+	if (!parse_filter(filter)) return 0;
+	out = path ? fopen(path, binary_format ? "wb" : "w") : stderr;
+	if (!out) return 0;
+	binary = binary_format;
+	if (binary) {
+		fwrite("LC3P", 1, 4, out); // not LC3R, which is a recording
+		put(TRAPTRACE_VERSION, 2);
+	}
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, writer_thread, NULL) != 0) {
+		atomic_store(&running, 0);
+		return 0;
+	}
+	traptrace_enabled = 1;
+	return 1;
+}
+
+void traptrace_stop(void) {
+	if (!traptrace_enabled) return;
+	traptrace_enabled = 0;
+	atomic_store(&running, 0);
+	pthread_join(thread, NULL);
+	if (out != stderr) fclose(out);
+}
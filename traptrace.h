@@ -0,0 +1,31 @@
+#ifndef TRAPTRACE_H
+#define TRAPTRACE_H
+
+#include <stdint.h>
+
+// strace for the guest: --trace-traps logs every trap it executes, with the
+//	calling PC, the retired-instruction count, R0 before and after, and the
+//	characters or string involved. The interpreter only fills in a fixed-size
+//	record in a ring buffer, at the trap itself; a writer thread formats the
+//	records (as text, or in binary) and writes them out, so nothing but traps
+//	costs anything and the guest doesn't wait on the log.
+//
+//	A binary log is "LC3P", a u16 version, then per trap: u64 retired, u16 pc,
+//	u8 vector, u8 flags (1: the string was truncated), u16 R0 before, R0 after,
+//	R1 and R2 before, u8 length and that many bytes of string (little-endian).
+
+#define TRAPTRACE_TEXT 48 // most characters of a string argument we keep
+
+extern int traptrace_enabled;
+extern uint8_t traptrace_wanted[256]; // by vector
+
+// `filter` is a comma-separated list of trap names or vectors (getc,out,x22),
+//	or NULL for all of them. 0 if it doesn't parse or the log can't be opened.
+int traptrace_start(const char* filter, const char* path, int binary);
+void traptrace_stop(void); // writes out whatever's still buffered
+
+// around each trap: before it runs (the PC has moved past it) and after
+void traptrace_begin(uint8_t vector);
+void traptrace_end(void);
+
+#endif
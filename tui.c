@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+// unix only
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include "lc3.h"
+#include "tui.h"
+#include "disasm.h"
+#include "io.h"
+
+#define FRAME_NS (1000000000 / 60)	// don't redraw faster than the terminal can show it
+#define OUTPUT_LINES 64			// guest output we keep around
+#define OUTPUT_WIDTH 256
+#define STEP_MANY 1000			// what 'n' steps
+
+// cell attributes
+enum {
+	A_NORMAL = 0,
+	A_BOLD,
+	A_REVERSE
+};
+
+struct cell {
+	char ch;
+	uint8_t attr;
+};
+
+int tui_active = 0;
+
+static int rows, cols;
+static struct cell* front;	// what the terminal shows
+static struct cell* back;	// what we want it to show
+static char* out;		// escape sequences for one flush
+static size_t out_len, out_size;
+
+static uint64_t last_draw;
+static long pending_steps;	// left to go from 'n' or :step N
+static uint16_t memory_view = 0x3000;
+static int memory_per_line = 8;
+static uint16_t last_reg[R_COUNT]; // registers at the last prompt, to highlight changes
+static char status[128];
+static char command[64];
+static int command_len = -1;	// -1 when we're not typing a : command
+
+static char output[OUTPUT_LINES][OUTPUT_WIDTH];
+static int output_line, output_col; // where the next character goes
+
+static void emit(const char* s, size_t n) {
+	if (out_len + n > out_size) {
+		out_size = (out_len + n) * 2;
+		out = realloc(out, out_size);
+	}
+	memcpy(out + out_len, s, n);
+	out_len += n;
+}
+
+static void emitf(const char* format, ...) {
+	char buffer[64];
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	emit(buffer, n);
+}
+
+static void write_out(void) {
+	size_t done = 0;
+	while (done < out_len) {
+		ssize_t n = write(STDOUT_FILENO, out + done, out_len - done);
+		if (n <= 0) break;
+		done += n;
+	}
+	out_len = 0;
+}
+
+// pick up the terminal size; everything is redrawn if it changed
+static void check_size(void) {
+	struct winsize ws;
+	int r = 24, c = 80;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col) {
+		r = ws.ws_row;
+		c = ws.ws_col;
+	}
+	if (r == rows && c == cols && front) return;
+
+	rows = r;
+	cols = c;
+	free(front);
+	free(back);
+	front = calloc(rows * cols, sizeof(struct cell));
+	back = calloc(rows * cols, sizeof(struct cell));
+	// the terminal is blank after this, which front (all zero) doesn't match, so every cell is resent
+	emit("\x1b[0m\x1b[2J", 8);
+}
+
+// write text into the back buffer at (row, col), clipped to `width` and padded with spaces
+static void put(int row, int col, int width, uint8_t attr, const char* format, ...) {
+	if (row < 0 || row >= rows || col >= cols) return;
+	if (col + width > cols) width = cols - col;
+
+	char buffer[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	struct cell* line = back + row * cols + col;
+	int i = 0;
+	for (; i < width && buffer[i]; i++) {
+		line[i].ch = (buffer[i] >= ' ' && buffer[i] < 127) ? buffer[i] : '.';
+		line[i].attr = attr;
+	}
+	for (; i < width; i++) {
+		line[i].ch = ' ';
+		line[i].attr = attr;
+	}
+}
+
+// send the cells that differ between back and front
+static void flush(void) {
+	int attr = -1;
+	int cursor_row = -1, cursor_col = -1;
+	for (int r = 0; r < rows; r++) {
+		for (int c = 0; c < cols; c++) {
+			struct cell* b = &back[r * cols + c];
+			struct cell* f = &front[r * cols + c];
+			if (b->ch == f->ch && b->attr == f->attr) continue;
+
+			if (r != cursor_row || c != cursor_col) emitf("\x1b[%d;%dH", r + 1, c + 1);
+			if (b->attr != attr) {
+				attr = b->attr;
+				emit(attr == A_BOLD ? "\x1b[0;1m" : attr == A_REVERSE ? "\x1b[0;7m" : "\x1b[0m", attr ? 6 : 4);
+			}
+			emit(&b->ch, 1);
+			*f = *b;
+			cursor_row = r;
+			cursor_col = c + 1;
+		}
+	}
+	if (attr > 0) emit("\x1b[0m", 4);
+	write_out();
+}
+
+static const char* cond_name(uint16_t cond) {
+	return cond == FL_NEG ? "n" : cond == FL_ZRO ? "z" : cond == FL_POS ? "p" : "?";
+}
+
+static void draw(void) {
+	check_size();
+	uint16_t pc = reg[R_PC] - 1; // the instruction that was just fetched
+	int output_rows = rows / 4 < 4 ? 4 : rows / 4;
+	int body_top = 1;
+	int body_rows = rows - 2 - output_rows;
+	int left = 0, left_width = 22;
+	int middle = left_width + 1, middle_width = 32;
+	int right = middle + middle_width + 1, right_width = cols - right;
+
+	for (int i = 0; i < rows * cols; i++) {
+		back[i].ch = ' ';
+		back[i].attr = A_NORMAL;
+	}
+
+	put(0, 0, cols, A_REVERSE, " lc3vm  PC x%04X   [s]tep  [n] step %d  [c]ontinue  [:]command  [q]uit",
+		pc, STEP_MANY);
+
+	// registers
+	put(body_top, left, left_width, A_BOLD, "Registers");
+	for (int i = 0; i < 8; i++) {
+		put(body_top + 1 + i, left, left_width, reg[i] != last_reg[i] ? A_REVERSE : A_NORMAL,
+			"R%d  x%04X %6d", i, reg[i], (int16_t) reg[i]);
+	}
+	put(body_top + 9, left, left_width, A_NORMAL, "PC  x%04X", pc);
+	put(body_top + 10, left, left_width, reg[R_COND] != last_reg[R_COND] ? A_REVERSE : A_NORMAL,
+		"CC  %s", cond_name(reg[R_COND]));
+
+	// stack around R6
+	int stack_top = body_top + 12;
+	int stack_rows = body_top + body_rows - stack_top - 1;
+	put(stack_top, left, left_width, A_BOLD, "Stack (R6)");
+	for (int i = 0; i < stack_rows; i++) {
+		uint16_t address = reg[R_R6] + i - 2;
+		put(stack_top + 1 + i, left, left_width, address == reg[R_R6] ? A_REVERSE : A_NORMAL,
+			"%c x%04X x%04X", address == reg[R_R6] ? '>' : ' ', address, memory[address]);
+	}
+
+	// disassembly, with the PC a third of the way down
+	put(body_top, middle, middle_width, A_BOLD, "Disassembly");
+	for (int i = 0; i < body_rows - 1; i++) {
+		uint16_t address = pc + i - (body_rows - 1) / 3;
+		char text[40];
+		disassemble(address, memory[address], text, sizeof(text));
+		put(body_top + 1 + i, middle, middle_width, address == pc ? A_REVERSE : A_NORMAL,
+			"%c x%04X x%04X %s", address == pc ? '>' : ' ', address, memory[address], text);
+	}
+
+	// memory
+	int per_line = right_width >= 7 + 8 * 5 ? 8 : right_width >= 7 + 4 * 5 ? 4 : 1;
+	memory_per_line = per_line;
+	put(body_top, right, right_width, A_BOLD, "Memory");
+	for (int i = 0; i < body_rows - 1; i++) {
+		char text[128];
+		uint16_t address = memory_view + i * per_line;
+		int n = snprintf(text, sizeof(text), "x%04X ", address);
+		for (int j = 0; j < per_line; j++) {
+			n += snprintf(text + n, sizeof(text) - n, " %04X", memory[(uint16_t) (address + j)]);
+		}
+		put(body_top + 1 + i, right, right_width, A_NORMAL, "%s", text);
+	}
+
+	// guest output, newest at the bottom
+	int output_top = body_top + body_rows;
+	put(output_top, 0, cols, A_BOLD, "Output");
+	for (int i = 0; i < output_rows - 1; i++) {
+		int line = (output_line - (output_rows - 2) + i + OUTPUT_LINES) % OUTPUT_LINES;
+		put(output_top + 1 + i, 0, cols, A_NORMAL, "%s", output[line]);
+	}
+
+	if (command_len >= 0) {
+		put(rows - 1, 0, cols, A_NORMAL, ":%s", command);
+	} else {
+		put(rows - 1, 0, cols, A_NORMAL, "%s", status);
+	}
+
+	flush();
+	last_draw = now_ns();
+}
+
+static int input_pending(void) {
+	struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+	return poll(&fd, 1, 0) > 0;
+}
+
+static int read_key(void) {
+	unsigned char c;
+	if (read(STDIN_FILENO, &c, 1) != 1) return 'q';
+	if (c != 0x1b || !input_pending()) return c;
+
+	// page up/down and arrows scroll the memory view
+	unsigned char seq[3] = {0};
+	if (read(STDIN_FILENO, seq, 2) != 2 || seq[0] != '[') return 0;
+	if (seq[1] == 'A') return 'k';
+	if (seq[1] == 'B') return 'j';
+	if ((seq[1] == '5' || seq[1] == '6') && read(STDIN_FILENO, seq + 2, 1) == 1) return seq[1] == '5' ? 'K' : 'J';
+	return 0;
+}
+
+static int parse_hex(const char* s, uint16_t* value) {
+	if (s[0] == 'x' || s[0] == 'X') s++;
+	else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s += 2;
+	char* end;
+	unsigned long v = strtoul(s, &end, 16);
+	if (!*s || *end || v > 0xFFFF) return 0;
+	*value = v;
+	return 1;
+}
+
+// run a : command; returns 1 if it started execution
+static int run_command(void) {
+	char* argument = strchr(command, ' ');
+	if (argument) *argument++ = '\0';
+
+	if (!strcmp(command, "step") || !strcmp(command, "s")) {
+		long n = argument ? strtol(argument, NULL, 10) : 1;
+		if (n < 1) {
+			snprintf(status, sizeof(status), "Usage: step [n]");
+			return 0;
+		}
+		pending_steps = n - 1;
+		return 1;
+	} else if (!strcmp(command, "memory") || !strcmp(command, "m")) {
+		if (!argument || !parse_hex(argument, &memory_view)) {
+			snprintf(status, sizeof(status), "Usage: memory ADDR");
+		}
+		return 0;
+	}
+	snprintf(status, sizeof(status), "Unknown command: %s (try step N or memory ADDR)", command);
+	return 0;
+}
+
+static void remember_registers(void) {
+	memcpy(last_reg, reg, sizeof(last_reg));
+}
+
+// a few words for the status line about the instruction we're about to run
+static void describe_next(void) {
+	uint16_t instr = memory[(uint16_t) (reg[R_PC] - 1)];
+	if (instr == (0xF000 | TRAP_GETC) || instr == (0xF000 | TRAP_IN)) {
+		snprintf(status, sizeof(status), "The guest is waiting for a key...");
+		draw();
+	}
+}
+
+void tui_enter(void) {
+	tui_active = 1;
+	front = back = NULL;
+	rows = cols = 0;
+	status[0] = '\0';
+	command_len = -1;
+	pending_steps = 0;
+	remember_registers();
+	emit("\x1b[?1049h\x1b[?25l", 14); // alternate screen, hide the cursor
+}
+
+void tui_leave(void) {
+	if (!tui_active) return;
+	tui_active = 0;
+	emit("\x1b[0m\x1b[?25h\x1b[?1049l", 18);
+	write_out();
+	free(front);
+	free(back);
+	front = back = NULL;
+}
+
+int tui_step(void) {
+	if (pending_steps > 0) {
+		pending_steps--;
+		if (now_ns() - last_draw >= FRAME_NS) {
+			snprintf(status, sizeof(status), "Stepping, %ld to go...", pending_steps);
+			draw();
+		}
+		return TUI_RUN;
+	}
+
+	if (status[0] && !strncmp(status, "Stepping", 8)) status[0] = '\0';
+	while (1) {
+		// when a step key is held down, catch up on the queued presses before drawing again
+		if (!input_pending() || now_ns() - last_draw >= FRAME_NS) draw();
+
+		int key = read_key();
+		if (command_len >= 0) {
+			// typing a : command
+			if (key == '\n' || key == '\r') {
+				command_len = -1;
+				if (run_command()) {
+					remember_registers();
+					return TUI_RUN;
+				}
+			} else if (key == 0x7F || key == '\b') {
+				if (command_len > 0) command[--command_len] = '\0';
+			} else if (key == 0x1b) {
+				command_len = -1;
+			} else if (key >= ' ' && key < 127 && command_len < (int) sizeof(command) - 1) {
+				command[command_len++] = key;
+				command[command_len] = '\0';
+			}
+			continue;
+		}
+
+		switch (key) {
+		case 's':
+		case ' ':
+			status[0] = '\0';
+			remember_registers();
+			describe_next();
+			return TUI_RUN;
+		case 'n':
+			pending_steps = STEP_MANY - 1;
+			remember_registers();
+			return TUI_RUN;
+		case 'c':
+			tui_leave();
+			next_state = S_TURBO;
+			return TUI_RUN;
+		case 'q':
+			tui_leave();
+			return TUI_PROMPT;
+		case ':':
+			command_len = 0;
+			command[0] = '\0';
+			break;
+		case 'j':
+			memory_view += memory_per_line;
+			break;
+		case 'k':
+			memory_view -= memory_per_line;
+			break;
+		case 'J':
+			memory_view += memory_per_line * 16;
+			break;
+		case 'K':
+			memory_view -= memory_per_line * 16;
+			break;
+		}
+	}
+}
+
+void tui_output(char c) {
+	if (c == '\n') {
+		output_line = (output_line + 1) % OUTPUT_LINES;
+		output_col = 0;
+		output[output_line][0] = '\0';
+	} else if (c == '\r') {
+		output_col = 0;
+	} else if (output_col < OUTPUT_WIDTH - 1) {
+		output[output_line][output_col++] = c;
+		output[output_line][output_col] = '\0';
+	}
+}
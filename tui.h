@@ -0,0 +1,27 @@
+#ifndef TUI_H
+#define TUI_H
+
+// Full-screen single-step debugger: registers, disassembly around the PC, a
+//	memory view, the stack around R6 and the guest's output, all on one screen.
+//	Drawing goes to an off-screen buffer that's diffed against what the terminal
+//	already shows, so only changed cells are sent, and redraws are capped at the
+//	terminal's refresh rate while stepping many instructions.
+
+extern int tui_active;
+
+// what to do with the instruction that was just fetched
+enum {
+	TUI_RUN = 0,	// execute it
+	TUI_PROMPT	// the user left the TUI; ask at the (lc3vm) prompt instead
+};
+
+void tui_enter(void);
+void tui_leave(void);
+
+// called before each instruction in single-step mode while the TUI is active
+int tui_step(void);
+
+// guest output while the TUI owns the screen
+void tui_output(char c);
+
+#endif